@@ -31,6 +31,7 @@
 #include "system.h"
 #include "thread.h"
 #include "file.h"
+#include "async_io.h"
 #include "panic.h"
 #include "lcd.h"
 #include "font.h"
@@ -50,6 +51,7 @@
 #include "metadata.h"
 #ifdef HAVE_ALBUMART
 #include "albumart.h"
+#include "albumart_cache.h"
 #include "jpeg_load.h"
 #include "bmp.h"
 #include "playback.h"
@@ -139,6 +141,15 @@ static int base_handle_id;
 /* Main lock for adding / removing handles */
 static struct mutex llist_mutex SHAREDBSS_ATTR;
 
+#ifdef HAVE_ALBUMART
+/* Key of the album art being loaded, and of the last one that had to be
+   decoded and is waiting to be written to the album art cache once the
+   buffering thread is idle. Both are protected by llist_mutex. */
+static struct albumart_cache_key aa_cache_key;
+static struct albumart_cache_key aa_cache_pending_key;
+static int aa_cache_pending_id = ERR_HANDLE_NOT_FOUND;
+#endif
+
 /* Handle cache (makes find_handle faster).
    This is global so that move_handle and rm_handle can invalidate it. */
 static struct memory_handle *cached_handle = NULL;
@@ -175,6 +186,8 @@ static const char buffering_thread_name[] = "buffering";
 static unsigned int buffering_thread_id = 0;
 static struct event_queue buffering_queue SHAREDBSS_ATTR;
 static struct queue_sender_list buffering_queue_sender_list SHAREDBSS_ATTR;
+/* read in flight for buffer_handle() */
+static struct async_io_request buffering_io;
 
 
 
@@ -629,6 +642,27 @@ static inline bool buffer_is_low(void)
     return data_counters.useful < BUF_WATERMARK / 2;
 }
 
+/* How much of h can be read in one go at its write position. Sets *stop if
+   that is all there is room for before the reading position or the next
+   handle */
+static ssize_t buffer_chunk_size(struct memory_handle *h, bool *stop)
+{
+    /* max amount to copy */
+    ssize_t copy_n = MIN( MIN(h->filerem, BUFFERING_DEFAULT_FILECHUNK),
+                         buffer_len - h->widx);
+    uintptr_t offset = h->next ? ringbuf_offset(h->next) : buf_ridx;
+    ssize_t overlap = ringbuf_add_cross(h->widx, copy_n, offset) + 1;
+
+    if (overlap > 0) {
+        /* read only up to available space and stop if it would overwrite
+           or be on top of the reading position or the next handle */
+        *stop = true;
+        copy_n -= overlap;
+    }
+
+    return copy_n;
+}
+
 /* Q_BUFFER_HANDLE event and buffer data for the given handle.
    Return whether or not the buffering should continue explicitly.  */
 static bool buffer_handle(int handle_id, size_t to_buffer)
@@ -680,26 +714,20 @@ static bool buffer_handle(int handle_id, size_t to_buffer)
         return true;
     }
 
-    while (h->filerem > 0 && !stop)
-    {
-        /* max amount to copy */
-        ssize_t copy_n = MIN( MIN(h->filerem, BUFFERING_DEFAULT_FILECHUNK),
-                             buffer_len - h->widx);
-        uintptr_t offset = h->next ? ringbuf_offset(h->next) : buf_ridx;
-        ssize_t overlap = ringbuf_add_cross(h->widx, copy_n, offset) + 1;
-
-        if (overlap > 0) {
-            /* read only up to available space and stop if it would overwrite
-               or be on top of the reading position or the next handle */
-            stop = true;
-            copy_n -= overlap;
-        }
+    /* Keep the next read going while the previous chunk is accounted for
+       and the codec is given time, so that the disk doesn't sit idle */
+    ssize_t copy_n = buffer_chunk_size(h, &stop);
+    if (copy_n <= 0)
+        return false; /* no space for read */
 
-        if (copy_n <= 0)
-            return false; /* no space for read */
+    read_async(&buffering_io, h->fd, &buffer[h->widx], copy_n, NULL, NULL);
+
+    while (1)
+    {
+        async_io_wait(&buffering_io, TIMEOUT_BLOCK);
 
         /* rc is the actual amount read */
-        int rc = read(h->fd, &buffer[h->widx], copy_n);
+        int rc = buffering_io.result;
 
         if (rc <= 0) {
             /* Some kind of filesystem error, maybe recoverable if not codec */
@@ -721,14 +749,8 @@ static bool buffer_handle(int handle_id, size_t to_buffer)
         h->available += rc;
         h->filerem -= rc;
 
-        /* If this is a large file, see if we need to break or give the codec
-         * more time */
-        if (h->type == TYPE_PACKET_AUDIO &&
-            pcmbuf_is_lowdata() && !buffer_is_low()) {
-            sleep(1);
-        } else {
-            yield();
-        }
+        if (h->filerem == 0 || stop)
+            break;
 
         if (to_buffer == 0) {
             /* Normal buffering - check queue */
@@ -739,6 +761,28 @@ static bool buffer_handle(int handle_id, size_t to_buffer)
                 break; /* Done */
             to_buffer -= rc;
         }
+
+        copy_n = buffer_chunk_size(h, &stop);
+        if (copy_n <= 0)
+            return false; /* no space for read */
+
+        read_async(&buffering_io, h->fd, &buffer[h->widx], copy_n,
+                   NULL, NULL);
+
+        /* If this is a large file, see if we need to break or give the codec
+         * more time */
+        if (h->type == TYPE_PACKET_AUDIO &&
+            pcmbuf_is_lowdata() && !buffer_is_low()) {
+            sleep(1);
+        } else {
+            yield();
+        }
+
+        /* Take back the read if it hasn't started yet and something else
+           needs doing, otherwise it is finished first */
+        if (to_buffer == 0 && !queue_empty(&buffering_queue) &&
+            async_io_cancel(&buffering_io))
+            break;
     }
 
     if (h->filerem == 0) {
@@ -863,7 +907,7 @@ static bool fill_buffer(void)
    buffer, with a struct bitmap and the actual data immediately following.
    Return value is the total size (struct + data). */
 static int load_image(int fd, const char *path,
-                      struct bufopen_bitmap_data *data)
+                      struct bufopen_bitmap_data *data, int handle_id)
 {
     int rc;
     struct bitmap *bmp = (struct bitmap *)&buffer[buf_widx];
@@ -884,11 +928,25 @@ static int load_image(int fd, const char *path,
     int free = (int)MIN(buffer_len - BUF_USED, buffer_len - buf_widx)
                                - sizeof(struct bitmap);
 
+    /* Reading back an already scaled copy is much cheaper than decoding */
+    bool have_key = albumart_cache_get_key(&aa_cache_key, fd, path, aa, dim);
+    if (have_key) {
+        rc = albumart_cache_load(&aa_cache_key, bmp, free);
+        if (rc > 0)
+            return rc + sizeof(struct bitmap);
+    }
+
 #ifdef HAVE_JPEG
     if (aa != NULL) {
         lseek(fd, aa->pos, SEEK_SET);
-        rc = clip_jpeg_fd(fd, aa->size, bmp, free, FORMAT_NATIVE|FORMAT_DITHER|
-                         FORMAT_RESIZE|FORMAT_KEEP_ASPECT, NULL);
+        if (aa->base64)
+            rc = clip_jpeg_fd_base64(fd, aa->skip, aa->size, bmp, free,
+                                     FORMAT_NATIVE|FORMAT_DITHER|
+                                     FORMAT_RESIZE|FORMAT_KEEP_ASPECT, NULL);
+        else
+            rc = clip_jpeg_fd(fd, aa->size, bmp, free, FORMAT_NATIVE|
+                              FORMAT_DITHER|FORMAT_RESIZE|FORMAT_KEEP_ASPECT,
+                              NULL);
     }
     else if (strcmp(path + strlen(path) - 4, ".bmp"))
         rc = read_jpeg_fd(fd, bmp, free, FORMAT_NATIVE|FORMAT_DITHER|
@@ -897,8 +955,47 @@ static int load_image(int fd, const char *path,
 #endif
         rc = read_bmp_fd(fd, bmp, free, FORMAT_NATIVE|FORMAT_DITHER|
                          FORMAT_RESIZE|FORMAT_KEEP_ASPECT, NULL);
+
+    if (rc > 0 && have_key) {
+        /* Only one save is kept pending, a newer one replaces it */
+        aa_cache_pending_key = aa_cache_key;
+        aa_cache_pending_id = handle_id;
+    }
     return rc + (rc > 0 ? sizeof(struct bitmap) : 0);
 }
+
+/* Write the last decoded album art to the cache, if its handle still
+   exists. Call only from the buffering thread: handles are only closed
+   there, so pinning the handle keeps its data in place while the file is
+   written without holding llist_mutex. */
+static void save_albumart_cache(void)
+{
+    static struct albumart_cache_key key; /* too big for the stack */
+    struct bitmap *bmp = NULL;
+    size_t size = 0;
+
+    mutex_lock(&llist_mutex);
+
+    int handle_id = aa_cache_pending_id;
+    struct memory_handle *h = find_handle(handle_id);
+    if (h && h->type == TYPE_BITMAP && h->available == h->filesize) {
+        h->pinned++;
+        key = aa_cache_pending_key;
+        bmp = (struct bitmap *)&buffer[h->data];
+        size = h->filesize - sizeof(struct bitmap);
+    }
+    aa_cache_pending_id = ERR_HANDLE_NOT_FOUND;
+
+    mutex_unlock(&llist_mutex);
+
+    if (bmp) {
+        albumart_cache_save(&key, bmp, size);
+
+        mutex_lock(&llist_mutex);
+        buf_pin_handle(handle_id, false);
+        mutex_unlock(&llist_mutex);
+    }
+}
 #endif
 
 
@@ -1042,7 +1139,8 @@ int bufopen(const char *file, size_t offset, enum data_type type,
     if (type == TYPE_BITMAP) {
         /* Bitmap file: we load the data instead of the file */
         int rc;
-        rc = load_image(fd, file, (struct bufopen_bitmap_data*)user_data);
+        rc = load_image(fd, file, (struct bufopen_bitmap_data*)user_data,
+                        handle_id);
         if (rc <= 0) {
             rm_handle(h);
             handle_id = ERR_FILE_ERROR;
@@ -1703,6 +1801,11 @@ static void NORETURN_ATTR buffering_thread(void)
         if (filling) {
             filling = data_counters.remaining > 0 ? fill_buffer() : false;
         } else if (ev.id == SYS_TIMEOUT) {
+#ifdef HAVE_ALBUMART
+            /* Nothing to fill, the disk was just in use */
+            if (aa_cache_pending_id >= 0)
+                save_albumart_cache();
+#endif
             if (data_counters.useful < BUF_WATERMARK) {
                 /* The buffer is low and we're idle, just watching the levels
                    - call the callbacks to get new data */
@@ -80,6 +80,7 @@
 #endif
 #include "logfdisp.h"
 #include "core_alloc.h"
+#include "sched_trace.h"
 #if CONFIG_CODEC == SWCODEC
 #include "pcmbuf.h"
 #include "buffering.h"
@@ -1447,6 +1448,77 @@ static bool dbg_disk_info(void)
     info.scroll_all = true;
     return simplelist_show_list(&info);
 }
+
+static int file_cache_callback(int btn, struct gui_synclist *lists)
+{
+    (void)lists;
+    struct file_cache_stats stats;
+    file_cache_get_stats(&stats);
+    simplelist_set_line_count(0);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Hits: %lu", stats.hits);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Misses: %lu", stats.misses);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Reads: %lu", stats.reads);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Coalesced: %lu",
+             stats.coalesced);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Writes: %lu", stats.writes);
+    if (btn == ACTION_NONE)
+        btn = ACTION_REDRAW;
+    return btn;
+}
+
+static bool dbg_file_cache_info(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "File Cache Info", 5, NULL);
+    info.action_callback = file_cache_callback;
+    info.hide_selection = true;
+    info.scroll_all = true;
+    return simplelist_show_list(&info);
+}
+
+#ifdef HAVE_IO_PRIORITY
+static int io_queue_callback(int btn, struct gui_synclist *lists)
+{
+    static const char * const class_names[STORAGE_NUM_CLASSES] =
+        { "Foreground", "Background" };
+    struct storage_queue_stats stats;
+    int i;
+    (void)lists;
+
+    storage_get_queue_stats(IF_MD2(0,) &stats);
+    simplelist_set_line_count(0);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Queue depth: %d (max %d)",
+             stats.depth, stats.max_depth);
+    simplelist_addline(SIMPLELIST_ADD_LINE, "Served late: %lu", stats.late);
+    for (i = 0; i < STORAGE_NUM_CLASSES; i++)
+    {
+        simplelist_addline(SIMPLELIST_ADD_LINE, "%s:", class_names[i]);
+        simplelist_addline(SIMPLELIST_ADD_LINE, " Transfers: %lu",
+                 stats.requests[i]);
+        simplelist_addline(SIMPLELIST_ADD_LINE, " Queued: %lu",
+                 stats.waited[i]);
+        simplelist_addline(SIMPLELIST_ADD_LINE, " Avg wait: %ld ms",
+                 stats.waited[i] ? (long)(stats.wait_ticks[i] * (1000/HZ)
+                                          / stats.waited[i]) : 0);
+        simplelist_addline(SIMPLELIST_ADD_LINE, " Max wait: %ld ms",
+                 stats.max_wait[i] * (1000/HZ));
+    }
+    if (btn == ACTION_NONE)
+        btn = ACTION_REDRAW;
+    return btn;
+}
+
+static bool dbg_io_queue_info(void)
+{
+    struct simplelist_info info;
+    simplelist_info_init(&info, "I/O Queue Info", 2 + 5*STORAGE_NUM_CLASSES,
+                         NULL);
+    info.action_callback = io_queue_callback;
+    info.hide_selection = true;
+    info.scroll_all = true;
+    return simplelist_show_list(&info);
+}
+#endif /* HAVE_IO_PRIORITY */
 #endif /* PLATFORM_NATIVE */
 
 #ifdef HAVE_DIRCACHE
@@ -1774,6 +1846,20 @@ static bool dbg_screendump(void)
 }
 #endif /* HAVE_LCD_BITMAP */
 
+#ifdef DO_SCHED_TRACE
+static bool dbg_sched_trace_dump(void)
+{
+    splash(0, "Writing scheduler trace...");
+
+    if (sched_trace_dump(SCHED_TRACE_FILE) < 0)
+        splashf(HZ, "Could not write %s", SCHED_TRACE_FILE);
+    else
+        splashf(HZ, "Saved %s", SCHED_TRACE_FILE);
+
+    return false;
+}
+#endif /* DO_SCHED_TRACE */
+
 extern bool write_metadata_log;
 
 static bool dbg_metadatalog(void)
@@ -2043,6 +2129,9 @@ static const struct the_menu_item menuitems[] = {
         { "Catch mem accesses", dbg_set_memory_guard },
 #endif
         { "View OS stacks", dbg_os },
+#ifdef DO_SCHED_TRACE
+        { "Dump scheduler trace", dbg_sched_trace_dump },
+#endif
 #ifdef HAVE_LCD_BITMAP
 #if (CONFIG_PLATFORM & PLATFORM_NATIVE)
         { "View battery", view_battery },
@@ -2057,6 +2146,10 @@ static const struct the_menu_item menuitems[] = {
 #endif
 #if (CONFIG_PLATFORM & PLATFORM_NATIVE)
         { "View disk info", dbg_disk_info },
+        { "View file cache info", dbg_file_cache_info },
+#ifdef HAVE_IO_PRIORITY
+        { "View I/O queue info", dbg_io_queue_info },
+#endif
 #if (CONFIG_STORAGE & STORAGE_ATA)
         { "Dump ATA identify info", dbg_identify_info},
 #endif
@@ -53,9 +53,232 @@
 #include "radio.h"
 #endif
 #include "wps.h"
+#ifdef HAVE_DIRCACHE
+#include "dircache.h"
+#endif
 
 static int compare_sort_dir; /* qsort key for sorting directories */
 
+#ifdef HAVE_DIRCACHE
+/* Cache of filtered and sorted directory listings, so that entering a
+ * directory again (going back up, reloading after starting playback) does
+ * not read and sort it all over again.  It is only used while dircache is
+ * enabled: a listing is keyed by the dircache id of its directory and stays
+ * valid as long as the dircache modification stamp doesn't change.
+ *
+ * Every listing is its own buflib allocation, which buflib may take back when
+ * it runs out of memory. Least recently used listings are evicted to keep
+ * the total below FT_CACHE_BUDGET. */
+#define FT_CACHE_SLOTS      8
+#if MEMORYSIZE > 8
+#define FT_CACHE_BUDGET     (256*1024)
+#else
+#define FT_CACHE_BUDGET     (64*1024)
+#endif
+#define FT_CACHE_ROOT_ID    (-2) /* dircache has no entry for "/" */
+
+struct ft_cache_key {
+    int dir_id;             /* dircache entry id of the directory */
+    unsigned long stamp;    /* dircache modification stamp */
+    int dirfilter;
+    int sort_dir;
+    int sort_file;
+    bool sort_case;
+    int interpret_numbers;
+    bool talk_file_clip;    /* thumbnail flags are set in attr */
+};
+
+/* stored in the allocation, followed by the name buffer */
+struct ft_cache_entry {
+    int name;               /* offset in the name buffer */
+    int attr;
+    unsigned time_write;
+};
+
+struct ft_cache_slot {
+    struct ft_cache_key key;
+    int handle;             /* buflib handle, 0 if the slot is unused */
+    size_t size;            /* 0 if the allocation was shrunk away */
+    int files;
+    int dirs;
+    int names_size;
+    unsigned last_used;
+};
+
+static struct ft_cache_slot ft_cache[FT_CACHE_SLOTS];
+static size_t ft_cache_used;
+static unsigned ft_cache_clock;
+
+static int ft_cache_move_callback(int handle, void* current, void* new)
+{
+    /* only offsets are stored, nothing to fix up */
+    (void)handle; (void)current; (void)new;
+    return BUFLIB_CB_OK;
+}
+
+static int ft_cache_shrink_callback(int handle, unsigned hints,
+                                    void* start, size_t old_size)
+{
+    /* can't free from within the callback, give up all the memory instead
+     * and leave freeing the handle to the next cache access */
+    (void)hints; (void)old_size;
+    for (int i = 0; i < FT_CACHE_SLOTS; i++)
+    {
+        if (ft_cache[i].handle == handle && ft_cache[i].size)
+        {
+            if (!core_shrink(handle, start, 0))
+                return BUFLIB_CB_CANNOT_SHRINK;
+            ft_cache_used -= ft_cache[i].size;
+            ft_cache[i].size = 0;
+            return BUFLIB_CB_OK;
+        }
+    }
+    return BUFLIB_CB_CANNOT_SHRINK;
+}
+
+static struct buflib_callbacks ft_cache_ops = {
+    .move_callback = ft_cache_move_callback,
+    .shrink_callback = ft_cache_shrink_callback,
+};
+
+static void ft_cache_free(struct ft_cache_slot *slot)
+{
+    core_free(slot->handle);
+    ft_cache_used -= slot->size;
+    slot->handle = 0;
+    slot->size = 0;
+}
+
+/* Fills the key for a directory. Returns false if it can't be cached. */
+static bool ft_cache_get_key(struct tree_context* c, const char *path,
+                             struct ft_cache_key *key)
+{
+    if (!dircache_is_enabled())
+        return false;
+
+    memset(key, 0, sizeof(*key)); /* keys are compared with memcmp */
+    if (path[0] == '/' && path[1] == '\0')
+        key->dir_id = FT_CACHE_ROOT_ID;
+    else if ((key->dir_id = dircache_get_entry_id(path)) < 0)
+        return false;
+
+    key->sort_dir = c->sort_dir;
+    key->sort_file = global_settings.sort_file;
+    /* file times only matter when sorting by date */
+    key->stamp = dircache_get_modification_stamp(
+                    key->sort_dir == SORT_DATE ||
+                    key->sort_dir == SORT_DATE_REVERSED ||
+                    key->sort_file == SORT_DATE ||
+                    key->sort_file == SORT_DATE_REVERSED);
+    key->dirfilter = *c->dirfilter;
+    key->sort_case = global_settings.sort_case;
+    key->interpret_numbers = global_settings.interpret_numbers;
+    key->talk_file_clip = global_settings.talk_file_clip;
+    return true;
+}
+
+/* Copies a cached listing into the tree cache, returns false on a miss */
+static bool ft_cache_load(struct tree_context* c,
+                          const struct ft_cache_key *key)
+{
+    struct ft_cache_slot *hit = NULL;
+
+    for (int i = 0; i < FT_CACHE_SLOTS; i++)
+    {
+        struct ft_cache_slot *slot = &ft_cache[i];
+        if (!slot->handle)
+            continue;
+
+        /* drop listings taken away by buflib or made stale by changes */
+        if (!slot->size || slot->key.stamp != key->stamp)
+            ft_cache_free(slot);
+        else if (!memcmp(&slot->key, key, sizeof(*key)))
+            hit = slot;
+    }
+
+    if (!hit || hit->files > c->cache.max_entries ||
+        hit->names_size > c->cache.name_buffer_size)
+        return false;
+
+    struct ft_cache_entry *cached = core_get_data(hit->handle);
+    char *names = core_get_data(c->cache.name_buffer_handle);
+    struct entry *entries = tree_get_entries(c);
+
+    memcpy(names, &cached[hit->files], hit->names_size);
+    for (int i = 0; i < hit->files; i++)
+    {
+        entries[i].name = names + cached[i].name;
+        entries[i].attr = cached[i].attr;
+        entries[i].time_write = cached[i].time_write;
+    }
+
+    c->filesindir = hit->files;
+    c->dirlength = hit->files;
+    c->dirsindir = hit->dirs;
+    c->dirfull = false;
+
+    hit->last_used = ++ft_cache_clock;
+    return true;
+}
+
+/* Stores the listing that was just loaded into the tree cache */
+static void ft_cache_store(struct tree_context* c,
+                           const struct ft_cache_key *key, int names_size)
+{
+    struct ft_cache_slot *slot = NULL;
+    size_t size = c->filesindir*sizeof(struct ft_cache_entry) + names_size;
+
+    if (size > FT_CACHE_BUDGET)
+        return;
+
+    /* evict least recently used listings until it fits */
+    while (1)
+    {
+        struct ft_cache_slot *lru = NULL;
+        slot = NULL;
+        for (int i = 0; i < FT_CACHE_SLOTS; i++)
+        {
+            if (!ft_cache[i].handle)
+                slot = &ft_cache[i];
+            else if (!lru || ft_cache[i].last_used < lru->last_used)
+                lru = &ft_cache[i];
+        }
+
+        if (slot && ft_cache_used + size <= FT_CACHE_BUDGET)
+            break;
+        else if (!lru)
+            return;
+
+        ft_cache_free(lru);
+    }
+
+    int handle = core_alloc_ex("ft cache", size, &ft_cache_ops);
+    if (handle <= 0)
+        return;
+
+    struct ft_cache_entry *cached = core_get_data(handle);
+    char *names = core_get_data(c->cache.name_buffer_handle);
+    struct entry *entries = tree_get_entries(c);
+
+    for (int i = 0; i < c->filesindir; i++)
+    {
+        cached[i].name = entries[i].name - names;
+        cached[i].attr = entries[i].attr;
+        cached[i].time_write = entries[i].time_write;
+    }
+    memcpy(&cached[c->filesindir], names, names_size);
+
+    slot->key = *key;
+    slot->handle = handle;
+    slot->size = size;
+    slot->files = c->filesindir;
+    slot->dirs = c->dirsindir;
+    slot->names_size = names_size;
+    slot->last_used = ++ft_cache_clock;
+    ft_cache_used += size;
+}
+#endif /* HAVE_DIRCACHE */
+
 int ft_build_playlist(struct tree_context* c, int start_index)
 {
     int i;
@@ -280,14 +503,30 @@ int ft_load(struct tree_context* c, const char* tempdir)
     struct dirent *entry;
     bool (*callback_show_item)(char *, int, struct tree_context *) = NULL;
     DIR *dir;
+#ifdef HAVE_DIRCACHE
+    struct ft_cache_key key;
+    bool cacheable;
+#endif
 
-    if (tempdir)
-        dir = opendir(tempdir);
-    else
-    {
-        dir = opendir(c->currdir);
+    if (!tempdir)
         callback_show_item = c->browse? c->browse->callback_show_item: NULL;
+
+#ifdef HAVE_DIRCACHE
+    /* custom browsers may filter anything, don't cache those */
+    cacheable = !callback_show_item &&
+                ft_cache_get_key(c, tempdir ? tempdir : c->currdir, &key);
+    if (cacheable)
+    {
+        bool hit;
+        tree_lock_cache(c);
+        hit = ft_cache_load(c, &key);
+        tree_unlock_cache(c);
+        if (hit)
+            return 0;
     }
+#endif
+
+    dir = opendir(tempdir ? tempdir : c->currdir);
     if(!dir)
         return -1; /* not a directory */
 
@@ -398,6 +637,12 @@ int ft_load(struct tree_context* c, const char* tempdir)
     if (global_settings.talk_file_clip)
         check_file_thumbnails(c); /* map .talk to ours */
 
+#ifdef HAVE_DIRCACHE
+    /* a partial listing would hide entries once the buffer got larger */
+    if (cacheable && !c->dirfull)
+        ft_cache_store(c, &key, name_buffer_used);
+#endif
+
     tree_unlock_cache(c);
     return 0;
 }
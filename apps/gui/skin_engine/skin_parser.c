@@ -1563,6 +1563,8 @@ static int convert_viewport(struct wps_data *data, struct skin_element* element)
     skin_vp->hidden_flags = 0;
     skin_vp->label = NULL;
     skin_vp->is_infovp = false;
+    skin_vp->plan = NULL;
+    skin_vp->plan_count = 0;
     element->data = skin_vp;
     curr_vp = skin_vp;
     curr_viewport_element = element;
@@ -1869,6 +1871,135 @@ static int skin_element_callback(struct skin_element* element, void* data)
     return CALLBACK_OK;
 }
 
+static void plan_scan_element(struct skin_element *element,
+                              struct skin_line_plan *plan, bool nested)
+{
+    struct skin_element *child;
+    unsigned flags;
+    int i;
+
+    switch (element->type)
+    {
+        case LINE_ALTERNATOR:
+            /* sublines change with time */
+            plan->flags |= SKIN_PLAN_ALWAYS;
+            for (i = 0; i < element->children_count; i++)
+                plan_scan_element(element->children[i], plan, true);
+            break;
+        case LINE:
+            if (element->children_count == 0)
+                break;
+            for (child = element->children[0]; child; child = child->next)
+                plan_scan_element(child, plan, nested);
+            break;
+        case CONDITIONAL:
+        case TAG:
+            flags = element->tag->flags;
+            if (flags&SKIN_RTC_REFRESH)
+            {
+#if CONFIG_RTC
+                plan->depends |= SKIN_REFRESH_DYNAMIC;
+#else
+                plan->depends |= SKIN_REFRESH_STATIC;
+#endif
+            }
+            else
+                plan->depends |= flags&SKIN_REFRESH_ALL;
+
+            if (element->type == CONDITIONAL)
+            {
+                for (i = 0; i < element->children_count; i++)
+                    plan_scan_element(element->children[i], plan, true);
+                break;
+            }
+
+            /* a line break that depends on a conditional can only be
+             * known by evaluating the line */
+            if (flags&NOBREAK)
+                plan->flags |= nested ? SKIN_PLAN_ALWAYS : SKIN_PLAN_NOBREAK;
+
+            switch (element->tag->type)
+            {
+                case SKIN_TOKEN_VIEWPORT_FGCOLOUR:
+                case SKIN_TOKEN_VIEWPORT_BGCOLOUR:
+                case SKIN_TOKEN_VIEWPORT_TEXTSTYLE:
+                case SKIN_TOKEN_VIEWPORT_GRADIENT_SETUP:
+                    plan->flags |= SKIN_PLAN_ALWAYS|SKIN_PLAN_COLOURS;
+                    break;
+                case SKIN_TOKEN_VIEWPORT_ENABLE:
+                case SKIN_TOKEN_UIVIEWPORT_ENABLE:
+                case SKIN_TOKEN_DRAW_INBUILTBAR:
+                case SKIN_TOKEN_VAR_SET:
+                    plan->flags |= SKIN_PLAN_ALWAYS;
+                    break;
+                case SKIN_TOKEN_IMAGE_DISPLAY_LISTICON:
+                case SKIN_TOKEN_IMAGE_PRELOAD_DISPLAY:
+                    /* images are hidden again on every refresh */
+                    plan->flags |= SKIN_PLAN_ALWAYS|SKIN_PLAN_DRAWS;
+                    break;
+                case SKIN_TOKEN_PEAKMETER:
+                case SKIN_TOKEN_PEAKMETER_LEFTBAR:
+                case SKIN_TOKEN_PEAKMETER_RIGHTBAR:
+                case SKIN_TOKEN_VOLUMEBAR:
+                case SKIN_TOKEN_BATTERY_PERCENTBAR:
+                case SKIN_TOKEN_PROGRESSBAR:
+                case SKIN_TOKEN_TUNER_RSSI_BAR:
+                case SKIN_TOKEN_ALBUMART_DISPLAY:
+                case SKIN_TOKEN_VIEWPORT_CUSTOMLIST:
+                    plan->flags |= SKIN_PLAN_DRAWS;
+                    break;
+                default:
+                    break;
+            }
+            break;
+        case TEXT:
+            plan->depends |= SKIN_REFRESH_STATIC;
+            break;
+        default:
+            break;
+    }
+}
+
+/* Flatten each viewport's lines into an array recording which refresh
+ * types can change them, so that the renderer doesn't have to evaluate
+ * every token on every refresh. Viewports for which there is no room left
+ * simply get rendered by walking the tree. */
+static void skin_compile_render_plan(struct wps_data *data)
+{
+    struct skin_element *viewport, *line;
+
+    for (viewport = data->tree; viewport; viewport = viewport->next)
+    {
+        struct skin_viewport *skin_vp = (struct skin_viewport*)viewport->data;
+        struct skin_line_plan *plan;
+        int count = 0, i;
+
+        skin_vp->depends = 0;
+        skin_vp->plan_flags = 0;
+        if (viewport->children_count == 0)
+            continue;
+
+        for (line = viewport->children[0]; line; line = line->next)
+            count++;
+        plan = (struct skin_line_plan*)skin_buffer_alloc(count*sizeof(*plan));
+        if (!plan)
+            return;
+
+        for (i = 0, line = viewport->children[0]; line; i++, line = line->next)
+        {
+            plan[i].line = line;
+            plan[i].depends = 0;
+            plan[i].flags = 0;
+            plan[i].last_crc = 0;
+            plan_scan_element(line, &plan[i], false);
+            skin_vp->depends |= plan[i].depends;
+            skin_vp->plan_flags |= plan[i].flags;
+        }
+        skin_vp->plan = plan;
+        skin_vp->plan_count = count;
+    }
+}
+
 /* to setup up the wps-data from a format-buffer (isfile = false)
    from a (wps-)file (isfile = true)*/
 bool skin_data_load(enum screen_type screen, struct wps_data *wps_data,
@@ -1962,6 +2093,7 @@ bool skin_data_load(enum screen_type screen, struct wps_data *wps_data,
 #endif
         return false;
     }
+    skin_compile_render_plan(wps_data);
 
 #ifdef HAVE_LCD_BITMAP
     char bmpdir[MAX_PATH];
@@ -46,6 +46,7 @@
 #include "playlist.h"
 #include "root_menu.h"
 #include "misc.h"
+#include "crc32.h"
 
 
 #define MAX_LINE 1024
@@ -612,6 +613,37 @@ bool skin_render_alternator(struct skin_element* element, struct skin_draw_info
     return changed_lines || ret;
 }
 
+/* Check whether the text about to be written differs from what the line
+ * showed last time, and remember it if so */
+static bool skin_line_changed(struct skin_line_plan *plan,
+                              struct skin_draw_info *info,
+                              unsigned long refresh_type)
+{
+    const char *end = info->cur_align_start + strlen(info->cur_align_start);
+    struct align_pos *align = &info->align;
+    unsigned state[] = {
+        info->line_number,
+        info->text_style,
+        align->left ? align->left - info->buf : -1,
+        align->center ? align->center - info->buf : -1,
+        align->right ? align->right - info->buf : -1,
+#if (LCD_DEPTH > 1) || (defined(HAVE_REMOTE_LCD) && (LCD_REMOTE_DEPTH > 1))
+        info->skin_vp->vp.fg_pattern,
+        info->skin_vp->vp.bg_pattern,
+#endif
+    };
+    unsigned crc = crc_32(info->buf, end - info->buf, 0xffffffff);
+    crc = crc_32(state, sizeof(state), crc);
+
+    if (refresh_type == SKIN_REFRESH_ALL || info->force_redraw ||
+        (plan->flags & SKIN_PLAN_DRAWS) || crc != plan->last_crc)
+    {
+        plan->last_crc = crc;
+        return true;
+    }
+    return false;
+}
+
 static void skin_render_viewport(struct skin_element* viewport, struct gui_wps *gwps,
                                  struct skin_viewport* skin_viewport, unsigned long refresh_type)
 {
@@ -634,6 +666,11 @@ static void skin_render_viewport(struct skin_element* viewport, struct gui_wps *
     
     struct align_pos * align = &info.align;
     bool needs_update;
+    struct skin_line_plan *plan = skin_viewport->plan;
+    /* colour changes restyle every following line, so those viewports
+     * evaluate everything like before */
+    bool skip_lines = plan && refresh_type != SKIN_REFRESH_ALL &&
+                      !(skin_viewport->plan_flags & SKIN_PLAN_COLOURS);
 #ifdef HAVE_LCD_BITMAP
     /* Set images to not to be displayed */
     struct skin_token_list *imglist = gwps->data->images;
@@ -667,6 +704,16 @@ static void skin_render_viewport(struct skin_element* viewport, struct gui_wps *
         align->center = NULL;
         align->right = NULL;
         
+        if (skip_lines && !(plan->flags & SKIN_PLAN_ALWAYS) &&
+            !(plan->depends & refresh_type))
+        {
+            /* nothing this line shows can have changed */
+            if (!(plan->flags & SKIN_PLAN_NOBREAK))
+                info.line_number++;
+            line = line->next;
+            plan++;
+            continue;
+        }
         
         if (line->type == LINE_ALTERNATOR)
             func = skin_render_alternator;
@@ -685,22 +732,24 @@ static void skin_render_viewport(struct skin_element* viewport, struct gui_wps *
             display->set_viewport(&skin_viewport->vp);
         }
 #endif
-        /* only update if the line needs to be, and there is something to write */
-        if (refresh_type && needs_update)
+        /* if the line is a scrolling one we don't want to update
+           too often, so that it has the time to scroll */
+        if (info.line_scrolls && !(refresh_type & SKIN_REFRESH_SCROLL) &&
+            !info.force_redraw)
+            needs_update = false;
+        /* only update if the line needs to be, and there is something
+         * new to write */
+        if (refresh_type && needs_update &&
+            (!plan || skin_line_changed(plan, &info, refresh_type)))
         {
-            if (info.line_scrolls)
-            {
-                /* if the line is a scrolling one we don't want to update
-                   too often, so that it has the time to scroll */
-                if ((refresh_type & SKIN_REFRESH_SCROLL) || info.force_redraw)
-                    write_line(display, align, info.line_number, true, info.text_style);
-            }
-            else
-                write_line(display, align, info.line_number, false, info.text_style);
+            write_line(display, align, info.line_number,
+                       info.line_scrolls, info.text_style);
         }
         if (!info.no_line_break)
             info.line_number++;
         line = line->next;
+        if (plan)
+            plan++;
     }
 #ifdef HAVE_LCD_BITMAP
     wps_display_images(gwps, &skin_viewport->vp);
@@ -766,6 +815,15 @@ void skin_render(struct gui_wps *gwps, unsigned refresh_mode)
             skin_viewport->hidden_flags = VP_DRAW_HIDEABLE;
         }
         
+        /* skip viewports showing nothing that depends on this refresh */
+        if (vp_refresh_mode != SKIN_REFRESH_ALL && skin_viewport->plan &&
+            !(skin_viewport->plan_flags & SKIN_PLAN_ALWAYS) &&
+            !(skin_viewport->depends & vp_refresh_mode))
+        {
+            refresh_mode = old_refresh_mode;
+            continue;
+        }
+        
         display->set_viewport(&skin_viewport->vp);
         if ((vp_refresh_mode&SKIN_REFRESH_ALL) == SKIN_REFRESH_ALL)
         {
@@ -780,7 +838,9 @@ void skin_render(struct gui_wps *gwps, unsigned refresh_mode)
     
     /* Restore the default viewport */
     display->set_viewport(NULL);
-    display->update();
+    /* only push what was actually redrawn, most refreshes only touch a
+     * progressbar or a couple of text lines */
+    display->update_dirty();
 }
 
 #ifdef HAVE_LCD_BITMAP
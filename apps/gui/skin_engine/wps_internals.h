@@ -176,11 +176,29 @@ struct gradient_config {
 /* these are never drawn, nor cleared, i.e. just ignored */
 #define VP_NEVER_VISIBLE    0x8
 #define VP_DEFAULT_LABEL    "|"
+
+/* Render plan for one top level line of a viewport, built once after the
+ * skin is parsed so that refreshes can skip lines whose inputs can't have
+ * changed and lines whose text came out the same as last time. */
+#define SKIN_PLAN_ALWAYS    0x1 /* changes with time or has side effects */
+#define SKIN_PLAN_DRAWS     0x2 /* draws more than text, always write it */
+#define SKIN_PLAN_NOBREAK   0x4 /* never advances the line number */
+#define SKIN_PLAN_COLOURS   0x8 /* changes colours or the text style */
+struct skin_line_plan {
+    struct skin_element *line;
+    unsigned long depends;  /* SKIN_REFRESH_* flags the output depends on */
+    unsigned flags;         /* SKIN_PLAN_* */
+    unsigned last_crc;      /* of what was written last */
+};
 struct skin_viewport {
     struct viewport vp;   /* The LCD viewport struct */
     char hidden_flags;
     bool is_infovp;
     char* label;
+    struct skin_line_plan *plan; /* NULL if it couldn't be built */
+    int plan_count;
+    unsigned long depends;  /* union of the lines' depends */
+    unsigned plan_flags;    /* union of the lines' flags */
 #if LCD_DEPTH > 1
     unsigned start_fgcolour;
     unsigned start_bgcolour;
@@ -62,6 +62,7 @@
 #include "plugin.h"
 #include "misc.h"
 #include "dircache.h"
+#include "async_io.h"
 #ifdef HAVE_TAGCACHE
 #include "tagcache.h"
 #include "tagtree.h"
@@ -371,6 +372,9 @@ static void init(void)
     viewportmanager_init();
 
     storage_init();
+#ifdef HAVE_ASYNC_IO
+    async_io_init();
+#endif
     settings_reset();
     settings_load(SETTINGS_ALL);
     settings_apply(true);
@@ -620,6 +624,10 @@ static void init(void)
         CHART("<settings_load(ALL)");
     }
 
+#ifdef HAVE_ASYNC_IO
+    async_io_init();
+#endif
+
     CHART(">init_dircache(true)");
     rc = init_dircache(true);
     CHART("<init_dircache(true)");
@@ -214,6 +214,8 @@ struct mp3_albumart {
     enum mp3_aa_type type;
     int size;
     off_t pos;
+    bool base64;    /* pos and size are of base64 text (Vorbis comments) */
+    int skip;       /* decoded bytes preceding the image, if base64 */
 };
 #endif
 
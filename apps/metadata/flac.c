@@ -113,6 +113,32 @@ bool get_flac_metadata(int fd, struct mp3entry* id3)
                 return rc;
             }
         } 
+#ifdef HAVE_ALBUMART
+        else if (type == 6 && !id3->embed_albumart) /* 6 is the PICTURE block */
+        {
+            off_t pos = lseek(fd, 0, SEEK_CUR);
+            long len = MIN(i, sizeof(id3->path));
+            int offset;
+
+            if (read(fd, buf, len) < len)
+            {
+                return rc;
+            }
+
+            /* The image data follows the header; use the first picture */
+            offset = parse_flac_picture(buf, len, &id3->albumart);
+            if (offset > 0 && (unsigned long) id3->albumart.size <= i - offset)
+            {
+                id3->albumart.pos = pos + offset;
+                id3->embed_albumart = true;
+            }
+
+            if (lseek(fd, pos + i, SEEK_SET) < 0)
+            {
+                return rc;
+            }
+        }
+#endif
         else if (!last_metadata)
         {
             /* Skip to next metadata block */
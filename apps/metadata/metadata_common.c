@@ -221,6 +221,108 @@ uint32_t get_itunes_int32(char* value, int count)
     return r;
 }
 
+#ifdef HAVE_ALBUMART
+/* Decode base64 text, stopping at padding or any other character outside of
+ * the alphabet. Decoding in place (out == in) is allowed. Returns the number
+ * of bytes written to out.
+ */
+int base64_decode(const char* in, int len, unsigned char* out)
+{
+    unsigned long bits = 0;
+    int count = 0;
+    int n = 0;
+
+    while (len-- > 0)
+    {
+        int c = *in++;
+
+        if (c >= 'A' && c <= 'Z')
+            c -= 'A';
+        else if (c >= 'a' && c <= 'z')
+            c -= 'a' - 26;
+        else if (c >= '0' && c <= '9')
+            c -= '0' - 52;
+        else if (c == '+')
+            c = 62;
+        else if (c == '/')
+            c = 63;
+        else
+            break;
+
+        bits = (bits << 6) | c;
+
+        /* A group of four characters is read before its three bytes are
+         * written, which is what makes decoding in place possible */
+        if (++count == 4)
+        {
+            out[n++] = bits >> 16;
+            out[n++] = bits >> 8;
+            out[n++] = bits;
+            count = 0;
+        }
+    }
+
+    /* Incomplete last group */
+    if (count >= 2)
+        out[n++] = bits >> (count * 6 - 8);
+    if (count == 3)
+        out[n++] = bits >> 2;
+
+    return n;
+}
+
+/* Get the image format and size from the header of a FLAC PICTURE block,
+ * which Vorbis comments also use (base64 encoded) for
+ * METADATA_BLOCK_PICTURE. Returns the offset of the image data from the
+ * start of the block, or -1 if the header isn't complete within len bytes
+ * or the image isn't in a supported format.
+ */
+int parse_flac_picture(unsigned char* buf, long len,
+    struct mp3_albumart* albumart)
+{
+    enum mp3_aa_type type = AA_TYPE_UNKNOWN;
+    unsigned long mime_len, offset;
+
+    /* Skip picture type */
+    if (len < 8)
+    {
+        return -1;
+    }
+
+    mime_len = get_long_be(&buf[4]);
+    offset = 8 + mime_len;
+
+    if (offset + 4 > (unsigned long) len)
+    {
+        return -1;
+    }
+
+    if ((mime_len == 10 && !strncasecmp((char *)&buf[8], "image/jpeg", 10))
+        || (mime_len == 9 && !strncasecmp((char *)&buf[8], "image/jpg", 9)))
+    {
+        type = AA_TYPE_JPG;
+    }
+    else if (mime_len == 9 && !strncasecmp((char *)&buf[8], "image/png", 9))
+    {
+        type = AA_TYPE_PNG;
+    }
+
+    /* Skip description, width, height, depth and number of colors */
+    offset += 4 + get_long_be(&buf[offset]) + 16;
+
+    if (type == AA_TYPE_UNKNOWN || offset + 4 > (unsigned long) len)
+    {
+        return -1;
+    }
+
+    albumart->type = type;
+    albumart->size = get_long_be(&buf[offset]);
+    albumart->base64 = false;
+    albumart->skip = 0;
+    return offset + 4;
+}
+#endif
+
 /* Skip an ID3v2 tag if it can be found. We assume the tag is located at the
  * start of the file, which should be true in all cases where we need to skip it.
  * Returns true if successfully skipped or not skipped, and false if
@@ -67,3 +67,8 @@ int32_t get_slong(void* buf);
 uint32_t get_itunes_int32(char* value, int count);
 long parse_tag(const char* name, char* value, struct mp3entry* id3,
     char* buf, long buf_remaining, enum tagtype type);
+#ifdef HAVE_ALBUMART
+int base64_decode(const char* in, int len, unsigned char* out);
+int parse_flac_picture(unsigned char* buf, long len,
+    struct mp3_albumart* albumart);
+#endif
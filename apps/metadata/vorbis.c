@@ -342,6 +342,42 @@ long read_vorbis_tags(int fd, struct mp3entry *id3,
 
         len -= read_len;
 
+#ifdef HAVE_ALBUMART
+        /* A base64 encoded FLAC PICTURE block. The image can only be decoded
+         * straight from the file if the text isn't split over Ogg pages. */
+        if (!id3->embed_albumart && len <= file.packet_remaining
+            && strcasecmp(name, "METADATA_BLOCK_PICTURE") == 0)
+        {
+            unsigned char *header = (unsigned char *) id3->path;
+            off_t pos = lseek(fd, 0, SEEK_CUR);
+            int offset;
+
+            read_len = file_read_string(&file, id3->path, sizeof(id3->path),
+                -1, len);
+
+            if (read_len < 0)
+            {
+                return 0;
+            }
+
+            /* Decode whole groups of the text that was kept */
+            read_len = base64_decode(id3->path,
+                MIN(len, (int32_t) sizeof(id3->path) - 1) & ~3, header);
+            offset = parse_flac_picture(header, read_len, &id3->albumart);
+
+            if (offset > 0 && id3->albumart.size <= len / 4 * 3 - offset)
+            {
+                id3->albumart.pos = pos + offset / 3 * 4;
+                id3->albumart.size = len - offset / 3 * 4;
+                id3->albumart.base64 = true;
+                id3->albumart.skip = offset % 3;
+                id3->embed_albumart = true;
+            }
+
+            continue;
+        }
+#endif
+
         if (file_read_string(&file, id3->path, sizeof(id3->path), -1, len) < 0)
         {
             return 0;
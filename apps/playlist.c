@@ -137,13 +137,6 @@
 #define PLAYLIST_QUEUED                 0x20000000
 #define PLAYLIST_SKIPPED                0x10000000
 
-struct directory_search_context {
-    struct playlist_info* playlist;
-    int position;
-    bool queue;
-    int count;
-};
-
 static struct playlist_info current_playlist;
 
 static void empty_playlist(struct playlist_info* playlist, bool resume);
@@ -664,6 +657,50 @@ int playlist_remove_all_tracks(struct playlist_info *playlist)
 }
 
 
+/*
+ * Resolve one of the special positions PLAYLIST_PREPEND, PLAYLIST_INSERT,
+ * PLAYLIST_INSERT_FIRST or PLAYLIST_INSERT_LAST into an index.  Tracks put
+ * there always form one contiguous block, which is what allows
+ * playlist_insert_context_add() to insert several of them at once.
+ */
+static int calculate_insert_position(struct playlist_info* playlist,
+                                     int position)
+{
+    switch (position)
+    {
+        case PLAYLIST_PREPEND:
+            return playlist->first_index;
+        case PLAYLIST_INSERT:
+            /* if there are already inserted tracks then add track to end of
+               insertion list else add after current playing track */
+            if (playlist->last_insert_pos >= 0 &&
+                playlist->last_insert_pos < playlist->amount &&
+                (playlist->indices[playlist->last_insert_pos]&
+                    PLAYLIST_INSERT_TYPE_MASK) == PLAYLIST_INSERT_TYPE_INSERT)
+                position = playlist->last_insert_pos+1;
+            else if (playlist->amount > 0)
+                position = playlist->index + 1;
+            else
+                position = 0;
+            break;
+        case PLAYLIST_INSERT_FIRST:
+            if (playlist->amount > 0)
+                position = playlist->index + 1;
+            else
+                position = 0;
+            break;
+        case PLAYLIST_INSERT_LAST:
+            if (playlist->first_index > 0)
+                position = playlist->first_index;
+            else
+                position = playlist->amount;
+            break;
+    }
+
+    playlist->last_insert_pos = position;
+    return position;
+}
+
 /*
  * Add track to playlist at specified position. There are seven special
  * positions that can be specified:
@@ -700,38 +737,11 @@ static int add_track_to_playlist(struct playlist_info* playlist,
     switch (position)
     {
         case PLAYLIST_PREPEND:
-            position = insert_position = playlist->first_index;
-            break;
         case PLAYLIST_INSERT:
-            /* if there are already inserted tracks then add track to end of
-               insertion list else add after current playing track */
-            if (playlist->last_insert_pos >= 0 &&
-                playlist->last_insert_pos < playlist->amount &&
-                (playlist->indices[playlist->last_insert_pos]&
-                    PLAYLIST_INSERT_TYPE_MASK) == PLAYLIST_INSERT_TYPE_INSERT)
-                position = insert_position = playlist->last_insert_pos+1;
-            else if (playlist->amount > 0)
-                position = insert_position = playlist->index + 1;
-            else
-                position = insert_position = 0;
-
-            playlist->last_insert_pos = position;
-            break;
         case PLAYLIST_INSERT_FIRST:
-            if (playlist->amount > 0)
-                position = insert_position = playlist->index + 1;
-            else
-                position = insert_position = 0;
-
-            playlist->last_insert_pos = position;
-            break;
         case PLAYLIST_INSERT_LAST:
-            if (playlist->first_index > 0)
-                position = insert_position = playlist->first_index;
-            else
-                position = insert_position = playlist->amount;
-
-            playlist->last_insert_pos = position;
+            position = insert_position =
+                calculate_insert_position(playlist, position);
             break;
         case PLAYLIST_INSERT_SHUFFLED:
         {
@@ -829,41 +839,8 @@ static int add_track_to_playlist(struct playlist_info* playlist,
  */
 static int directory_search_callback(char* filename, void* context)
 {
-    struct directory_search_context* c =
-        (struct directory_search_context*) context;
-    int insert_pos;
-
-    insert_pos = add_track_to_playlist(c->playlist, filename, c->position,
-        c->queue, -1);
-
-    if (insert_pos < 0)
-        return -1;
-    
-    (c->count)++;
-    
-    /* Make sure tracks are inserted in correct order if user requests
-       INSERT_FIRST */
-    if (c->position == PLAYLIST_INSERT_FIRST || c->position >= 0)
-        c->position = insert_pos + 1;
-    
-    if (((c->count)%PLAYLIST_DISPLAY_COUNT) == 0)
-    {
-        unsigned char* count_str;
-
-        if (c->queue)
-            count_str = ID2P(LANG_PLAYLIST_QUEUE_COUNT);
-        else
-            count_str = ID2P(LANG_PLAYLIST_INSERT_COUNT);
-
-        display_playlist_count(c->count, count_str, false);
-        
-        if ((c->count) == PLAYLIST_DISPLAY_COUNT &&
-            (audio_status() & AUDIO_STATUS_PLAY) &&
-            c->playlist->started)
-            audio_flush_and_reload_tracks();
-    }
-
-    return 0;
+    return playlist_insert_context_add(
+        (struct playlist_insert_context*) context, filename);
 }
 
 /*
@@ -1442,6 +1419,44 @@ static int get_previous_directory(char *dir){
   return get_next_dir(dir,false,false);
 }
 
+/*
+ * Maps a position of the random folder advance order to an index of the
+ * folder list. The order is a permutation of [0, count) keyed by key, made
+ * of a small Feistel network over the next power of four and cycle-walking
+ * until the result is in range. Only the key and the position have to be
+ * kept to step back and forth through it, also across a resume.
+ */
+static int folder_advance_permute(unsigned int pos, unsigned int count,
+                                  uint32_t key)
+{
+    unsigned int half = 1, mask, round;
+
+    while (half < 15 && (1u << (2*half)) < count)
+        half++;
+    mask = (1u << half) - 1;
+
+    do
+    {
+        unsigned int l = pos >> half, r = pos & mask;
+
+        for (round = 0; round < 4; round++)
+        {
+            uint32_t f = (r ^ (round << 24) ^ key) * 0x9e3779b1u;
+            unsigned int t;
+
+            f = (f ^ (f >> 15)) * 0x2c1b3c6du;
+            t = l ^ ((f ^ (f >> 12)) & mask);
+            l = r;
+            r = t;
+        }
+
+        pos = (l << half) | r;
+    }
+    while (pos >= count);
+
+    return pos;
+}
+
 /*
  * search through all the directories (starting with the current) to find
  * one that has tracks to play
@@ -1464,27 +1479,46 @@ static int get_next_dir(char *dir, bool is_forward, bool recursion)
         {
             char buffer[MAX_PATH];
             int folder_count = 0;
-            srand(current_tick);
+            bool found = false;
             *(tc->dirfilter) = SHOW_MUSIC;
             tc->sort_dir = global_settings.sort_dir;
             read(fd,&folder_count,sizeof(int));
-            if (!folder_count)
-                exit = true;
-            while (!exit)
+            /* the list only holds music folders, unless it is outdated */
+            for (i = 0; i < folder_count && !found; i++)
             {
-                i = rand()%folder_count;
-                lseek(fd,sizeof(int) + (MAX_PATH*i),SEEK_SET);
+                int pos = global_status.folder_advance_pos
+                          + (is_forward ? 1 : -1);
+                int folder;
+
+                if (global_status.folder_advance_seed == 0
+                    || pos >= folder_count)
+                {
+                    /* a new order for each round through the list */
+                    srand(current_tick);
+                    global_status.folder_advance_seed = rand() | 1;
+                    pos = 0;
+                }
+                else if (pos < 0)
+                    pos = folder_count - 1;
+
+                global_status.folder_advance_pos = pos;
+                folder = folder_advance_permute(pos, folder_count,
+                                         global_status.folder_advance_seed);
+                lseek(fd,sizeof(int) + (MAX_PATH*folder),SEEK_SET);
                 read(fd,buffer,MAX_PATH);
                 if (check_subdir_for_music(buffer, "", false) ==0)
-                    exit = true;
+                    found = true;
             }
-            if (folder_count)
-                strcpy(dir,buffer);
             close(fd);
+            status_save();
             *(tc->dirfilter) = saved_dirfilter;
             tc->sort_dir = global_settings.sort_dir;
             reload_directory();
-            return 0;
+            if (found)
+            {
+                strcpy(dir,buffer);
+                return 0;
+            }
         }
     }
 
@@ -2901,16 +2935,121 @@ int playlist_insert_track(struct playlist_info* playlist, const char *filename,
 }
 
 /*
- * Insert all tracks from specified directory into playlist.
+ * Reverse the order of the index entries in [first, last)
  */
-int playlist_insert_directory(struct playlist_info* playlist,
-                              const char *dirname, int position, bool queue,
-                              bool recurse)
+static void reverse_indices(struct playlist_info* playlist, int first,
+                            int last)
 {
+    while (first < --last)
+    {
+        unsigned long index = playlist->indices[first];
+        playlist->indices[first] = playlist->indices[last];
+        playlist->indices[last] = index;
+#ifdef HAVE_DIRCACHE
+        if (playlist->filenames)
+        {
+            int entry = playlist->filenames[first];
+            playlist->filenames[first] = playlist->filenames[last];
+            playlist->filenames[last] = entry;
+        }
+#endif
+        first++;
+    }
+}
+
+/*
+ * Write the control file records batched in an insert context with a single
+ * write and move the tracks staged after the end of the index array into
+ * place.  Returns 0 on success and -1 on failure.
+ */
+static int flush_insert_context(struct playlist_insert_context *context)
+{
+    struct playlist_info* playlist = context->playlist;
+    int pending = context->pending;
+    int pos = context->insert_pos;
+    long seek_base = -1;
     int result;
-    unsigned char *count_str;
-    struct directory_search_context context;
+    int i;
+
+    if (!pending)
+        return 0;
+
+    context->pending = 0;
+
+    mutex_lock(playlist->control_mutex);
+
+    /* anything still cached was issued before these tracks */
+    result = flush_cached_control(playlist);
+    if (result >= 0)
+    {
+        seek_base = lseek(playlist->control_fd, 0, SEEK_END);
+        if (seek_base < 0 ||
+            write(playlist->control_fd, context->buf, context->buf_len)
+                != context->buf_len)
+        {
+            result = -1;
+            splash(HZ*2, ID2P(LANG_PLAYLIST_CONTROL_UPDATE_ERROR));
+        }
+        else
+            playlist->pending_control_sync = true;
+    }
+
+    mutex_unlock(playlist->control_mutex);
+
+    context->buf_len = 0;
+
+    if (result < 0)
+        return result;
+
+    /* staged entries hold seek positions relative to the batch start */
+    for (i = playlist->amount; i < playlist->amount + pending; i++)
+        playlist->indices[i] += seek_base;
+
+    /* rotate the staged block in front of the tracks that follow pos */
+    if (pos < playlist->amount)
+    {
+        reverse_indices(playlist, pos, playlist->amount);
+        reverse_indices(playlist, playlist->amount,
+                        playlist->amount + pending);
+        reverse_indices(playlist, pos, playlist->amount + pending);
+    }
+
+    /* same bookkeeping add_track_to_playlist() would have done per track */
+    if (playlist->amount > 0 && playlist->started)
+    {
+        if (pos <= playlist->index)
+            playlist->index += pending;
+
+        if (pos <= playlist->first_index &&
+            context->position != PLAYLIST_PREPEND)
+            playlist->first_index += pending;
+    }
 
+    if (context->position != PLAYLIST_PREPEND)
+        playlist->last_insert_pos = pos + pending - 1;
+    else if (pos < playlist->last_insert_pos)
+        playlist->last_insert_pos += pending;
+
+    playlist->amount += pending;
+    playlist->num_inserted_tracks += pending;
+    context->insert_pos += pending;
+
+    return 0;
+}
+
+/*
+ * Prepare inserting a batch of tracks with playlist_insert_context_add().
+ * Tracks end up in the order they are added.  When they go to one of the
+ * contiguous special positions (PLAYLIST_PREPEND, PLAYLIST_INSERT,
+ * PLAYLIST_INSERT_FIRST and PLAYLIST_INSERT_LAST) their control file records
+ * are written and the index array is updated once per batch instead of
+ * once per track.  The context must be released with
+ * playlist_insert_context_release().  Returns 0 on success and -1 on failure.
+ */
+int playlist_insert_context_create(struct playlist_info* playlist,
+                                   struct playlist_insert_context *context,
+                                   int position, bool queue, bool progress)
+{
     if (!playlist)
         playlist = &current_playlist;
 
@@ -2928,28 +3067,154 @@ int playlist_insert_directory(struct playlist_info* playlist,
             return -1;
     }
 
-    if (queue)
-        count_str = ID2P(LANG_PLAYLIST_QUEUE_COUNT);
-    else
-        count_str = ID2P(LANG_PLAYLIST_INSERT_COUNT);
+    context->playlist = playlist;
+    context->position = position;
+    context->queue = queue;
+    context->progress = progress;
+    context->count = 0;
+    context->insert_pos = -1;
+    context->pending = 0;
+    context->buf_len = 0;
 
-    display_playlist_count(0, count_str, false);
+    if (progress)
+        display_playlist_count(0, queue ? ID2P(LANG_PLAYLIST_QUEUE_COUNT) :
+                                          ID2P(LANG_PLAYLIST_INSERT_COUNT),
+                               false);
 
-    context.playlist = playlist;
-    context.position = position;
-    context.queue = queue;
-    context.count = 0;
-    
     cpu_boost(true);
 
-    result = playlist_directory_tracksearch(dirname, recurse,
-        directory_search_callback, &context);
+    return 0;
+}
+
+/*
+ * Add a track to an insert context.  Returns 0 on success and -1 on failure.
+ */
+int playlist_insert_context_add(struct playlist_insert_context *context,
+                                const char *filename)
+{
+    struct playlist_info* playlist = context->playlist;
+    int insert_pos;
+
+    switch (context->position)
+    {
+        case PLAYLIST_PREPEND:
+        case PLAYLIST_INSERT:
+        case PLAYLIST_INSERT_FIRST:
+        case PLAYLIST_INSERT_LAST:
+        {
+            unsigned long flags = PLAYLIST_INSERT_TYPE_INSERT;
+            int last_insert_pos;
+            int len;
+            char *p;
+
+            /* room for "Q:<position>:<last position>:<filename>\n" */
+            len = strlen(filename) + 2*12 + 4;
+            if (len > PLAYLIST_INSERT_BUFFER_SIZE)
+                return -1;
+
+            if (len > PLAYLIST_INSERT_BUFFER_SIZE - context->buf_len &&
+                flush_insert_context(context) < 0)
+                return -1;
+
+            if (playlist->amount + context->pending >=
+                playlist->max_playlist_size)
+            {
+                display_buffer_full();
+                return -1;
+            }
+
+            if (context->insert_pos < 0)
+                context->insert_pos =
+                    calculate_insert_position(playlist, context->position);
+
+            insert_pos = context->insert_pos + context->pending;
+
+            if (context->position != PLAYLIST_PREPEND)
+                last_insert_pos = insert_pos;
+            else if (context->insert_pos < playlist->last_insert_pos)
+                last_insert_pos = playlist->last_insert_pos +
+                                  context->pending + 1;
+            else
+                last_insert_pos = playlist->last_insert_pos;
+
+            if (context->queue)
+                flags |= PLAYLIST_QUEUED;
+
+            p = &context->buf[context->buf_len];
+            len = snprintf(p, PLAYLIST_INSERT_BUFFER_SIZE - context->buf_len,
+                           "%c:%d:%d:", context->queue ? 'Q' : 'A',
+                           insert_pos, last_insert_pos);
+
+            /* stage the track after the end of the index array, it is moved
+               into place once its control record is on disk */
+            insert_pos = playlist->amount + context->pending;
+            playlist->indices[insert_pos] = flags | (context->buf_len + len);
+#ifdef HAVE_DIRCACHE
+            if (playlist->filenames)
+                playlist->filenames[insert_pos] = -1;
+#endif
+            len += snprintf(p + len,
+                            PLAYLIST_INSERT_BUFFER_SIZE - context->buf_len - len,
+                            "%s\n", filename);
+            context->buf_len += len;
+            context->pending++;
+            break;
+        }
+        default:
+            /* random or explicit positions, insert one by one */
+            insert_pos = add_track_to_playlist(playlist, filename,
+                                               context->position,
+                                               context->queue, -1);
+            if (insert_pos < 0)
+                return -1;
+
+            /* Make sure tracks are inserted in correct order */
+            if (context->position >= 0)
+                context->position = insert_pos + 1;
+            break;
+    }
+
+    context->count++;
+
+    if ((context->count % PLAYLIST_DISPLAY_COUNT) == 0)
+    {
+        if (context->progress)
+            display_playlist_count(context->count,
+                                   context->queue ?
+                                        ID2P(LANG_PLAYLIST_QUEUE_COUNT) :
+                                        ID2P(LANG_PLAYLIST_INSERT_COUNT),
+                                   false);
+
+        /* let playback see the first tracks early */
+        if (context->count == PLAYLIST_DISPLAY_COUNT &&
+            (audio_status() & AUDIO_STATUS_PLAY) &&
+            playlist->started &&
+            flush_insert_context(context) == 0)
+            audio_flush_and_reload_tracks();
+    }
+
+    return 0;
+}
+
+/*
+ * Finish a bulk insertion started with playlist_insert_context_create().
+ * Returns 0 on success and -1 if the last batch could not be written.
+ */
+int playlist_insert_context_release(struct playlist_insert_context *context)
+{
+    struct playlist_info* playlist = context->playlist;
+    int result = flush_insert_context(context);
 
     sync_control(playlist, false);
 
     cpu_boost(false);
 
-    display_playlist_count(context.count, count_str, true);
+    if (context->progress)
+        display_playlist_count(context->count,
+                               context->queue ?
+                                    ID2P(LANG_PLAYLIST_QUEUE_COUNT) :
+                                    ID2P(LANG_PLAYLIST_INSERT_COUNT),
+                               true);
 
     if ((audio_status() & AUDIO_STATUS_PLAY) && playlist->started)
         audio_flush_and_reload_tracks();
@@ -2961,6 +3226,28 @@ int playlist_insert_directory(struct playlist_info* playlist,
     return result;
 }
 
+/*
+ * Insert all tracks from specified directory into playlist.
+ */
+int playlist_insert_directory(struct playlist_info* playlist,
+                              const char *dirname, int position, bool queue,
+                              bool recurse)
+{
+    int result;
+    struct playlist_insert_context context;
+
+    if (playlist_insert_context_create(playlist, &context, position,
+                                       queue, true) < 0)
+        return -1;
+
+    result = playlist_directory_tracksearch(dirname, recurse,
+        directory_search_callback, &context);
+
+    playlist_insert_context_release(&context);
+
+    return result;
+}
+
 /*
  * Insert all tracks from specified playlist into dynamic playlist.
  */
@@ -2971,25 +3258,20 @@ int playlist_insert_playlist(struct playlist_info* playlist, const char *filenam
     int max;
     char *temp_ptr;
     const char *dir;
-    unsigned char *count_str;
     char temp_buf[MAX_PATH+1];
     char trackname[MAX_PATH+1];
-    int count = 0;
     int result = 0;
     bool utf8 = is_m3u8(filename);
+    struct playlist_insert_context context;
 
-    if (!playlist)
-        playlist = &current_playlist;
-
-    if (check_control(playlist) < 0)
-    {
-        splash(HZ*2, ID2P(LANG_PLAYLIST_CONTROL_ACCESS_ERROR));
+    if (playlist_insert_context_create(playlist, &context, position,
+                                       queue, true) < 0)
         return -1;
-    }
 
     fd = open_utf8(filename, O_RDONLY);
     if (fd < 0)
     {
+        playlist_insert_context_release(&context);
         splash(HZ*2, ID2P(LANG_PLAYLIST_ACCESS_ERROR));
         return -1;
     }
@@ -3003,22 +3285,6 @@ int playlist_insert_playlist(struct playlist_info* playlist, const char *filenam
     else
         dir = "/";
 
-    if (queue)
-        count_str = ID2P(LANG_PLAYLIST_QUEUE_COUNT);
-    else
-        count_str = ID2P(LANG_PLAYLIST_INSERT_COUNT);
-
-    display_playlist_count(count, count_str, false);
-
-    if (position == PLAYLIST_REPLACE)
-    {
-        if (playlist_remove_all_tracks(playlist) == 0)
-            position = PLAYLIST_INSERT_LAST;
-        else return -1;
-    }
-
-    cpu_boost(true);
-
     while ((max = read_line(fd, temp_buf, sizeof(temp_buf))) > 0)
     {
         /* user abort */
@@ -3027,8 +3293,6 @@ int playlist_insert_playlist(struct playlist_info* playlist, const char *filenam
     
         if (temp_buf[0] != '#' && temp_buf[0] != '\0')
         {
-            int insert_pos;
-            
             if (!utf8)
             {
                 /* Use trackname as a temporay buffer. Note that trackname must
@@ -3046,31 +3310,11 @@ int playlist_insert_playlist(struct playlist_info* playlist, const char *filenam
                 break;
             }
             
-            insert_pos = add_track_to_playlist(playlist, trackname, position,
-                queue, -1);
-
-            if (insert_pos < 0)
+            if (playlist_insert_context_add(&context, trackname) < 0)
             {
                 result = -1;
                 break;
             }
-
-            /* Make sure tracks are inserted in correct order if user
-               requests INSERT_FIRST */
-            if (position == PLAYLIST_INSERT_FIRST || position >= 0)
-                position = insert_pos + 1;
-
-            count++;
-            
-            if ((count%PLAYLIST_DISPLAY_COUNT) == 0)
-            {
-                display_playlist_count(count, count_str, false);
-
-                if (count == PLAYLIST_DISPLAY_COUNT &&
-                    (audio_status() & AUDIO_STATUS_PLAY) &&
-                    playlist->started)
-                    audio_flush_and_reload_tracks();
-            }
         }
 
         /* let the other threads work */
@@ -3082,18 +3326,8 @@ int playlist_insert_playlist(struct playlist_info* playlist, const char *filenam
     if (temp_ptr)
         *temp_ptr = '/';
 
-    sync_control(playlist, false);
-
-    cpu_boost(false);
-
-    display_playlist_count(count, count_str, true);
-
-    if ((audio_status() & AUDIO_STATUS_PLAY) && playlist->started)
-        audio_flush_and_reload_tracks();
-
-#ifdef HAVE_DIRCACHE
-    queue_post(&playlist_queue, PLAYLIST_LOAD_POINTERS, 0);
-#endif
+    if (playlist_insert_context_release(&context) < 0)
+        result = -1;
 
     return result;
 }
@@ -115,6 +115,24 @@ struct playlist_info
                                     shuffled command start */
 };
 
+/* Size of the buffer used to batch control file records when inserting
+   several tracks at once. Must hold at least one full A:/Q: command. */
+#define PLAYLIST_INSERT_BUFFER_SIZE (MAX_PATH*4)
+
+/* State of a bulk insertion, see playlist_insert_context_create() */
+struct playlist_insert_context
+{
+    struct playlist_info* playlist; /* playlist tracks are inserted into    */
+    int  position;       /* requested insert position                       */
+    bool queue;          /* queue tracks instead of inserting them          */
+    bool progress;       /* show the insert count splash                    */
+    int  count;          /* number of tracks inserted so far                */
+    int  insert_pos;     /* index of the next track, -1 until resolved      */
+    int  pending;        /* tracks staged past the end of the index array   */
+    int  buf_len;        /* bytes of control data waiting in buf            */
+    char buf[PLAYLIST_INSERT_BUFFER_SIZE]; /* pending control file records  */
+};
+
 struct playlist_track_info
 {
     char filename[MAX_PATH]; /* path name of mp3 file               */
@@ -153,6 +171,12 @@ void playlist_close(struct playlist_info* playlist);
 void playlist_sync(struct playlist_info* playlist);
 int playlist_insert_track(struct playlist_info* playlist, const char *filename,
                           int position, bool queue, bool sync);
+int playlist_insert_context_create(struct playlist_info* playlist,
+                                   struct playlist_insert_context *context,
+                                   int position, bool queue, bool progress);
+int playlist_insert_context_add(struct playlist_insert_context *context,
+                                const char *filename);
+int playlist_insert_context_release(struct playlist_insert_context *context);
 int playlist_insert_directory(struct playlist_info* playlist,
                               const char *dirname, int position, bool queue,
                               bool recurse);
@@ -804,6 +804,18 @@ static const struct plugin_api rockbox_api = {
     buflib_shrink,
     buflib_get_data,
     buflib_get_name,
+
+    playlist_insert_context_create,
+    playlist_insert_context_add,
+    playlist_insert_context_release,
+    treewalk_open,
+    treewalk_next,
+    treewalk_skip_dir,
+    treewalk_get_path,
+    treewalk_close,
+#ifdef HAVE_TAGCACHE
+    tagcache_get_commitid,
+#endif
 };
 
 int plugin_load(const char* plugin, const void* parameter)
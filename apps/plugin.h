@@ -147,12 +147,12 @@ void* plugin_get_buffer(size_t *buffer_size);
 #define PLUGIN_MAGIC 0x526F634B /* RocK */
 
 /* increase this every time the api struct changes */
-#define PLUGIN_API_VERSION 212
+#define PLUGIN_API_VERSION 224
 
 /* update this to latest version if a change to the api struct breaks
    backwards compatibility (and please take the opportunity to sort in any
    new function which are "waiting" at the end of the function table) */
-#define PLUGIN_MIN_API_VERSION 210
+#define PLUGIN_MIN_API_VERSION 223
 
 /* plugin return codes */
 /* internal returns start at 0x100 to make exit(1..255) work */
@@ -945,7 +945,24 @@ struct plugin_api {
                             void* new_start, size_t new_size);
     void*  (*buflib_get_data)(struct buflib_context* ctx, int handle);
     const char* (*buflib_get_name)(struct buflib_context* ctx, int handle);
-    
+
+    int (*playlist_insert_context_create)(struct playlist_info* playlist,
+                                    struct playlist_insert_context *context,
+                                    int position, bool queue, bool progress);
+    int (*playlist_insert_context_add)(struct playlist_insert_context *context,
+                                       const char *filename);
+    int (*playlist_insert_context_release)(
+                                    struct playlist_insert_context *context);
+    int (*treewalk_open)(struct treewalk *walk, const char *path,
+                         unsigned flags, void *buf, size_t bufsize);
+    bool (*treewalk_next)(struct treewalk *walk);
+    void (*treewalk_skip_dir)(struct treewalk *walk);
+    size_t (*treewalk_get_path)(const struct treewalk *walk,
+                                char *buf, size_t size);
+    void (*treewalk_close)(struct treewalk *walk);
+#ifdef HAVE_TAGCACHE
+    long (*tagcache_get_commitid)(void);
+#endif
 };
 
 /* plugin header */
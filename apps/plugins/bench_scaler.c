@@ -74,6 +74,45 @@ const struct custom_format format_null = {
     .get_size = get_size_null
 };
 
+#if defined(HAVE_LCD_COLOR) && LCD_DEPTH == 16 \
+    && !(defined(LCD_STRIDEFORMAT) && LCD_STRIDEFORMAT == VERTICAL_STRIDE)
+#define CHECK_NATIVE
+/* straightforward per-component RGB565 output, to check the native output
+   converter against */
+static void output_row_ref(uint32_t row, void * row_in,
+                           struct scaler_context *ctx)
+{
+    int col;
+    uint8_t dy = DITHERY(row);
+    struct uint32_rgb *qp = (struct uint32_rgb *)row_in;
+    fb_data *dest = (fb_data *)ctx->bm->data + ctx->bm->width * row;
+    int delta = 127;
+    unsigned r, g, b;
+
+    for (col = 0; col < ctx->bm->width; col++) {
+        if (ctx->dither)
+            delta = DITHERXDY(col,dy);
+        r = SC_OUT(qp->r, ctx);
+        g = SC_OUT(qp->g, ctx);
+        b = SC_OUT(qp->b, ctx);
+        qp++;
+        r = (31 * r + (r >> 3) + delta) >> 8;
+        g = (63 * g + (g >> 2) + delta) >> 8;
+        b = (31 * b + (b >> 3) + delta) >> 8;
+        *dest++ = LCD_RGBPACK_LCD(r, g, b);
+    }
+}
+
+const struct custom_format format_ref = {
+    .output_row_8 = NULL,
+    .output_row_32 = {
+        output_row_ref,
+        output_row_ref
+    },
+    .get_size = get_size_null
+};
+#endif
+
 #define lcd_printf(...) \
 do { \
     rb->lcd_putsxyf(0, output_y, __VA_ARGS__); \
@@ -131,6 +170,52 @@ enum plugin_status plugin_start(const void* parameter)
         }
     }
 
+#ifdef CHECK_NATIVE
+    /* Scale a pseudo-random image to native format and compare the result
+       with the reference converter, with and without dithering. */
+    unsigned char *src_buf = plugin_buf;
+    fb_data *out_native = (fb_data *)(plugin_buf + 256 * sizeof(*part.buf));
+    fb_data *out_ref = out_native + 256 * 256;
+    unsigned char *work = (unsigned char *)(out_ref + 256 * 256);
+    size_t work_len = plugin_buf_len - (work - plugin_buf);
+    unsigned int seed = 0x12345678;
+    int i, dither, bad = 0;
+
+    for (i = 0; i < 256 * (int)sizeof(*part.buf); i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        src_buf[i] = seed >> 24;
+    }
+    for (in = 64; in < 1025; in <<= 2)
+    {
+        for (out = 48; out < 257; out += 52)
+        {
+            in_dim.width = in_dim.height = in;
+            for (dither = 0; dither < 2; dither++)
+            {
+                bm.width = bm.height = rset.rowstop = out;
+                bm.data = (unsigned char *)out_native;
+                resize_on_load(&bm, dither, &in_dim, &rset, work, work_len,
+                               &format_native, IF_PIX_FMT(0,) store_part_null,
+                               NULL);
+                bm.width = bm.height = out;
+                bm.data = (unsigned char *)out_ref;
+                resize_on_load(&bm, dither, &in_dim, &rset, work, work_len,
+                               &format_ref, IF_PIX_FMT(0,) store_part_null,
+                               NULL);
+                if (rb->memcmp(out_native, out_ref,
+                               out * out * sizeof(fb_data)))
+                {
+                    lcd_printf("MISMATCH %d->%d dither %d", in, out, dither);
+                    bad++;
+                }
+            }
+        }
+    }
+    if (!bad)
+        lcd_printf("native output is bit-exact");
+#endif
+
     while (rb->get_action(CONTEXT_STD,1) != ACTION_STD_OK) rb->yield();
     return PLUGIN_OK;
 }
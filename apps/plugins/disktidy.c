@@ -23,6 +23,7 @@
 
 
 static int removed = 0; /* number of items removed */
+static bool incomplete = false; /* parts of the disk weren't looked at */
 
 /* function return values */
 enum tidy_return
@@ -147,7 +148,7 @@ bool tidy_load_file(const char* file)
     return true;
 }
 
-static bool match(struct tidy_type *tidy_type, char *string, int len)
+static bool match(struct tidy_type *tidy_type, const char *string, int len)
 {
     char *pattern = tidy_type->filestring;
     if (tidy_type->pre < 0)
@@ -165,7 +166,7 @@ static bool match(struct tidy_type *tidy_type, char *string, int len)
                         string + len - tidy_type->post) == 0);
 }
 
-bool tidy_remove_item(char *item, int attr)
+bool tidy_remove_item(const char *item, int attr)
 {
     int i;
     int len;
@@ -310,10 +311,9 @@ enum tidy_return tidy_removedir(char *path, int *path_length)
 enum tidy_return tidy_clean(char *path, int *path_length)
 {
     /* deletes junk files and dirs left by system */
-    struct dirent *entry;
+    struct treewalk walk;
     enum tidy_return status = TIDY_RETURN_OK;
     int button;
-    DIR *dir;
     int old_path_length = *path_length;
 
     /* display status text */
@@ -321,83 +321,71 @@ enum tidy_return tidy_clean(char *path, int *path_length)
 
     rb->yield();
 
-    dir = rb->opendir(path);
-    if (dir)
+    if (rb->treewalk_open(&walk, path, 0, NULL, 0) < 0)
+        return TIDY_RETURN_ERROR;
+
+    while((status == TIDY_RETURN_OK) && rb->treewalk_next(&walk))
+    /* walk the whole tree */
     {
-        while((status == TIDY_RETURN_OK) && ((entry = rb->readdir(dir)) != 0))
-        /* walk directory */
+        bool is_dir = walk.info.attribute & ATTR_DIRECTORY;
+        bool remove = tidy_remove_item(walk.name, walk.info.attribute);
+
+        /* check for user input and usb connect */
+        button = rb->get_action(CONTEXT_STD, TIMEOUT_NOBLOCK);
+        if (button == ACTION_STD_CANCEL)
         {
-            struct dirinfo info = rb->dir_get_info(dir, entry);
-            /* check for user input and usb connect */
-            button = rb->get_action(CONTEXT_STD, TIMEOUT_NOBLOCK);
-            if (button == ACTION_STD_CANCEL)
-            {
-                rb->closedir(dir);
-                return TIDY_RETURN_ABORT;
-            }
-            if (rb->default_event_handler(button) == SYS_USB_CONNECTED)
-            {
-                rb->closedir(dir);
-                return TIDY_RETURN_USB;
-            }
+            status = TIDY_RETURN_ABORT;
+            break;
+        }
+        if (rb->default_event_handler(button) == SYS_USB_CONNECTED)
+        {
+            status = TIDY_RETURN_USB;
+            break;
+        }
 
-            rb->yield();
+        rb->yield();
 
-            if (info.attribute & ATTR_DIRECTORY)
+        if (!is_dir && !remove)
+            continue;
+
+        /* get absolute path */
+        *path_length = rb->treewalk_get_path(&walk, path, MAX_PATH);
+        if (*path_length >= MAX_PATH)
+        {
+            /* silent error */
+            rb->treewalk_skip_dir(&walk);
+            continue;
+        }
+
+        if (is_dir)
+        {
+            if (remove)
             {
-                /* directory ignore "." and ".." */
-                if ((rb->strcmp(entry->d_name, ".") != 0) && \
-                    (rb->strcmp(entry->d_name, "..") != 0))
-                {
-                    /* get absolute path */
-                    /* returns an error if path is too long */
-                    if(!tidy_path_append_entry(path, entry, path_length))
-                        /* silent error */
-                        continue;
-
-                    if (tidy_remove_item(entry->d_name, info.attribute))
-                    {
-                        /* delete dir */
-                        status = tidy_removedir(path, path_length);
-                    }
-                    else
-                    {
-                        /* dir not deleted so clean it */
-                        status = tidy_clean(path, path_length);
-                    }
-                    
-                    /* restore path */
-                    tidy_path_remove_entry(path, old_path_length, path_length);
-                }
+                /* delete dir, don't walk into it */
+                rb->treewalk_skip_dir(&walk);
+                status = tidy_removedir(path, path_length);
             }
             else
             {
-                /* file */
-                if (tidy_remove_item(entry->d_name, info.attribute))
-                {
-                    /* get absolute path */
-                    /* returns an error if path is too long */
-                    if(!tidy_path_append_entry(path, entry, path_length))
-                        /* silent error */
-                        continue;
-
-                    removed++; /* increment removed files counter */
-                    /* delete file */
-                    if (rb->remove(path) != 0)
-                        DEBUGF("Could not delete file %s\n", path);
-
-                    /* restore path */
-                    tidy_path_remove_entry(path, old_path_length, path_length);
-                }
+                /* dir not deleted so it gets cleaned */
+                tidy_lcd_status(path);
             }
         }
-        rb->closedir(dir);
-        return status;
-    }
-    else
-    {
-        return TIDY_RETURN_ERROR;
+        else
+        {
+            removed++; /* increment removed files counter */
+            /* delete file */
+            if (rb->remove(path) != 0)
+                DEBUGF("Could not delete file %s\n", path);
+        }
     }
+    if (walk.incomplete)
+        incomplete = true;
+    rb->treewalk_close(&walk);
+
+    /* restore path, every path of the walk starts with it */
+    tidy_path_remove_entry(path, old_path_length, path_length);
+    return status;
 }
 
 enum tidy_return tidy_do(void)
@@ -428,6 +416,8 @@ enum tidy_return tidy_do(void)
             rb->lcd_clear_display();
         }
         rb->splashf(HZ*2, "Cleaned up %d items", removed);
+        if (incomplete)
+            rb->splash(HZ*2, "Some folders were skipped");
     }
     return status;
 }
@@ -84,36 +84,28 @@ static void hash_file( int out, const char *path )
 
 static void hash_dir( int out, const char *path )
 {
-    DIR *dir;
-    struct dirent *entry;
+    struct treewalk walk;
 
-    dir = rb->opendir( path );
-    if( dir )
+    if( rb->treewalk_open( &walk, path, TREEWALK_SKIP_DIRS, NULL, 0 ) < 0 )
+        return;
+
+    while( !quit && rb->treewalk_next( &walk ) )
     {
-        while( !quit && ( entry = rb->readdir( dir ) ) )
-        {
-            char childpath[MAX_PATH];
-            rb->snprintf( childpath, MAX_PATH, "%s/%s",
-                          rb->strcmp( path, "/" ) ? path : "", entry->d_name );
-            
-            struct dirinfo info = rb->dir_get_info(dir, entry);
-            if (info.attribute & ATTR_DIRECTORY)
-            {
-                if( rb->strcmp( entry->d_name, "." )
-                    && rb->strcmp( entry->d_name, ".." ) )
-                {
-                    /* Got a sub directory */
-                    hash_dir( out, childpath );
-                }
-            }
-            else
-            {
-                /* Got a file */
-                hash_file( out, childpath );
-            }
-        }
-        rb->closedir( dir );
+        char childpath[MAX_PATH];
+        rb->treewalk_get_path( &walk, childpath, MAX_PATH );
+
+        /* Got a file */
+        hash_file( out, childpath );
+    }
+
+    /* Part of the tree was skipped, don't let the list pass as complete */
+    if( !quit && walk.incomplete && out >= 0 )
+    {
+        rb->write( out, "error  ", 7 );
+        rb->write( out, path, rb->strlen( path ) );
+        rb->write( out, "\n", 1 );
     }
+    rb->treewalk_close( &walk );
 }
 
 static void hash_list( int out, const char *path )
@@ -227,10 +227,23 @@ typedef fb_data pix_t;
 #define MAX_SLIDES_COUNT 10
 
 #define THREAD_STACK_SIZE DEFAULT_STACK_SIZE + 0x200
+
+/* The cache is built by worker threads decoding covers that the main thread
+   looked up in the database, using a small ring of pending jobs. */
+#if NUM_CORES > 1 || (CONFIG_PLATFORM & PLATFORM_HOSTED)
+#define BUILD_WORKERS 2
+#else
+#define BUILD_WORKERS 1
+#endif
+#define BUILD_QUEUE_SIZE 4
+#define BUILD_STACK_SIZE (DEFAULT_STACK_SIZE + 0x2000)
+
 #define CACHE_PREFIX PLUGIN_DEMOS_DATA_DIR "/pictureflow"
 
 #define EV_EXIT 9999
 #define EV_WAKEUP 1337
+#define EV_BUILD_JOB 1338
+#define EV_BUILD_ROOM 1339
 
 #define EMPTY_SLIDE CACHE_PREFIX "/emptyslide.pfraw"
 #define EMPTY_SLIDE_BMP PLUGIN_DEMOS_DIR "/pictureflow_emptyslide.bmp"
@@ -344,6 +357,8 @@ static int last_album = 0;
 static int backlight_mode = 0;
 static bool resize = true;
 static int cache_version = 0;
+static int cache_resume = 0;
+static int cache_resume_commit = 0; /* database the resume point is for */
 static int show_album_name = (LCD_HEIGHT > 100)
     ? ALBUM_NAME_TOP : ALBUM_NAME_BOTTOM;
 
@@ -363,7 +378,10 @@ static struct configdata config[] =
       show_album_name_conf },
     { TYPE_INT, 0, 2, { .int_p = &auto_wps }, "auto wps", NULL },
     { TYPE_INT, 0, 999999, { .int_p = &last_album }, "last album", NULL },
-    { TYPE_INT, 0, 1, { .int_p = &backlight_mode }, "backlight", NULL }
+    { TYPE_INT, 0, 1, { .int_p = &backlight_mode }, "backlight", NULL },
+    { TYPE_INT, 0, 999999, { .int_p = &cache_resume }, "cache resume", NULL },
+    { TYPE_INT, 0, 999999, { .int_p = &cache_resume_commit },
+      "cache resume commit", NULL }
 };
 
 #define CONFIG_NUM_ITEMS (sizeof(config) / sizeof(struct configdata))
@@ -401,6 +419,28 @@ static int empty_slide_hid;
 unsigned int thread_id;
 struct event_queue thread_q;
 
+struct build_job {
+    char pfraw_file[MAX_PATH];
+    char albumart_file[MAX_PATH];
+};
+
+/* State shared between create_albumart_cache() and its workers */
+static struct {
+    struct mutex mutex;
+    struct build_job jobs[BUILD_QUEUE_SIZE];
+    int head, count;        /* ring of queued jobs */
+    int done;               /* albums processed, for the progress bar */
+    int slides;             /* albums that got a slide */
+    int bad;                /* albums whose art couldn't be read */
+    int started;            /* workers that picked their buffer */
+    bool waiting;           /* producer waits for room in the ring */
+    struct event_queue job_q;  /* EV_BUILD_JOB per queued job, then EV_EXIT */
+    struct event_queue room_q; /* EV_BUILD_ROOM when the producer waits */
+    size_t buf_size;        /* buffer size of each worker */
+    unsigned int thread_id[BUILD_WORKERS];
+    unsigned long stack[BUILD_WORKERS][BUILD_STACK_SIZE / sizeof(long)];
+} build;
+
 static struct tagcache_search tcs;
 
 static struct buflib_context buf_ctx;
@@ -1185,62 +1225,179 @@ bool save_pfraw(char* filename, struct bitmap *bm)
 }
 
 /**
- Precomupte the album art images and store them in CACHE_PREFIX.
- Use the "?" bitmap if image is not found.
+ Decode the cover of one queued album and save it as a pfraw.
+ Use the "?" bitmap if the cover can't be read, setting *bad.
  */
-bool create_albumart_cache(void)
+static bool build_one(struct build_job *job, void *wbuf, bool *bad)
 {
-    int ret;
-
-    int i, slides = 0;
     struct bitmap input_bmp;
-
-    char pfraw_file[MAX_PATH];
-    char albumart_file[MAX_PATH];
+    int ret;
     unsigned int format = FORMAT_NATIVE;
-    bool update = (cache_version == CACHE_UPDATE);
     if (resize)
         format |= FORMAT_RESIZE|FORMAT_KEEP_ASPECT;
-    for (i=0; i < album_count; i++)
+
+    input_bmp.data = wbuf;
+    input_bmp.width = DISPLAY_WIDTH;
+    input_bmp.height = DISPLAY_HEIGHT;
+    ret = read_image_file(job->albumart_file, &input_bmp, build.buf_size,
+                            format, &format_transposed);
+    *bad = ret <= 0;
+    if (*bad) {
+        input_bmp.width = DISPLAY_WIDTH;
+        input_bmp.height = DISPLAY_HEIGHT;
+        ret = read_image_file(EMPTY_SLIDE_BMP, &input_bmp, build.buf_size,
+                                format, &format_transposed);
+    }
+    return ret > 0 && save_pfraw(job->pfraw_file, &input_bmp);
+}
+
+/**
+ Cache builder worker: take jobs off the ring until told to quit
+ */
+static void build_thread(void)
+{
+    struct build_job job;
+    struct queue_event ev;
+
+    rb->mutex_lock(&build.mutex);
+    void *wbuf = (char *)buf + build.started++ * build.buf_size;
+    rb->mutex_unlock(&build.mutex);
+
+    while (1) {
+        /* jobs are posted after being queued, EV_EXIT after the last one */
+        rb->queue_wait(&build.job_q, &ev);
+        if (ev.id != EV_BUILD_JOB)
+            break;
+
+        rb->mutex_lock(&build.mutex);
+        int tail = (build.head + BUILD_QUEUE_SIZE - build.count)
+                                                        % BUILD_QUEUE_SIZE;
+        job = build.jobs[tail];
+        build.count--;
+        bool wake = build.waiting;
+        build.waiting = false;
+        rb->mutex_unlock(&build.mutex);
+        if (wake)
+            rb->queue_post(&build.room_q, EV_BUILD_ROOM, 0);
+
+        bool bad;
+        bool saved = build_one(&job, wbuf, &bad);
+
+        rb->mutex_lock(&build.mutex);
+        build.done++;
+        build.slides += saved;
+        build.bad += bad;
+        rb->mutex_unlock(&build.mutex);
+    }
+}
+
+/**
+ Tell the workers that all jobs are queued and wait for them to finish
+ */
+static void end_build_threads(int count)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        rb->queue_post(&build.job_q, EV_EXIT, 0);
+    for (i = 0; i < count; i++)
+        rb->thread_wait(build.thread_id[i]);
+    rb->queue_delete(&build.job_q);
+    rb->queue_delete(&build.room_q);
+}
+
+/**
+ Precomupte the album art images and store them in CACHE_PREFIX.
+ The database lookups happen here while the workers decode and scale.
+ If interrupted, the next build resumes with the first album not done.
+ */
+bool create_albumart_cache(void)
+{
+    int i, workers;
+    bool update = (cache_version == CACHE_UPDATE);
+    bool interrupted = false;
+    struct build_job job;
+    struct queue_event ev;
+    long commitid = rb->tagcache_get_commitid();
+
+    rb->memset(&build, 0, sizeof(build));
+    rb->mutex_init(&build.mutex);
+    rb->queue_init(&build.job_q, false);
+    rb->queue_init(&build.room_q, false);
+    build.buf_size = (buf_size / BUILD_WORKERS) & ~3;
+
+    for (workers = 0; workers < BUILD_WORKERS; workers++)
     {
-        draw_progressbar(i);
+        build.thread_id[workers] = rb->create_thread(build_thread,
+                           build.stack[workers], sizeof(build.stack[workers]),
+                           0, "PF cache builder"
+                           IF_PRIO(, PRIORITY_BUFFERING) IF_COP(, CPU));
+        if (build.thread_id[workers] == 0)
+            break;
+    }
+    if (workers == 0)
+    {
+        end_build_threads(0);
+        return false;
+    }
+
+    /* albums before the resume point were done by the interrupted build,
+       unless the database changed since and they are other albums now */
+    i = (cache_resume_commit == commitid && cache_resume < album_count)
+        ? cache_resume : 0;
+    build.done = i;
+    build.slides = i;
+    for (; i < album_count; i++)
+    {
+        draw_progressbar(build.done);
+        if ( rb->button_get(false) == PF_MENU ) {
+            interrupted = true;
+            break;
+        }
 
-        rb->snprintf(pfraw_file, sizeof(pfraw_file), CACHE_PREFIX "/%x.pfraw",
-                     mfnv(get_album_name(i)));
+        rb->snprintf(job.pfraw_file, sizeof(job.pfraw_file),
+                     CACHE_PREFIX "/%x.pfraw", mfnv(get_album_name(i)));
         /* delete existing cache, so it's a true rebuild */
-        if(rb->file_exists(pfraw_file)) {
+        if(rb->file_exists(job.pfraw_file)) {
             if(update) {
-                slides++;
+                rb->mutex_lock(&build.mutex);
+                build.slides++;
+                build.done++;
+                rb->mutex_unlock(&build.mutex);
                 continue;
             }
-            rb->remove(pfraw_file);
+            rb->remove(job.pfraw_file);
         }
-        if (!get_albumart_for_index_from_db(i, albumart_file, MAX_PATH))
-            rb->strcpy(albumart_file, EMPTY_SLIDE_BMP);
-
-        input_bmp.data = buf;
-        input_bmp.width = DISPLAY_WIDTH;
-        input_bmp.height = DISPLAY_HEIGHT;
-        ret = read_image_file(albumart_file, &input_bmp, buf_size,
-                                format, &format_transposed);
-        if (ret <= 0) {
-            rb->splashf(HZ, "Album art is bad: %s", get_album_name(i));
-            rb->strcpy(albumart_file, EMPTY_SLIDE_BMP);
-            ret = read_image_file(albumart_file, &input_bmp, buf_size,
-                                    format, &format_transposed);
-            if(ret <= 0)
-                continue;
+        if (!get_albumart_for_index_from_db(i, job.albumart_file, MAX_PATH))
+            rb->strcpy(job.albumart_file, EMPTY_SLIDE_BMP);
+
+        /* wait for a worker to make room in the ring */
+        rb->mutex_lock(&build.mutex);
+        while (build.count == BUILD_QUEUE_SIZE) {
+            build.waiting = true;
+            rb->mutex_unlock(&build.mutex);
+            draw_progressbar(build.done);
+            rb->queue_wait(&build.room_q, &ev);
+            rb->mutex_lock(&build.mutex);
         }
-        if (!save_pfraw(pfraw_file, &input_bmp))
-        {
-            rb->splash(HZ, "Could not write bmp");
-            continue;
-        }
-        slides++;
-        if ( rb->button_get(false) == PF_MENU ) return false;
-    }
-    draw_progressbar(i);
-    if ( slides == 0 ) {
+        build.jobs[build.head] = job;
+        build.head = (build.head + 1) % BUILD_QUEUE_SIZE;
+        build.count++;
+        rb->mutex_unlock(&build.mutex);
+        rb->queue_post(&build.job_q, EV_BUILD_JOB, 0);
+    }
+
+    /* the queued jobs are finished either way, so an interrupted build can
+       pick up right after them */
+    end_build_threads(workers);
+    draw_progressbar(build.done);
+    cache_resume = interrupted ? i : 0;
+    cache_resume_commit = commitid;
+
+    if (build.bad > 0)
+        rb->splashf(HZ, "Album art is bad for %d albums", build.bad);
+    if (interrupted)
+        return false;
+    if ( build.slides == 0 ) {
         /* Warn the user that we couldn't find any albumart */
         rb->splash(2*HZ, "No album art found");
         return false;
@@ -2283,6 +2440,7 @@ int settings_menu(void)
                 /* fallthrough if changed, since cache needs to be rebuilt */
             case 7:
                 cache_version = CACHE_REBUILD;
+                cache_resume = 0;
                 rb->remove(EMPTY_SLIDE);
                 configfile_save(CONFIG_FILE, config,
                                 CONFIG_NUM_ITEMS, CONFIG_VERSION);
@@ -2553,13 +2711,17 @@ void start_playback(bool append)
     else if (append || (rb->playlist_remove_all_tracks(NULL) == 0
             && rb->playlist_create(NULL, NULL) == 0))
     {
+        struct playlist_insert_context context;
+        if (rb->playlist_insert_context_create(NULL, &context,
+                    PLAYLIST_INSERT_LAST, false, false) < 0)
+            return;
         do {
             rb->yield();
-            if (rb->playlist_insert_track(NULL, get_track_filename(count),
-                    PLAYLIST_INSERT_LAST, false, true) < 0)
+            if (rb->playlist_insert_context_add(&context,
+                    get_track_filename(count)) < 0)
                 break;
         } while(++count < track_count);
-        rb->playlist_sync(NULL);
+        rb->playlist_insert_context_release(&context);
     }
     else
         return;
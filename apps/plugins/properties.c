@@ -135,52 +135,41 @@ static bool file_properties(char* selected_file)
 
 typedef struct {
     char dirname[MAX_PATH];
-    int len;
     unsigned int dc;
     unsigned int fc;
     long long bc;
+    bool incomplete;            /* counts are a lower bound */
 } DPS;
 
 static bool _dir_properties(DPS* dps)
 {
-    /* recursively scan directories in search of files
+    /* walk the whole tree in search of files
        and informs the user of the progress */
     bool result;
     static long lasttick=0;
-    int dirlen;
-    DIR* dir;
-    struct dirent* entry;
+    struct treewalk walk;
 
     result = true;
-    dirlen = rb->strlen(dps->dirname);
-    dir = rb->opendir(dps->dirname);
-    if (!dir)
+    if (rb->treewalk_open(&walk, dps->dirname, 0, NULL, 0) < 0)
         return false; /* open error */
 
-    /* walk through the directory content */
-    while(result && (0 != (entry = rb->readdir(dir))))
+    while(result && rb->treewalk_next(&walk))
     {
-        struct dirinfo info = rb->dir_get_info(dir, entry);
-        /* append name to current directory */
-        rb->snprintf(dps->dirname+dirlen, dps->len-dirlen, "/%s",
-                     entry->d_name);
-
-        if (info.attribute & ATTR_DIRECTORY)
+        if (walk.info.attribute & ATTR_DIRECTORY)
         {
             unsigned log;
 
-            if (!rb->strcmp((char *)entry->d_name, ".") ||
-                !rb->strcmp((char *)entry->d_name, ".."))
-                continue; /* skip these */
-
             dps->dc++; /* new directory */
             if (*rb->current_tick - lasttick > (HZ/8))
             {
+                char path[MAX_PATH];
+
                 lasttick = *rb->current_tick;
+                rb->treewalk_get_path(&walk, path, sizeof path);
                 rb->lcd_clear_display();
                 rb->lcd_puts(0,0,"SCANNING...");
-                rb->lcd_puts(0,1,dps->dirname);
-                rb->lcd_puts(0,2,entry->d_name);
+                rb->lcd_puts(0,1,path);
+                rb->lcd_puts(0,2,walk.name);
                 rb->lcd_putsf(0,3,"Directories: %d", dps->dc);
                 rb->lcd_putsf(0,4,"Files: %d", dps->fc);
                 log = human_size_log(dps->bc);
@@ -188,31 +177,30 @@ static bool _dir_properties(DPS* dps)
                                                 human_size_prefix[log]);
                 rb->lcd_update();
             }
-
-             /* recursion */
-            result = _dir_properties(dps);
         }
         else
         {
             dps->fc++; /* new file */
-            dps->bc += info.size;
+            dps->bc += walk.info.size;
         }
         if(ACTION_STD_CANCEL == rb->get_action(CONTEXT_STD,TIMEOUT_NOBLOCK))
             result = false;
         rb->yield();
     }
-    rb->closedir(dir);
+    dps->incomplete = walk.incomplete;
+    rb->treewalk_close(&walk);
     return result;
 }
 
 static bool dir_properties(char* selected_file)
 {
     unsigned log;
+    const char *more;
     DPS dps = {
-        .len = MAX_PATH,
         .dc  = 0,
         .fc  = 0,
         .bc  = 0,
+        .incomplete = false,
     };
     rb->strlcpy(dps.dirname, selected_file, MAX_PATH);
 
@@ -228,11 +216,15 @@ static bool dir_properties(char* selected_file)
 #endif
 
     rb->strlcpy(str_dirname, selected_file, MAX_PATH);
-    rb->snprintf(str_dircount, sizeof str_dircount, "Subdirs: %d", dps.dc);
-    rb->snprintf(str_filecount, sizeof str_filecount, "Files: %d", dps.fc);
+    /* a '+' tells that some of the tree couldn't be walked */
+    more = dps.incomplete ? "+" : "";
+    rb->snprintf(str_dircount, sizeof str_dircount, "Subdirs: %d%s",
+                 dps.dc, more);
+    rb->snprintf(str_filecount, sizeof str_filecount, "Files: %d%s",
+                 dps.fc, more);
     log = human_size_log(dps.bc);
-    rb->snprintf(str_size, sizeof str_size, "Size: %ld %cB",
-                 (long) (dps.bc >> (log*10)), human_size_prefix[log]);
+    rb->snprintf(str_size, sizeof str_size, "Size: %ld %cB%s",
+                 (long) (dps.bc >> (log*10)), human_size_prefix[log], more);
     num_properties = 4;
     return true;
 }
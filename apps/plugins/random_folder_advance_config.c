@@ -25,6 +25,7 @@
 
 
 static bool cancel;
+static bool incomplete; /* some folders couldn't be looked at */
 static int fd;
 static int dirs_count;
 static int lasttick;
@@ -58,78 +59,87 @@ void update_screen(bool clear)
     }
 }
 
-void traversedir(char* location, char* name)
+/* Skip .rockbox and the removed directories */
+static bool traverse_filter(const struct treewalk *walk, void *data)
 {
-    struct dirent *entry;
-    DIR* dir;
-    char fullpath[MAX_PATH], path[MAX_PATH];
-    bool check = false;
+    char path[MAX_PATH], *start = path;
     int i;
+    (void)data;
 
-    rb->snprintf(fullpath, sizeof(fullpath), "%s/%s", location, name);
-    dir = rb->opendir(fullpath);
-    if (dir) {
-        entry = rb->readdir(dir);
-        while (entry) {
-            if (cancel)
-                break;
-            /* Skip .. and . */
-            if (entry->d_name[0] == '.')
-            {
-                if (    !rb->strcmp(entry->d_name,".")
-                     || !rb->strcmp(entry->d_name,"..")
-                     || !rb->strcmp(entry->d_name,".rockbox"))
-                    check = false;
-                else check = true;
-            }
-            else check = true;
+    if (!(walk->info.attribute & ATTR_DIRECTORY))
+        return true;
+
+    if (!rb->strcmp(walk->name, ".rockbox"))
+        return false;
+
+    /* check if path is removed directory, if so dont enter it */
+    rb->treewalk_get_path(walk, path, sizeof(path));
+    while(*start == '/')
+        start++;
+    for(i = 0; i < num_replaced_dirs; i++)
+    {
+        if(!rb->strcmp(start, removed_dirs[i]))
+            return false;
+    }
 
-        /* check if path is removed directory, if so dont enter it */
-        rb->snprintf(path, MAX_PATH, "%s/%s", fullpath, entry->d_name);
-        while(path[0] == '/')
-            rb->strlcpy(path, path + 1, sizeof(path));
-        for(i = 0; i < num_replaced_dirs; i++)
+    return true;
+}
+
+static void write_folder(char *path)
+{
+    char *start = &path[rb->strlen(path)];
+    rb->memset(start,0,&path[MAX_PATH-1]-start);
+    rb->write(fd,path,MAX_PATH);
+    dirs_count++;
+}
+
+/* Adds every folder below path holding music files to the list, path
+   itself only if include_root is set */
+void traversedir(const char *path, bool include_root)
+{
+    struct treewalk walk;
+    /* has_music[d] is set once the folder holding the entries of depth d
+       has been written */
+    bool has_music[TREEWALK_MAX_DEPTH+1];
+    char buf[MAX_PATH];
+
+    rb->snprintf(buf, sizeof(buf), "/%s", path);
+    if (rb->treewalk_open(&walk, buf, 0, NULL, 0) < 0)
+        return;
+    walk.filter = traverse_filter;
+    has_music[0] = !include_root;
+
+    while (!cancel && rb->treewalk_next(&walk)) {
+        if (walk.info.attribute & ATTR_DIRECTORY)
+            has_music[walk.depth+1] = false;
+        else if (!has_music[walk.depth] &&
+                 (rb->filetype_get_attr(walk.name) & FILE_ATTR_MASK)
+                    == FILE_ATTR_AUDIO)
         {
-            if(!rb->strcmp(path, removed_dirs[i]))
-            {
-                check = false;
-                break;
-            }
+            char *slash;
+            has_music[walk.depth] = true;
+            rb->treewalk_get_path(&walk, buf, MAX_PATH);
+            slash = rb->strrchr(buf, '/');
+            slash[slash == buf ? 1 : 0] = '\0';
+            write_folder(buf);
         }
 
-            if (check)
-            {
-                struct dirinfo info = rb->dir_get_info(dir, entry);
-                if (info.attribute & ATTR_DIRECTORY) {
-                    char *start;
-                    dirs_count++;
-                    rb->snprintf(path,MAX_PATH,"%s/%s",fullpath,entry->d_name);
-                    start = &path[rb->strlen(path)];
-                    rb->memset(start,0,&path[MAX_PATH-1]-start);
-                    rb->write(fd,path,MAX_PATH);
-                    traversedir(fullpath, entry->d_name);
-                }
-            }
-            if (*rb->current_tick - lasttick > (HZ/2)) {
-                update_screen(false);
-                lasttick = *rb->current_tick;
-                if (rb->action_userabort(TIMEOUT_NOBLOCK))
-                {
-                    cancel = true;
-                    break;
-                }
-            }
-
-            entry = rb->readdir(dir);
+        if (*rb->current_tick - lasttick > (HZ/2)) {
+            update_screen(false);
+            lasttick = *rb->current_tick;
+            if (rb->action_userabort(TIMEOUT_NOBLOCK))
+                cancel = true;
         }
-        rb->closedir(dir);
     }
+    if (walk.incomplete)
+        incomplete = true;
+    rb->treewalk_close(&walk);
 }
 
 bool custom_dir(void)
 {
     DIR* dir_check;
-    char *starts, line[MAX_PATH], formatted_line[MAX_PATH];
+    char line[MAX_PATH], formatted_line[MAX_PATH];
     static int fd2;
     char buf[11];
     int i, errors = 0;
@@ -168,8 +178,6 @@ bool custom_dir(void)
                 if (dir_check)
                 {
                     rb->closedir(dir_check);
-                    starts = &formatted_line[rb->strlen(formatted_line)];
-                    rb->memset(starts, 0, &formatted_line[MAX_PATH-1]-starts);
                     bool write_line = true;
 
                     for(i = 0; i < num_replaced_dirs; i++)
@@ -181,13 +189,7 @@ bool custom_dir(void)
                         }
                     }
 
-                    if(write_line)
-                    {
-                        dirs_count++;
-                        rb->write(fd, formatted_line, MAX_PATH);
-                    }
-
-                    traversedir("", line);
+                    traversedir(line, write_line);
                 }
                 else
                 {
@@ -216,6 +218,7 @@ void generate(void)
 {
     dirs_count = 0;
     cancel = false;
+    incomplete = false;
     fd = rb->open(RFA_FILE,O_CREAT|O_WRONLY, 0666);
     rb->write(fd,&dirs_count,sizeof(int));
     if (fd < 0)
@@ -229,12 +232,15 @@ void generate(void)
     lasttick = *rb->current_tick;
 
     if(!custom_dir())
-        traversedir("", "");
+        traversedir("", true);
 
     rb->lseek(fd,0,SEEK_SET);
     rb->write(fd,&dirs_count,sizeof(int));
     rb->close(fd);
-    rb->splash(HZ, "Done");
+    if (incomplete)
+        rb->splash(HZ*2, "Done, some folders were skipped");
+    else
+        rb->splash(HZ, "Done");
 }
 
 static const char* list_get_name_cb(int selected_item, void* data,
@@ -0,0 +1,189 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2012 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "string-extra.h"
+#include "system.h"
+#include "file.h"
+#if !(CONFIG_PLATFORM & PLATFORM_NATIVE)
+#include <sys/stat.h>
+#endif
+#include "dir.h"
+#include "crc32.h"
+#include "albumart_cache.h"
+
+/* Define LOGF_ENABLE to enable logf output in this file */
+/*#define LOGF_ENABLE*/
+#include "logf.h"
+
+/* Bump this whenever the file layout or the way the bitmaps are scaled
+ * changes, so that old cache files are ignored. */
+#define AACACHE_MAGIC   0x41414301 /* "AAC" + version */
+
+/* The cache is a fixed set of slots, a new bitmap simply replaces whatever
+ * was in its slot before. This keeps the directory from growing without
+ * bounds as the library is played through. */
+#define AACACHE_SLOTS   256
+
+#ifdef LCD_PIXELFORMAT
+#define AACACHE_FORMAT  ((LCD_DEPTH << 16) | LCD_PIXELFORMAT)
+#else
+#define AACACHE_FORMAT  (LCD_DEPTH << 16)
+#endif
+
+struct aacache_header {
+    uint32_t magic;
+    struct albumart_cache_key key;
+    int32_t width;          /* bitmap dimensions after scaling */
+    int32_t height;
+    int32_t format;         /* struct bitmap format field */
+    int32_t datasize;       /* bytes of bitmap data following the header */
+};
+
+/* Lookups happen in the thread opening the art and saves in the buffering
+ * thread, each gets its own header to keep it off the stack */
+static struct aacache_header load_header;
+static struct aacache_header save_header;
+
+/* Write date and time of the open file, as found in its directory entry
+ * when it was opened */
+static bool get_mtime(int fd, uint32_t *mtime)
+{
+#if (CONFIG_PLATFORM & PLATFORM_NATIVE)
+    unsigned long wrt;
+
+    if (file_get_mtime(fd, &wrt) < 0)
+        return false;
+    *mtime = wrt;
+#else
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+        return false;
+    *mtime = st.st_mtime;
+#endif
+    return true;
+}
+
+static void get_cache_filename(const struct albumart_cache_key *key,
+                               char *buf, size_t buflen)
+{
+    unsigned crc = crc_32(key->path, strlen(key->path), 0xffffffff);
+    crc = crc_32(key, offsetof(struct albumart_cache_key, path), crc);
+    snprintf(buf, buflen, ALBUMART_CACHE_DIR "/%02x.raw",
+             crc % AACACHE_SLOTS);
+}
+
+bool albumart_cache_get_key(struct albumart_cache_key *key, int fd,
+                            const char *path, const struct mp3_albumart *aa,
+                            const struct dim *dim)
+{
+    memset(key, 0, sizeof(*key));
+
+    if (!get_mtime(fd, &key->mtime))
+        return false;
+
+    key->filesize = filesize(fd);
+    key->pos = aa ? aa->pos : -1;
+    key->size = aa ? aa->size : 0;
+    key->req_width = dim->width;
+    key->req_height = dim->height;
+    key->format = AACACHE_FORMAT;
+    strlcpy(key->path, path, sizeof(key->path));
+    return true;
+}
+
+int albumart_cache_load(const struct albumart_cache_key *key,
+                        struct bitmap *bm, int maxsize)
+{
+    char filename[MAX_PATH];
+    int fd, rc = -1;
+
+    get_cache_filename(key, filename, sizeof(filename));
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    if (read(fd, &load_header, sizeof(load_header)) != sizeof(load_header)
+        || load_header.magic != AACACHE_MAGIC
+        || memcmp(&load_header.key, key, sizeof(*key))
+        || load_header.datasize <= 0 || load_header.datasize > maxsize
+        || filesize(fd) != (off_t)sizeof(load_header) + load_header.datasize)
+        goto out;
+
+    if (read(fd, bm->data, load_header.datasize) != load_header.datasize)
+        goto out;
+
+    bm->width = load_header.width;
+    bm->height = load_header.height;
+#if (LCD_DEPTH > 1) || defined(HAVE_REMOTE_LCD) && (LCD_REMOTE_DEPTH > 1)
+    bm->format = load_header.format;
+#endif
+    rc = load_header.datasize;
+    logf("aacache hit %s", filename);
+out:
+    close(fd);
+    return rc;
+}
+
+bool albumart_cache_save(const struct albumart_cache_key *key,
+                         const struct bitmap *bm, int size)
+{
+    char filename[MAX_PATH];
+    int fd;
+    bool ok;
+
+    get_cache_filename(key, filename, sizeof(filename));
+    fd = creat(filename, 0666);
+    if (fd < 0)
+    {
+        /* first use, the directory may not exist yet */
+        mkdir(ALBUMART_CACHE_DIR);
+        fd = creat(filename, 0666);
+        if (fd < 0)
+            return false;
+    }
+
+    save_header.magic = AACACHE_MAGIC;
+    save_header.key = *key;
+    save_header.width = bm->width;
+    save_header.height = bm->height;
+#if (LCD_DEPTH > 1) || defined(HAVE_REMOTE_LCD) && (LCD_REMOTE_DEPTH > 1)
+    save_header.format = bm->format;
+#else
+    save_header.format = 0;
+#endif
+    save_header.datasize = size;
+
+    ok = write(fd, &save_header, sizeof(save_header)) == sizeof(save_header)
+         && write(fd, bm->data, size) == size;
+    close(fd);
+
+    /* A partial file would be rejected by the size check anyway, but don't
+     * leave it lying around */
+    if (!ok)
+        remove(filename);
+
+    logf("aacache save %s: %d", filename, ok);
+    return ok;
+}
@@ -0,0 +1,73 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2012 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+#ifndef _ALBUMART_CACHE_H_
+#define _ALBUMART_CACHE_H_
+
+#ifdef HAVE_ALBUMART
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include "lcd.h"
+#include "metadata.h"
+#include "bmp.h"
+
+/* Album art that was already scaled to a skin's viewport is kept on disk in
+ * native format, so that the next time the same art is requested at the same
+ * size it only has to be read back instead of decoded and resized. */
+#define ALBUMART_CACHE_DIR ROCKBOX_DIR "/aacache"
+
+/* Identifies one scaled copy of one piece of album art. A cache file only
+ * matches if every field is the same, so editing the source file, changing
+ * the skin's album art size or running a build for another display all
+ * simply miss. */
+struct albumart_cache_key {
+    uint32_t mtime;         /* write date and time of the source file */
+    int32_t  filesize;      /* size of the source file */
+    int32_t  pos;           /* offset of embedded art, or -1 */
+    int32_t  size;          /* size of embedded art, or 0 */
+    int32_t  req_width;     /* size the art was scaled to fit */
+    int32_t  req_height;
+    uint32_t format;        /* depth and pixel format of the bitmap data */
+    char     path[MAX_PATH];
+};
+
+/* Fill in key for the art in the open file fd. aa describes embedded art and
+ * is NULL for a separate image file.
+ * Returns false if the source file couldn't be identified */
+bool albumart_cache_get_key(struct albumart_cache_key *key, int fd,
+                            const char *path, const struct mp3_albumart *aa,
+                            const struct dim *dim);
+
+/* Load the cached bitmap for key into bm, whose data pointer must already
+ * be set up to point to maxsize bytes.
+ * Returns the size of the bitmap data, or a value <= 0 on a miss */
+int albumart_cache_load(const struct albumart_cache_key *key,
+                        struct bitmap *bm, int maxsize);
+
+/* Write size bytes of bitmap data from bm to the cache under key.
+ * Returns false if the cache file couldn't be written */
+bool albumart_cache_save(const struct albumart_cache_key *key,
+                         const struct bitmap *bm, int size);
+
+#endif /* HAVE_ALBUMART */
+
+#endif /* _ALBUMART_CACHE_H_ */
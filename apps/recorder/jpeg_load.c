@@ -30,6 +30,11 @@
 #include "plugin.h"
 #include "debug.h"
 #include "jpeg_load.h"
+#if defined(HAVE_ALBUMART) && !defined(PLUGIN) && !defined(JPEG_FROM_MEM)
+/* album art embedded in Vorbis comments is base64 encoded */
+#define JPEG_BASE64
+#include "metadata/metadata_common.h"
+#endif
 /*#define JPEG_BS_DEBUG*/
 //#define ROCKBOX_DEBUG_JPEG
 /* for portability of below JPEG code */
@@ -79,18 +84,22 @@ struct jpeg
     int fd;
     int buf_left;
     int buf_index;
+#ifdef JPEG_BASE64
+    bool base64; /* file data is base64 text */
+#endif
 #endif
     unsigned long len;
     unsigned long int bitbuf;
     int bitbuf_bits;
     int marker_ind;
     int marker_val;
-    unsigned char marker;
+    unsigned char marker; /* marker hit inside entropy data, not yet handled */
     int x_size, y_size; /* size of image (can be less than block boundary) */
     int x_phys, y_phys; /* physical size, block aligned */
     int x_mbl; /* x dimension of MBL */
     int y_mbl; /* y dimension of MBL */
     int blocks; /* blocks per MB */
+    int components; /* components in frame */
     int restart_interval; /* number of MCUs between RSTm markers */
     int restart; /* blocks until next restart marker */
     int mcu_row; /* current row relative to first row of this row of MCUs */
@@ -120,7 +129,19 @@ struct jpeg
     struct derived_tbl ac_derived_tbls[2];
 
     struct frame_component frameheader[3]; /* Component descriptor */
-    struct scan_component scanheader[3]; /* currently not used */
+    struct scan_component scanheader[3]; /* components of current scan */
+    int scan_components; /* number of components in current scan */
+    int spectral_start; /* Ss, first zig-zag index coded in scan */
+    int spectral_end; /* Se, last zig-zag index coded in scan */
+    int approx_high; /* Ah, successive approximation bit position high */
+    int approx_low; /* Al, successive approximation bit position low */
+
+    bool progressive; /* SOF2 frame, image is kept in coefficient planes */
+    int16_t *coef_buf[3]; /* per component needed coefficients, per block */
+    uint64_t *coef_nz[3]; /* per component nonzero history of each block */
+    int coef_need[3]; /* coefficients kept per block */
+    int coef_stride[3]; /* blocks per row of coefficient plane */
+    int coef_row; /* MCU row to output next */
 
     int mcu_membership[6]; /* info per block */
     int tab_membership[6];
@@ -888,6 +909,22 @@ INLINE void jpeg_putc(struct jpeg* p_jpeg)
 #else
 INLINE void fill_buf(struct jpeg* p_jpeg)
 {
+#ifdef JPEG_BASE64
+    if (p_jpeg->base64)
+    {   /* whole groups of 4 characters, decoded in place */
+        int n = read(p_jpeg->fd, p_jpeg->buf,
+                     MIN(p_jpeg->len, JPEG_READ_BUF_SIZE & ~3));
+        p_jpeg->buf_index = 0;
+        p_jpeg->buf_left = n;
+        if (n > 0)
+        {
+            p_jpeg->len -= n;
+            p_jpeg->buf_left = base64_decode((char *)p_jpeg->buf, n,
+                                             p_jpeg->buf);
+        }
+        return;
+    }
+#endif
         p_jpeg->buf_left = read(p_jpeg->fd, p_jpeg->buf,
                                 (p_jpeg->len >= JPEG_READ_BUF_SIZE)?
                                      JPEG_READ_BUF_SIZE : p_jpeg->len);
@@ -908,6 +945,23 @@ static unsigned char *jpeg_getc(struct jpeg* p_jpeg)
 
 INLINE bool skip_bytes_seek(struct jpeg* p_jpeg)
 {
+#ifdef JPEG_BASE64
+    if (p_jpeg->base64)
+    {   /* no seeking in encoded data, decode what is skipped instead */
+        int count = -p_jpeg->buf_left;
+        while (count > 0)
+        {
+            fill_buf(p_jpeg);
+            if (p_jpeg->buf_left <= 0)
+                return false;
+            int n = MIN(count, p_jpeg->buf_left);
+            p_jpeg->buf_left -= n;
+            p_jpeg->buf_index += n;
+            count -= n;
+        }
+        return true;
+    }
+#endif
     if (UNLIKELY(lseek(p_jpeg->fd, -p_jpeg->buf_left, SEEK_CUR) < 0))
         return false;
     p_jpeg->buf_left = 0;
@@ -957,25 +1011,43 @@ static int process_markers(struct jpeg* p_jpeg)
     int i, j, n;
     int ret = 0; /* returned flags */
 
-    while ((c = e_getc(p_jpeg, -1)))
+    while (true)
     {
-        if (c != 0xFF) /* no marker? */
-        {
-            JDEBUGF("Non-marker data\n");
-            jpeg_putc(p_jpeg);
-            break; /* exit marker processing */
+        if (p_jpeg->marker)
+        {   /* the entropy decoder already read this marker */
+            c = p_jpeg->marker;
+            p_jpeg->marker = 0;
         }
+        else
+        {
+            c = e_getc(p_jpeg, -1);
+            if (c != 0xFF) /* no marker? (entropy data may start with 0) */
+            {
+                JDEBUGF("Non-marker data\n");
+                jpeg_putc(p_jpeg);
+                break; /* exit marker processing */
+            }
 
-        c = e_getc(p_jpeg, -1);
+            c = e_getc(p_jpeg, -1);
+        }
         JDEBUGF("marker value %X\n",c);
         switch (c)
         {
         case 0xFF: /* Fill byte */
             ret |= FILL_FF;
-        case 0x00: /* Zero stuffed byte - entropy data */
             jpeg_putc(p_jpeg);
             continue;
 
+        case 0x00: /* Zero stuffed byte - entropy data */
+            /* the 0xFF is the first data byte, start the bit buffer with it */
+            p_jpeg->bitbuf = 0xFF;
+            p_jpeg->bitbuf_bits = 8;
+            return ret;
+
+        case 0xC2: /* SOF Huff  - Progressive DCT*/
+            ret |= SOF2;
+            p_jpeg->progressive = true;
+            /* fall through, the frame header is the same */
         case 0xC0: /* SOF Huff  - Baseline DCT */
             {
                 JDEBUGF("SOF marker ");
@@ -1014,11 +1086,11 @@ static int process_markers(struct jpeg* p_jpeg)
                     return -3; /* Unsupported SOF0 subsampling */
                 }
                 p_jpeg->blocks = n;
+                p_jpeg->components = n;
             }
             break;
 
         case 0xC1: /* SOF Huff  - Extended sequential DCT*/
-        case 0xC2: /* SOF Huff  - Progressive DCT*/
         case 0xC3: /* SOF Huff  - Spatial (sequential) lossless*/
         case 0xC5: /* SOF Huff  - Differential sequential DCT*/
         case 0xC6: /* SOF Huff  - Differential progressive DCT*/
@@ -1103,7 +1175,7 @@ static int process_markers(struct jpeg* p_jpeg)
             break;
         case 0xD9: /* End of Image */
             JDEBUGF("EOI\n");
-            break;
+            return ret | EOI; /* nothing may follow */
         case 0x01: /* for temp private use arith code */
             JDEBUGF("private\n");
             break; /* skip parameterless marker */
@@ -1117,7 +1189,9 @@ static int process_markers(struct jpeg* p_jpeg)
                 marker_size -= 2;
 
                 n = (marker_size-1-3)/2;
-                if (e_getc(p_jpeg, -1) != n || (n != 1 && n != 3))
+                /* progressive DC scans may interleave any of the components */
+                if (e_getc(p_jpeg, -1) != n || (n != 1 && n != 3
+                    && !(n == 2 && p_jpeg->progressive)))
                 {
                     return (-7); /* Unsupported SOS component specification */
                 }
@@ -1130,7 +1204,14 @@ static int process_markers(struct jpeg* p_jpeg)
                     p_jpeg->scanheader[i].AC_select = c & 0x0F;
                     marker_size -= 2;
                 }
-                /* skip spectral information */
+                p_jpeg->scan_components = n;
+                /* spectral selection and successive approximation */
+                p_jpeg->spectral_start = e_getc(p_jpeg, -1);
+                p_jpeg->spectral_end = e_getc(p_jpeg, -1);
+                c = e_getc(p_jpeg, -1);
+                p_jpeg->approx_high = c >> 4;
+                p_jpeg->approx_low = c & 0x0F;
+                marker_size -= 3;
                 e_skip_bytes(p_jpeg, marker_size);
             }
             break;
@@ -1573,27 +1654,42 @@ static void fill_bit_buffer(struct jpeg* p_jpeg)
 
     if (p_jpeg->marker_val)
         p_jpeg->marker_ind += 16;
-    byte = d_getc(p_jpeg, 0);
+    /* past a marker ending the entropy data, only feed zeros */
+    byte = p_jpeg->marker ? 0 : d_getc(p_jpeg, 0);
     if (UNLIKELY(byte == 0xFF)) /* legal marker can be byte stuffing or RSTm */
     {   /* simplification: just skip the (one-byte) marker code */
-        marker = d_getc(p_jpeg, 0);
+        do
+            marker = d_getc(p_jpeg, 0);
+        while (UNLIKELY(marker == 0xFF)); /* fill bytes before a marker */
         if ((marker & ~7) == 0xD0)
         {
             p_jpeg->marker_val = marker;
             p_jpeg->marker_ind = 8;
         }
+        else if (marker)
+        {   /* keep it for process_markers() */
+            p_jpeg->marker = marker;
+            byte = 0;
+        }
     }
     p_jpeg->bitbuf = (p_jpeg->bitbuf << 8) | byte;
 
-    byte = d_getc(p_jpeg, 0);
+    byte = p_jpeg->marker ? 0 : d_getc(p_jpeg, 0);
     if (UNLIKELY(byte == 0xFF)) /* legal marker can be byte stuffing or RSTm */
     {   /* simplification: just skip the (one-byte) marker code */
-        marker = d_getc(p_jpeg, 0);
+        do
+            marker = d_getc(p_jpeg, 0);
+        while (UNLIKELY(marker == 0xFF)); /* fill bytes before a marker */
         if ((marker & ~7) == 0xD0)
         {
             p_jpeg->marker_val = marker;
             p_jpeg->marker_ind = 0;
         }
+        else if (marker)
+        {
+            p_jpeg->marker = marker;
+            byte = 0;
+        }
     }
     p_jpeg->bitbuf = (p_jpeg->bitbuf << 8) | byte;
     p_jpeg->bitbuf_bits += 16;
@@ -1654,6 +1750,8 @@ INLINE void drop_bits(struct jpeg *p_jpeg, int nbits)
 /* re-synchronize to entropy data (skip restart marker) */
 static void search_restart(struct jpeg *p_jpeg)
 {
+    if (p_jpeg->marker)
+        return; /* data ended early, nothing to resync to */
     if (p_jpeg->marker_val)
     {
         p_jpeg->marker_val = 0;
@@ -1777,6 +1875,342 @@ static const int extend_offset[16] = /* entry n is (-1 << n) + 1 */
     } /* end slow decode */ \
 }
 
+/* Progressive DCT (Annex G). Every scan only carries a spectral band or a
+ * single bit plane of some coefficients of the whole image, so these are
+ * collected in per component coefficient planes first, and the image is
+ * output through the usual scaled IDCTs afterwards. Only the zig-zag
+ * coefficients up to k_need are kept for each block, a 64-bit history tells
+ * the refinement scans which of the dropped ones are nonzero. When only DC
+ * is needed, or for components which are not output, the AC scans are
+ * skipped without decoding them.
+ */
+struct prog_state
+{
+    int last_dc[3];
+    int eobrun; /* blocks left in current end-of-band run */
+    struct derived_tbl *dctbl[3]; /* per component, as chosen by the scan */
+    struct derived_tbl *actbl[3];
+};
+
+INLINE bool prog_coef_nonzero(int16_t *coef, uint64_t *nz, int k)
+{
+    return nz ? (*nz >> k) & 1 : coef[k] != 0;
+}
+
+/* Section G.1.2.3: correction bit of an already nonzero coefficient */
+INLINE void prog_refine_coef(struct jpeg *p_jpeg, int16_t *coef, int need,
+                             int k, int p1)
+{
+    check_bit_buffer(p_jpeg, 1);
+    if (get_bits(p_jpeg, 1) && k < need && !(coef[k] & p1))
+        coef[k] += coef[k] >= 0 ? p1 : -p1;
+}
+
+static void prog_decode_dc(struct jpeg *p_jpeg, struct prog_state *st,
+                           int ci, int16_t *coef)
+{
+    int s, r;
+    if (p_jpeg->approx_high)
+    {   /* refinement: one raw bit per block */
+        check_bit_buffer(p_jpeg, 1);
+        if (get_bits(p_jpeg, 1) && coef)
+            coef[0] |= 1 << p_jpeg->approx_low;
+        return;
+    }
+    huff_decode_dc(p_jpeg, st->dctbl[ci], s, r);
+    if (s)
+        r = HUFF_EXTEND(r, s);
+    st->last_dc[ci] += r;
+    if (coef)
+        coef[0] = st->last_dc[ci] * (1 << p_jpeg->approx_low);
+}
+
+static void prog_decode_ac_first(struct jpeg *p_jpeg, struct prog_state *st,
+                                 int ci, int16_t *coef, uint64_t *nz, int need)
+{
+    int k, s, r;
+    if (st->eobrun)
+    {
+        st->eobrun--;
+        return;
+    }
+    for (k = p_jpeg->spectral_start; k <= p_jpeg->spectral_end; k++)
+    {
+        huff_decode_ac(p_jpeg, st->actbl[ci], s);
+        r = s >> 4;
+        s &= 15;
+        if (s)
+        {
+            k += r;
+            check_bit_buffer(p_jpeg, s);
+            r = get_bits(p_jpeg, s);
+            r = HUFF_EXTEND(r, s);
+            if (k < need)
+                coef[k] = r * (1 << p_jpeg->approx_low);
+            if (nz && k < 64)
+                *nz |= 1ULL << k;
+        }
+        else if (r == 15)
+            k += 15;
+        else
+        {   /* end of band, possibly for a run of blocks */
+            st->eobrun = BIT_N(r) - 1;
+            if (r)
+            {
+                check_bit_buffer(p_jpeg, r);
+                st->eobrun += get_bits(p_jpeg, r);
+            }
+            break;
+        }
+    }
+}
+
+static void prog_decode_ac_refine(struct jpeg *p_jpeg, struct prog_state *st,
+                                  int ci, int16_t *coef, uint64_t *nz,
+                                  int need)
+{
+    int p1 = 1 << p_jpeg->approx_low;
+    int k = p_jpeg->spectral_start;
+    int end = p_jpeg->spectral_end;
+    int s, r;
+    if (!st->eobrun)
+    {
+        for (; k <= end; k++)
+        {
+            huff_decode_ac(p_jpeg, st->actbl[ci], s);
+            r = s >> 4;
+            s &= 15;
+            if (s)
+            {   /* a newly nonzero coefficient, its sign follows */
+                check_bit_buffer(p_jpeg, 1);
+                s = get_bits(p_jpeg, 1) ? p1 : -p1;
+            }
+            else if (r != 15)
+            {   /* end of band, the rest is refined below */
+                st->eobrun = BIT_N(r);
+                if (r)
+                {
+                    check_bit_buffer(p_jpeg, r);
+                    st->eobrun += get_bits(p_jpeg, r);
+                }
+                break;
+            }
+            /* skip r zero coefficients, refining the nonzero ones between */
+            do
+            {
+                if (prog_coef_nonzero(coef, nz, k))
+                    prog_refine_coef(p_jpeg, coef, need, k, p1);
+                else if (--r < 0)
+                    break;
+                k++;
+            } while (k <= end);
+            if (s && k < 64)
+            {
+                if (k < need)
+                    coef[k] = s;
+                if (nz)
+                    *nz |= 1ULL << k;
+            }
+        }
+    }
+    if (st->eobrun)
+    {
+        for (; k <= end; k++)
+            if (prog_coef_nonzero(coef, nz, k))
+                prog_refine_coef(p_jpeg, coef, need, k, p1);
+        st->eobrun--;
+    }
+}
+
+static void prog_decode_block(struct jpeg *p_jpeg, struct prog_state *st,
+                              int ci, int bx, int by)
+{
+    int16_t *coef = NULL;
+    uint64_t *nz = NULL;
+    int need = p_jpeg->coef_need[ci];
+    if (p_jpeg->coef_buf[ci])
+    {
+        int blk = by * p_jpeg->coef_stride[ci] + bx;
+        coef = p_jpeg->coef_buf[ci] + blk * need;
+        if (p_jpeg->coef_nz[ci])
+            nz = p_jpeg->coef_nz[ci] + blk;
+    }
+    if (!p_jpeg->spectral_start)
+        prog_decode_dc(p_jpeg, st, ci, coef);
+    else if (p_jpeg->approx_high)
+        prog_decode_ac_refine(p_jpeg, st, ci, coef, nz, need);
+    else
+        prog_decode_ac_first(p_jpeg, st, ci, coef, nz, need);
+}
+
+/* skip the rest of the entropy coded segment, up to the next marker */
+static void prog_next_marker(struct jpeg *p_jpeg)
+{
+    unsigned char *c;
+    p_jpeg->bitbuf_bits = 0;
+    p_jpeg->marker_val = 0;
+    p_jpeg->marker_ind = 0;
+    while (!p_jpeg->marker && (c = jpeg_getc(p_jpeg)))
+    {
+        if (*c != 0xFF)
+            continue;
+        unsigned char marker;
+        do
+            marker = d_getc(p_jpeg, 0);
+        while (marker == 0xFF);
+        if (marker && (marker & ~7) != 0xD0)
+            p_jpeg->marker = marker;
+    }
+}
+
+/* decode the scan whose header was just read, unless nothing in it is kept */
+static void prog_decode_scan(struct jpeg *p_jpeg)
+{
+    struct prog_state st;
+    int comp[3];
+    int i, n = p_jpeg->scan_components;
+    int ss = p_jpeg->spectral_start, se = p_jpeg->spectral_end;
+    bool wanted = false;
+    memset(&st, 0, sizeof(st));
+    /* Section G.1.1.1.1: DC scans may interleave, AC scans may not */
+    if (ss > se || se > 63 || (!ss && se) || (ss && n != 1))
+        return;
+    for (i = 0; i < n; i++)
+    {
+        int ci, id = p_jpeg->scanheader[i].ID;
+        for (ci = 0; ci < p_jpeg->components; ci++)
+            if (p_jpeg->frameheader[ci].ID == id)
+                break;
+        int tbl = ss ? p_jpeg->scanheader[i].AC_select
+                     : p_jpeg->scanheader[i].DC_select;
+        if (ci == p_jpeg->components || tbl > 1)
+            return;
+        comp[i] = ci;
+        st.dctbl[ci] = &p_jpeg->dc_derived_tbls[tbl];
+        st.actbl[ci] = &p_jpeg->ac_derived_tbls[tbl];
+        /* AC scans carry the history later refinements rely on, so those
+         * can only be skipped if no AC coefficient is kept at all */
+        if (p_jpeg->coef_buf[ci] && (!ss || p_jpeg->coef_need[ci] > 1))
+            wanted = true;
+    }
+    if (!wanted)
+        return;
+
+    int h_samp = p_jpeg->frameheader[0].horizontal_sampling;
+    int v_samp = p_jpeg->frameheader[0].vertical_sampling;
+    int mcus_x, mcus_y, mx, my;
+    if (n == 1)
+    {   /* non-interleaved: an MCU is one block of the component's own size */
+        int w = p_jpeg->x_size, h = p_jpeg->y_size;
+        if (comp[0])
+        {
+            w = (w + h_samp - 1) / h_samp;
+            h = (h + v_samp - 1) / v_samp;
+        }
+        mcus_x = (w + 7) / 8;
+        mcus_y = (h + 7) / 8;
+    } else {
+        mcus_x = p_jpeg->x_mbl;
+        mcus_y = p_jpeg->y_mbl;
+    }
+    p_jpeg->restart = p_jpeg->restart_interval;
+    for (my = 0; my < mcus_y; my++)
+    {
+        for (mx = 0; mx < mcus_x; mx++)
+        {
+            if (n == 1)
+                prog_decode_block(p_jpeg, &st, comp[0], mx, my);
+            else for (i = 0; i < n; i++)
+            {
+                int ci = comp[i], x, y;
+                int hs = ci ? 1 : h_samp, vs = ci ? 1 : v_samp;
+                for (y = 0; y < vs; y++)
+                    for (x = 0; x < hs; x++)
+                        prog_decode_block(p_jpeg, &st, ci, mx * hs + x,
+                            my * vs + y);
+            }
+            if (p_jpeg->restart_interval && --p_jpeg->restart == 0
+                && (mx + 1 < mcus_x || my + 1 < mcus_y))
+            {   /* if a restart marker is due: */
+                p_jpeg->restart = p_jpeg->restart_interval;
+                search_restart(p_jpeg);
+                st.last_dc[0] = st.last_dc[1] = st.last_dc[2] = 0;
+                st.eobrun = 0;
+            }
+        }
+        yield();
+    }
+}
+
+/* Allocate the coefficient planes from buf and decode all scans into them.
+ * Returns the buffer space used, or a negative value if it does not fit.
+ */
+static int prog_decode_image(struct jpeg *p_jpeg, char *buf, int size)
+{
+    char *buf_start = buf;
+    int ci, status;
+#ifdef HAVE_LCD_COLOR
+    int comps = p_jpeg->components;
+#else
+    int comps = 1; /* only luma is output */
+#endif
+    for (ci = 0; ci < comps; ci++)
+    {
+        int hs = ci ? 1 : p_jpeg->frameheader[0].horizontal_sampling;
+        int vs = ci ? 1 : p_jpeg->frameheader[0].vertical_sampling;
+        /* same coefficients as the baseline decoder keeps */
+        int need = MAX(p_jpeg->k_need[!!ci], 1);
+        int blocks = p_jpeg->x_mbl * hs * p_jpeg->y_mbl * vs;
+        /* history of dropped coefficients, unless no AC scan is decoded */
+        int nz_size = need > 1 ? blocks * sizeof(uint64_t) : 0;
+        int coef_size = blocks * need * sizeof(int16_t);
+        ALIGN_BUFFER(buf, size, sizeof(uint64_t));
+        if (size < nz_size + coef_size)
+            return -1;
+        p_jpeg->coef_nz[ci] = nz_size ? (uint64_t *)buf : NULL;
+        p_jpeg->coef_buf[ci] = (int16_t *)(buf + nz_size);
+        p_jpeg->coef_need[ci] = need;
+        p_jpeg->coef_stride[ci] = p_jpeg->x_mbl * hs;
+        memset(buf, 0, nz_size + coef_size);
+        buf += nz_size + coef_size;
+        size -= nz_size + coef_size;
+    }
+    JDEBUGF("coefficient planes: %d bytes\n", (int)(buf - buf_start));
+    do
+    {
+        prog_decode_scan(p_jpeg);
+        prog_next_marker(p_jpeg);
+        status = process_markers(p_jpeg);
+        if (status > 0 && (status & DHT))
+            fix_huff_tables(p_jpeg);
+    /* a broken or truncated stream shows what has been decoded so far */
+    } while (status > 0 && (status & SOS));
+    /* restart intervals only apply to the entropy coded data */
+    p_jpeg->restart_interval = 0;
+    p_jpeg->coef_row = 0;
+    return buf - buf_start;
+}
+
+/* dequantize the kept coefficients of one block of the current MCU row */
+INLINE void prog_load_block(struct jpeg *p_jpeg, int16_t *block, int ci,
+                            int blkn, int x, const unsigned char *zz)
+{
+    int hs = ci ? 1 : p_jpeg->frameheader[0].horizontal_sampling;
+    int vs = ci ? 1 : p_jpeg->frameheader[0].vertical_sampling;
+    int i = ci ? 0 : blkn; /* block within the component's part of the MCU */
+    int need = p_jpeg->coef_need[ci];
+    int16_t *quant = p_jpeg->quanttable[!!ci];
+    int16_t *coef = p_jpeg->coef_buf[ci] + need *
+        ((p_jpeg->coef_row * vs + i / hs) * p_jpeg->coef_stride[ci]
+         + x * hs + i % hs);
+    int k;
+    block[0] = MULTIPLY16(coef[0], quant[0]);
+    MEMSET(block+1, 0, p_jpeg->zero_need[!!ci] * sizeof(int));
+    for (k = 1; k < need; k++)
+        if (coef[k])
+            block[zz[k]] = MULTIPLY16(coef[k], quant[k]);
+}
+
 static struct img_part *store_row_jpeg(void *jpeg_args)
 {
     struct jpeg *p_jpeg = (struct jpeg*) jpeg_args;
@@ -1818,6 +2252,20 @@ static struct img_part *store_row_jpeg(void *jpeg_args)
 #ifdef JPEG_IDCT_TRANSPOSE
                 bool transpose = p_jpeg->v_scale[!!ci] > 2;
 #endif
+                if (p_jpeg->progressive)
+                {
+#ifndef HAVE_LCD_COLOR
+                    if (ci)
+                        continue;
+#endif
+#ifdef JPEG_IDCT_TRANSPOSE
+                    prog_load_block(p_jpeg, block, ci, blkn, x,
+                        transpose ? zag : zag + 64);
+#else
+                    prog_load_block(p_jpeg, block, ci, blkn, x, zag);
+#endif
+                    goto block_end;
+                }
                 int k = 1; /* coefficient index */
                 int s, r; /* huffman values */
                 struct derived_tbl* dctbl = &p_jpeg->dc_derived_tbls[ti];
@@ -1949,6 +2397,7 @@ block_end:
 #endif
             }
         }
+        p_jpeg->coef_row++;
     } /* if !p_jpeg->mcu_row */
     p_jpeg->mcu_row = (p_jpeg->mcu_row + 1) & (height - 1);
     p_jpeg->part.len = width;
@@ -2031,7 +2480,7 @@ int get_jpeg_dim_mem(unsigned char *data, unsigned long len,
 
 int decode_jpeg_mem(unsigned char *data,
 #else
-int clip_jpeg_fd(int fd,
+static int decode_jpeg_fd(int fd, int base64_skip,
 #endif
                  unsigned long len,
                  struct bitmap *bm,
@@ -2062,6 +2511,16 @@ int clip_jpeg_fd(int fd,
     p_jpeg->fd = fd;
     if (p_jpeg->len == 0)
         p_jpeg->len = filesize(p_jpeg->fd);
+#ifdef JPEG_BASE64
+    if (base64_skip >= 0)
+    {
+        p_jpeg->base64 = true;
+        if (base64_skip && !skip_bytes(p_jpeg, base64_skip))
+            return -1;
+    }
+#else
+    (void)base64_skip;
+#endif
 #endif
     status = process_markers(p_jpeg);
 #ifndef JPEG_FROM_MEM
@@ -2171,6 +2630,14 @@ int clip_jpeg_fd(int fd,
         return -1;
     buf_start += decode_buf_size;
     maxsize = buf_end - buf_start;
+    if (p_jpeg->progressive)
+    {   /* all scans have to be read before the first row can be output */
+        int coef_size = prog_decode_image(p_jpeg, buf_start, maxsize);
+        if (coef_size < 0)
+            return -1;
+        buf_start += coef_size;
+        maxsize = buf_end - buf_start;
+    }
     memset(p_jpeg->img_buf, 0, decode_buf_size);
     p_jpeg->mcu_row = 0;
     p_jpeg->restart = p_jpeg->restart_interval;
@@ -2231,6 +2698,29 @@ int clip_jpeg_fd(int fd,
 }
 
 #ifndef JPEG_FROM_MEM
+int clip_jpeg_fd(int fd,
+                 unsigned long len,
+                 struct bitmap *bm,
+                 int maxsize,
+                 int format,
+                 const struct custom_format *cformat)
+{
+    return decode_jpeg_fd(fd, -1, len, bm, maxsize, format, cformat);
+}
+
+#ifdef JPEG_BASE64
+int clip_jpeg_fd_base64(int fd,
+                        int skip,
+                        unsigned long len,
+                        struct bitmap *bm,
+                        int maxsize,
+                        int format,
+                        const struct custom_format *cformat)
+{
+    return decode_jpeg_fd(fd, skip, len, bm, maxsize, format, cformat);
+}
+#endif
+
 int read_jpeg_fd(int fd,
                  struct bitmap *bm,
                  int maxsize,
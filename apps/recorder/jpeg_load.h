@@ -67,4 +67,19 @@ int clip_jpeg_fd(int fd,
                  int format,
                  const struct custom_format *cformat);
 
+#if defined(HAVE_ALBUMART) && !defined(PLUGIN)
+/**
+ * read base64 encoded embedded jpeg files (Vorbis comments) as above.
+ * jpeg_size is the length of the base64 text, skip the number of decoded
+ * bytes preceding the jpeg data
+ **/
+int clip_jpeg_fd_base64(int fd,
+                        int skip,
+                        unsigned long jpeg_size,
+                        struct bitmap *bm,
+                        int maxsize,
+                        int format,
+                        const struct custom_format *cformat);
+#endif
+
 #endif /* _JPEG_JPEG_DECODER_H */
@@ -73,6 +73,11 @@ static inline void clear_flush_interrupt(void)
 static size_t        num_rec_bytes;      /* Num bytes recorded             */
 static unsigned long num_rec_samples;    /* Number of PCM samples recorded */
 
+/* Disk space for the current file is reserved this far ahead of the data
+   written, so that it grows in large contiguous pieces */
+#define PREALLOC_SIZE  (4*1024*1024)
+static off_t         rec_prealloc_end;   /* End of reserved space          */
+
 /** Stats on encoded data for all files from start to stop **/
 #if 0
 static unsigned long long accum_rec_bytes; /* total size written to chunks */
@@ -660,6 +665,7 @@ static void pcmrec_start_file(void)
        enc_new_size and pcm_new_size to reflect additional
        data written if any */
     rec_fdata.filename = filename;
+    rec_prealloc_end = 0;
     enc_events_callback(ENC_START_FILE, &rec_fdata);
 
     if (errors == 0 && (rec_fdata.chunk->flags & CHUNKF_ERROR))
@@ -682,6 +688,25 @@ static void pcmrec_start_file(void)
     rec_fdata.chunk->flags &= ~CHUNKF_START_FILE;
 } /* pcmrec_start_file */
 
+/* reserve more space for the current file if the chunk would go past the
+   end of what was reserved so far */
+static void pcmrec_preallocate(void)
+{
+    off_t size;
+
+    if (rec_fdata.rec_file < 0)
+        return;
+
+    size = filesize(rec_fdata.rec_file) + rec_fdata.chunk->enc_size;
+    if (size <= rec_prealloc_end)
+        return;
+
+    /* not an error, the file simply grows as it is written if this fails */
+    rec_prealloc_end = size + PREALLOC_SIZE;
+    if (file_preallocate(rec_fdata.rec_file, rec_prealloc_end) < 0)
+        logf("prealloc failed: %ld", (long)rec_prealloc_end);
+} /* pcmrec_preallocate */
+
 static inline void pcmrec_write_chunk(void)
 {
     size_t        enc_size = rec_fdata.new_enc_size;
@@ -689,6 +714,8 @@ static inline void pcmrec_write_chunk(void)
 
     if (errors != 0)
         rec_fdata.chunk->flags |= CHUNKF_ERROR;
+    else
+        pcmrec_preallocate();
 
     enc_events_callback(ENC_WRITE_CHUNK, &rec_fdata);
 
@@ -157,6 +157,62 @@ static inline uint32_t mul_u16_u16(uint16_t op1, uint16_t op2)
 }
 #endif
 
+/* Row kernels for the vertical scalers. These work on all three channels of
+   a row at once, four values per iteration, so that loads, multiplies and
+   stores of neighbouring values can overlap instead of waiting on each other.
+*/
+
+/* acc = acc * acc_mul + tmp * tmp_mul */
+static inline void row_mul_add(uint32_t *acc, const uint32_t *tmp,
+                               const uint32_t *end, uint32_t acc_mul,
+                               uint32_t tmp_mul)
+{
+    for (; acc + 4 <= end; acc += 4, tmp += 4)
+    {
+        uint32_t a0 = acc[0], a1 = acc[1], a2 = acc[2], a3 = acc[3];
+        acc[0] = a0 * acc_mul + tmp[0] * tmp_mul;
+        acc[1] = a1 * acc_mul + tmp[1] * tmp_mul;
+        acc[2] = a2 * acc_mul + tmp[2] * tmp_mul;
+        acc[3] = a3 * acc_mul + tmp[3] * tmp_mul;
+    }
+    for (; acc < end; acc++, tmp++)
+        *acc = *acc * acc_mul + *tmp * tmp_mul;
+}
+
+/* acc += tmp * mul */
+static inline void row_add_mul(uint32_t *acc, const uint32_t *tmp,
+                               const uint32_t *end, uint32_t mul)
+{
+    for (; acc + 4 <= end; acc += 4, tmp += 4)
+    {
+        uint32_t t0 = tmp[0], t1 = tmp[1], t2 = tmp[2], t3 = tmp[3];
+        acc[0] += t0 * mul;
+        acc[1] += t1 * mul;
+        acc[2] += t2 * mul;
+        acc[3] += t3 * mul;
+    }
+    for (; acc < end; acc++, tmp++)
+        *acc += *tmp * mul;
+}
+
+#ifdef HAVE_UPSCALER
+/* val += inc */
+static inline void row_add(uint32_t *val, const uint32_t *inc,
+                           const uint32_t *end)
+{
+    for (; val + 4 <= end; val += 4, inc += 4)
+    {
+        uint32_t i0 = inc[0], i1 = inc[1], i2 = inc[2], i3 = inc[3];
+        val[0] += i0;
+        val[1] += i1;
+        val[2] += i2;
+        val[3] += i3;
+    }
+    for (; val < end; val++, inc++)
+        *val += *inc;
+}
+#endif
+
 /* horizontal area average scaler */
 static bool scale_h_area(void *out_line_ptr,
                          struct scaler_context *ctx, bool accum)
@@ -339,13 +395,11 @@ static inline bool scale_v_area(struct rowset *rset, struct scaler_context *ctx)
     oye = 0;
 #ifdef HAVE_LCD_COLOR
     uint32_t *rowacc = (uint32_t *) ctx->buf,
-             *rowtmp = rowacc + 3 * ctx->bm->width,
-             *rowacc_px, *rowtmp_px;
+             *rowtmp = rowacc + 3 * ctx->bm->width;
     memset((void *)ctx->buf, 0, ctx->bm->width * 2 * sizeof(struct uint32_rgb));
 #else
     uint32_t *rowacc = (uint32_t *) ctx->buf,
-             *rowtmp = rowacc + ctx->bm->width,
-             *rowacc_px, *rowtmp_px;
+             *rowtmp = rowacc + ctx->bm->width;
     memset((void *)ctx->buf, 0, ctx->bm->width * 2 * sizeof(uint32_t));
 #endif
     SDEBUGF("scale_v_area\n");
@@ -361,9 +415,7 @@ static inline bool scale_v_area(struct rowset *rset, struct scaler_context *ctx)
             */
             oye -= v_i_val;
             /* add stored partial row to accumulator */
-            for(rowacc_px = rowacc, rowtmp_px = rowtmp; rowacc_px != rowtmp;
-                rowacc_px++, rowtmp_px++)
-                *rowacc_px = *rowacc_px * v_o_val + *rowtmp_px * mul;
+            row_mul_add(rowacc, rowtmp, rowtmp, v_o_val, mul);
             /* store new scaled row in temp row */
             if(!ctx->h_scaler(rowtmp, ctx, false))
                 return false;
@@ -371,9 +423,7 @@ static inline bool scale_v_area(struct rowset *rset, struct scaler_context *ctx)
                scale to final value
             */
             mul = v_o_val - oye;
-            for(rowacc_px = rowacc, rowtmp_px = rowtmp; rowacc_px != rowtmp;
-                rowacc_px++, rowtmp_px++)
-                *rowacc_px += mul * *rowtmp_px;
+            row_add_mul(rowacc, rowtmp, rowtmp, mul);
             ctx->output_row(oy, (void*)rowacc, ctx);
             /* clear accumulator row, store partial coverage for next row */
 #ifdef HAVE_LCD_COLOR
@@ -634,9 +684,7 @@ static inline bool scale_v_linear(struct rowset *rset,
                 }
             }
         } else
-            for(rowinc_px = rowinc, rowval_px = rowval; rowinc_px < rowval;
-                rowinc_px++, rowval_px++)
-                *rowval_px += *rowinc_px;
+            row_add(rowval, rowinc, rowtmp);
         ctx->output_row(oy, (void*)rowval, ctx);
         iye += v_i_val;
     }
@@ -644,6 +692,20 @@ static inline bool scale_v_linear(struct rowset *rset,
 }
 #endif /* HAVE_UPSCALER */
 
+#if defined(HAVE_LCD_COLOR) && LCD_DEPTH == 16
+/* Dither and pack one RGB565 pixel. Red and blue use the same packing, so
+   they are computed together in the two halves of one word: no lane can
+   exceed 31 * 255 + 31 + 255, so nothing carries from red into blue. */
+static inline fb_data pack_rgb565(unsigned r, unsigned g, unsigned b,
+                                  unsigned delta)
+{
+    uint32_t rb = r | (b << 16);
+    rb = 31 * rb + ((rb >> 3) & 0x001f001f) + delta * 0x00010001;
+    g = (63 * g + (g >> 2) + delta) >> 8;
+    return LCD_RGBPACK_LCD((rb >> 8) & 0x1f, g, rb >> 24);
+}
+#endif
+
 #if defined(HAVE_LCD_COLOR) && (defined(HAVE_JPEG) || defined(PLUGIN))
 static void output_row_32_native_fromyuv(uint32_t row, void * row_in,
                                struct scaler_context *ctx)
@@ -672,10 +734,7 @@ static void output_row_32_native_fromyuv(uint32_t row, void * row_in,
         v = SC_OUT(qp->r, ctx);
         qp++;
         yuv_to_rgb(y, u, v, &r, &g, &b);
-        r = (31 * r + (r >> 3) + delta) >> 8;
-        g = (63 * g + (g >> 2) + delta) >> 8;
-        b = (31 * b + (b >> 3) + delta) >> 8;
-        *dest = LCD_RGBPACK_LCD(r, g, b);
+        *dest = pack_rgb565(r, g, b, delta);
         dest += DEST_STEP;
     }
 }
@@ -766,10 +825,7 @@ static void output_row_32_native(uint32_t row, void * row_in,
                     r = SC_OUT(q0.r, ctx);
                     g = SC_OUT(q0.g, ctx);
                     b = SC_OUT(q0.b, ctx);
-                    r = (31 * r + (r >> 3) + delta) >> 8;
-                    g = (63 * g + (g >> 2) + delta) >> 8;
-                    b = (31 * b + (b >> 3) + delta) >> 8;
-                    *dest = LCD_RGBPACK_LCD(r, g, b);
+                    *dest = pack_rgb565(r, g, b, delta);
                     dest += ctx->bm->height;
                 }
 #else
@@ -786,10 +842,7 @@ static void output_row_32_native(uint32_t row, void * row_in,
                     r = SC_OUT(q0.r, ctx);
                     g = SC_OUT(q0.g, ctx);
                     b = SC_OUT(q0.b, ctx);
-                    r = (31 * r + (r >> 3) + delta) >> 8;
-                    g = (63 * g + (g >> 2) + delta) >> 8;
-                    b = (31 * b + (b >> 3) + delta) >> 8;
-                    *dest++ = LCD_RGBPACK_LCD(r, g, b);
+                    *dest++ = pack_rgb565(r, g, b, delta);
                 }
 #endif
 
@@ -200,6 +200,7 @@ struct screen screens[NB_SCREENS] =
         .scroll_stop_line=&lcd_scroll_stop_line,
         .update=&lcd_update,
         .update_viewport=&lcd_update_viewport,
+        .update_dirty=&lcd_update_dirty,
         .backlight_on=&backlight_on,
         .backlight_off=&backlight_off,
         .is_backlight_on=&is_backlight_on,
@@ -291,6 +292,7 @@ struct screen screens[NB_SCREENS] =
         .scroll_stop_line=&lcd_remote_scroll_stop_line,
         .update=&lcd_remote_update,
         .update_viewport=&lcd_remote_update_viewport,
+        .update_dirty=&lcd_remote_update_dirty,
         .backlight_on=&remote_backlight_on,
         .backlight_off=&remote_backlight_off,
         .is_backlight_on=&is_remote_backlight_on,
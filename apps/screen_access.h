@@ -150,6 +150,7 @@ struct screen
     void (*scroll_stop_line)(const struct viewport* vp, int y);
     void (*update)(void);
     void (*update_viewport)(void);
+    void (*update_dirty)(void);
     void (*backlight_on)(void);
     void (*backlight_off)(void);
     bool (*is_backlight_on)(bool ignore_always_off);
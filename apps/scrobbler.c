@@ -30,10 +30,8 @@ http://www.audioscrobbler.net/wiki/Portable_Player_Logging
 #include "metadata.h"
 #include "kernel.h"
 #include "audio.h"
-#include "core_alloc.h"
 #include "settings.h"
-#include "ata_idle_notify.h"
-#include "filefuncs.h"
+#include "writeback.h"
 #include "appevents.h"
 
 #if CONFIG_RTC
@@ -48,13 +46,20 @@ http://www.audioscrobbler.net/wiki/Portable_Player_Logging
 /* increment this on any code change that effects output */
 #define SCROBBLER_REVISION " $Revision$"
 
-#define SCROBBLER_MAX_CACHE 32
 /* longest entry I've had is 323, add a safety margin */
 #define SCROBBLER_CACHE_LEN 512
 
-static int scrobbler_cache;
+static const char scrobbler_header[] =
+    "#AUDIOSCROBBLER/" SCROBBLER_VERSION "\n"
+    "#TZ/UNKNOWN\n"
+#if CONFIG_RTC
+    "#CLIENT/Rockbox " TARGET_NAME SCROBBLER_REVISION "\n";
+#else
+    "#CLIENT/Rockbox " TARGET_NAME SCROBBLER_REVISION " Timeless\n";
+#endif
 
-static int cache_pos;
+static char scrobbler_file[MAX_PATH];
+static char scrobbler_buf[SCROBBLER_CACHE_LEN];
 static struct mp3entry scrobbler_entry;
 static bool pending = false;
 static bool scrobbler_initialised = false;
@@ -103,89 +108,19 @@ static void get_scrobbler_filename(char *path, size_t size)
     }
 }
 
-static void write_cache(void)
-{
-    int i;
-    int fd;
-
-    char scrobbler_file[MAX_PATH];
-    get_scrobbler_filename(scrobbler_file, MAX_PATH);
-
-    /* If the file doesn't exist, create it.
-    Check at each write since file may be deleted at any time */
-    if(!file_exists(scrobbler_file))
-    {
-        fd = open(scrobbler_file, O_RDWR | O_CREAT, 0666);
-        if(fd >= 0)
-        {
-            fdprintf(fd, "#AUDIOSCROBBLER/" SCROBBLER_VERSION "\n"
-                         "#TZ/UNKNOWN\n"
-#if CONFIG_RTC
-                         "#CLIENT/Rockbox " TARGET_NAME SCROBBLER_REVISION "\n");
-#else
-                         "#CLIENT/Rockbox " TARGET_NAME SCROBBLER_REVISION " Timeless\n");
-#endif
-
-            close(fd);
-        }
-        else
-        {
-            logf("SCROBBLER: cannot create log file");
-        }
-    }
-
-    /* write the cache entries */
-    fd = open(scrobbler_file, O_WRONLY | O_APPEND);
-    if(fd >= 0)
-    {
-        logf("SCROBBLER: writing %d entries", cache_pos); 
-        /* copy data to temporary storage in case data moves during I/O */
-        char temp_buf[SCROBBLER_CACHE_LEN];
-        for ( i=0; i < cache_pos; i++ )
-        {
-            logf("SCROBBLER: write %d", i);
-            char* scrobbler_buf = core_get_data(scrobbler_cache);
-            ssize_t len = strlcpy(temp_buf, scrobbler_buf+(SCROBBLER_CACHE_LEN*i),
-                                        sizeof(temp_buf));
-            if (write(fd, temp_buf, len) != len)
-                break;
-        }
-        close(fd);
-    }
-    else
-    {
-        logf("SCROBBLER: error writing file");
-    }
-
-    /* clear even if unsuccessful - don't want to overflow the buffer */
-    cache_pos = 0;
-}
-
-static void scrobbler_flush_callback(void *data)
-{
-    (void)data;
-    if (scrobbler_initialised && cache_pos)
-        write_cache();
-}
-
 static void add_to_cache(unsigned long play_length)
 {
-    if ( cache_pos >= SCROBBLER_MAX_CACHE )
-        write_cache();
-
     int ret;
     char rating = 'S'; /* Skipped */
-    char* scrobbler_buf = core_get_data(scrobbler_cache);
 
-    logf("SCROBBLER: add_to_cache[%d]", cache_pos);
+    logf("SCROBBLER: add_to_cache");
 
     if ( play_length > (scrobbler_entry.length/2) )
         rating = 'L'; /* Listened */
 
     if (scrobbler_entry.tracknum > 0)
     {
-        ret = snprintf(scrobbler_buf+(SCROBBLER_CACHE_LEN*cache_pos),
-                SCROBBLER_CACHE_LEN,
+        ret = snprintf(scrobbler_buf, sizeof(scrobbler_buf),
                 "%s\t%s\t%s\t%d\t%d\t%c\t%ld\t%s\n",
                 scrobbler_entry.artist,
                 scrobbler_entry.album?scrobbler_entry.album:"",
@@ -196,8 +131,7 @@ static void add_to_cache(unsigned long play_length)
                 (long)timestamp,
                 scrobbler_entry.mb_track_id?scrobbler_entry.mb_track_id:"");
     } else {
-        ret = snprintf(scrobbler_buf+(SCROBBLER_CACHE_LEN*cache_pos),
-                SCROBBLER_CACHE_LEN,
+        ret = snprintf(scrobbler_buf, sizeof(scrobbler_buf),
                 "%s\t%s\t%s\t\t%d\t%c\t%ld\t%s\n",
                 scrobbler_entry.artist,
                 scrobbler_entry.album?scrobbler_entry.album:"",
@@ -213,8 +147,10 @@ static void add_to_cache(unsigned long play_length)
         logf("SCROBBLER: entry too long:");
         logf("SCROBBLER: %s", scrobbler_entry.path);
     } else {
-        cache_pos++;
-        register_storage_idle_func(scrobbler_flush_callback);
+        /* written out along with everything else the next time the disk
+           spins up */
+        writeback_append(scrobbler_file, scrobbler_buf, ret,
+                         scrobbler_header);
     }
 
 }
@@ -254,15 +190,11 @@ int scrobbler_init(void)
     if(!global_settings.audioscrobbler)
         return -1;
 
-    scrobbler_cache = core_alloc("scrobbler", SCROBBLER_MAX_CACHE*SCROBBLER_CACHE_LEN);
-    if (scrobbler_cache <= 0)
-    {
-        logf("SCROOBLER: OOM");
+    get_scrobbler_filename(scrobbler_file, sizeof(scrobbler_file));
+    if (!scrobbler_file[0])
         return -1;
-    }
 
     add_event(PLAYBACK_EVENT_TRACK_CHANGE, false, scrobbler_change_event);
-    cache_pos = 0;
     pending = false;
     scrobbler_initialised = true;
 
@@ -277,10 +209,6 @@ static void scrobbler_flush_cache(void)
         if(pending)
             add_to_cache(audio_prev_elapsed());
 
-        /* Write the cache to disk if needed */
-        if (cache_pos)
-            write_cache();
-
         pending = false;
     }
 }
@@ -293,9 +221,6 @@ void scrobbler_shutdown(void)
     {
         remove_event(PLAYBACK_EVENT_TRACK_CHANGE, scrobbler_change_event);
         scrobbler_initialised = false;
-        /* get rid of the buffer */
-        core_free(scrobbler_cache);
-        scrobbler_cache = 0;
     }
 }
 
@@ -308,7 +233,7 @@ void scrobbler_poweroff(void)
         else
             add_to_cache(audio_prev_elapsed());
 
-        /* scrobbler_shutdown is called later, the cache will be written
+        /* scrobbler_shutdown is called later, the journal will be written
         *  make sure the final track isn't added twice when that happens */
         pending = false;
     }
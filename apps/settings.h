@@ -277,6 +277,8 @@ struct system_status
 #endif
     signed char last_screen;
     int  viewer_icon_count;
+    int folder_advance_seed; /* key of the random folder advance order */
+    int folder_advance_pos;  /* position in that order */
     int last_volume_change; /* tick the last volume change happened. skins use this */
 };
 
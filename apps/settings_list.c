@@ -1835,6 +1835,8 @@ const struct settings_list settings[] = {
                 "resume rewind", UNIT_SEC, 0, 60, 5,
                 NULL, NULL, NULL),
 #endif
+    SYSTEM_SETTING(NVRAM(4), folder_advance_seed, 0),
+    SYSTEM_SETTING(NVRAM(4), folder_advance_pos, 0),
 };
 
 const int nb_settings = sizeof(settings)/sizeof(*settings);
@@ -1846,9 +1846,9 @@ int tagtree_get_filename(struct tree_context* c, char *buf, int buflen)
 static bool insert_all_playlist(struct tree_context *c, int position, bool queue)
 {
     struct tagcache_search tcs;
+    struct playlist_insert_context context;
     int i;
     char buf[MAX_PATH];
-    int from, to, direction;
     int files_left = c->filesindir;
 
     cpu_boost(true);
@@ -1858,32 +1858,18 @@ static bool insert_all_playlist(struct tree_context *c, int position, bool queue
         cpu_boost(false);
         return false;
     }
-    
-    if (position == PLAYLIST_REPLACE)
-    {
-        if (playlist_remove_all_tracks(NULL) == 0)
-            position = PLAYLIST_INSERT_LAST;
-        else
-        {
-            cpu_boost(false);
-            return false;
-        }
-    }
 
-    if (position == PLAYLIST_INSERT_FIRST)
+    /* Tracks are inserted as one batch, in list order whatever the
+       position, so the control file is written once per batch. */
+    if (playlist_insert_context_create(NULL, &context, position,
+                                       queue, false) < 0)
     {
-        from = c->filesindir - 1;
-        to = -1;
-        direction = -1;
-    }
-    else
-    {
-        from = 0;
-        to = c->filesindir;
-        direction = 1;
+        tagcache_search_finish(&tcs);
+        cpu_boost(false);
+        return false;
     }
-    
-    for (i = from; i != to; i += direction)
+
+    for (i = 0; i < c->filesindir; i++)
     {
         /* Count back to zero */
         if (!show_search_progress(false, files_left--))
@@ -1895,14 +1881,14 @@ static bool insert_all_playlist(struct tree_context *c, int position, bool queue
             continue;
         }
 
-        if (playlist_insert_track(NULL, buf, position, queue, false) < 0)
+        if (playlist_insert_context_add(&context, buf) < 0)
         {
-            logf("playlist_insert_track failed");
+            logf("playlist_insert_context_add failed");
             break;
         }
         yield();
     }
-    playlist_sync(NULL);
+    playlist_insert_context_release(&context);
     tagcache_search_finish(&tcs);
     cpu_boost(false);
     
@@ -0,0 +1,196 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2012 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+#include <string.h>
+#include "config.h"
+#include "system.h"
+#include "kernel.h"
+#include "file.h"
+#include "core_alloc.h"
+#include "ata_idle_notify.h"
+#include "writeback.h"
+
+/* Define LOGF_ENABLE to enable logf output in this file */
+/*#define LOGF_ENABLE*/
+#include "logf.h"
+
+#define WRITEBACK_BUFFER_SIZE (8*1024)
+
+struct writeback_record
+{
+    unsigned short size;    /* of the whole record, aligned */
+    unsigned short datalen;
+    const char *header;     /* written when the file is created */
+    char path[];            /* followed by the data */
+};
+
+static int writeback_handle;
+static size_t writeback_used;       /* bytes of records in the buffer */
+static bool writeback_committing;   /* the buffer may not move */
+static struct mutex writeback_mutex;
+
+static int move_callback(int handle, void *current, void *new)
+{
+    (void)handle; (void)current; (void)new;
+    return writeback_committing ? BUFLIB_CB_CANNOT_MOVE : BUFLIB_CB_OK;
+}
+
+static struct buflib_callbacks ops = {
+    .move_callback = move_callback,
+    .shrink_callback = NULL,
+};
+
+/* Open path for appending, creating it with header if it doesn't exist */
+static int open_record_file(const struct writeback_record *rec)
+{
+    int fd = open(rec->path, O_WRONLY|O_APPEND);
+
+    if (fd < 0)
+    {
+        fd = open(rec->path, O_WRONLY|O_CREAT|O_APPEND, 0666);
+        if (fd >= 0 && rec->header)
+            write(fd, rec->header, strlen(rec->header));
+    }
+
+    return fd;
+}
+
+static void writeback_commit(void)
+{
+    const char *path = NULL;
+    size_t pos = 0;
+    int fd = -1;
+
+    mutex_lock(&writeback_mutex);
+
+    if (writeback_committing || !writeback_used)
+    {
+        mutex_unlock(&writeback_mutex);
+        return;
+    }
+
+    writeback_committing = true;
+
+    /* Records may still be added while this yields for the disk, they go
+       after the ones being written and are picked up too */
+    while (pos < writeback_used || fd >= 0)
+    {
+        if (pos >= writeback_used)
+        {
+            /* Caught up, but something could come in while closing */
+            mutex_unlock(&writeback_mutex);
+            close(fd);
+            fd = -1;
+            path = NULL;
+            mutex_lock(&writeback_mutex);
+            continue;
+        }
+
+        struct writeback_record *rec =
+            (void *)((char *)core_get_data(writeback_handle) + pos);
+
+        mutex_unlock(&writeback_mutex);
+
+        if (!path || strcmp(path, rec->path))
+        {
+            /* Closing makes sure everything before this is on the disk */
+            if (fd >= 0)
+                close(fd);
+
+            path = rec->path;
+            fd = open_record_file(rec);
+        }
+
+        if (fd < 0 || write(fd, rec->path + strlen(rec->path) + 1,
+                            rec->datalen) != rec->datalen)
+        {
+            logf("writeback: %s failed", rec->path);
+        }
+
+        pos += rec->size;
+        mutex_lock(&writeback_mutex);
+    }
+
+    writeback_used = 0;
+    writeback_committing = false;
+
+    mutex_unlock(&writeback_mutex);
+}
+
+static void writeback_idle_callback(void *data)
+{
+    (void)data;
+    writeback_commit();
+}
+
+bool writeback_append(const char *path, const void *data, size_t size,
+                      const char *header)
+{
+    size_t pathlen = strlen(path) + 1;
+    size_t recsize = ALIGN_UP(sizeof(struct writeback_record) + pathlen + size,
+                              sizeof(long));
+
+    if (recsize > WRITEBACK_BUFFER_SIZE)
+        return false;
+
+    if (!writeback_handle)
+    {
+        mutex_init(&writeback_mutex);
+        writeback_handle = core_alloc_ex("writeback", WRITEBACK_BUFFER_SIZE,
+                                         &ops);
+        if (writeback_handle <= 0)
+        {
+            writeback_handle = 0;
+            return false;
+        }
+    }
+
+    mutex_lock(&writeback_mutex);
+
+    while (writeback_used + recsize > WRITEBACK_BUFFER_SIZE)
+    {
+        /* Full, this has to go to the disk now whether it spins or not */
+        mutex_unlock(&writeback_mutex);
+
+        if (writeback_committing)
+            sleep(1);
+        else
+            writeback_commit();
+
+        mutex_lock(&writeback_mutex);
+    }
+
+    struct writeback_record *rec =
+        (void *)((char *)core_get_data(writeback_handle) + writeback_used);
+
+    rec->size = recsize;
+    rec->datalen = size;
+    rec->header = header;
+    memcpy(rec->path, path, pathlen);
+    memcpy(rec->path + pathlen, data, size);
+    writeback_used += recsize;
+
+    mutex_unlock(&writeback_mutex);
+
+    logf("writeback: %lu bytes for %s", (unsigned long)size, path);
+    register_storage_idle_func(writeback_idle_callback);
+    return true;
+}
@@ -0,0 +1,44 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2012 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+#ifndef _WRITEBACK_H_
+#define _WRITEBACK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Small appends to log style files are collected in RAM and only written
+ * out the next time the disk spins up anyway, when the journal fills up, or
+ * when the storage idle callbacks are forced on USB connect and shutdown.
+ *
+ * Records are written in the order they were added, and each file is closed
+ * before the next one is opened, so after a crash every file holds what was
+ * added to it up to some point, and nothing added later made it to the disk
+ * before something added earlier. */
+
+/* Queue size bytes of data to be appended to path. If the file doesn't
+ * exist when the record is written, it is created and header (which may be
+ * NULL and must remain valid) is written first.
+ * Returns false if the record could never fit in the journal */
+bool writeback_append(const char *path, const void *data, size_t size,
+                      const char *header);
+
+#endif /* _WRITEBACK_H_ */
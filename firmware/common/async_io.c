@@ -0,0 +1,268 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2012 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+#include "config.h"
+#include <stdbool.h>
+#include "system.h"
+#include "thread.h"
+#include "kernel.h"
+#include "usb.h"
+#include "file.h"
+#include "storage.h"
+#include "async_io.h"
+
+/* Define LOGF_ENABLE to enable logf output in this file */
+/*#define LOGF_ENABLE*/
+#include "logf.h"
+
+#define ASYNC_IO_SUBMIT     1
+
+static struct event_queue async_io_queue SHAREDBSS_ATTR;
+static struct mutex async_io_mutex SHAREDBSS_ATTR;
+static long async_io_stack[DEFAULT_STACK_SIZE/sizeof(long)];
+static const char async_io_thread_name[] = "async io";
+static unsigned int async_io_thread_id;
+
+/* requests waiting for the worker, oldest first */
+static struct async_io_request *async_io_head;
+static struct async_io_request *async_io_tail;
+
+static struct async_io_request *async_io_dequeue(void)
+{
+    mutex_lock(&async_io_mutex);
+
+    struct async_io_request *req = async_io_head;
+    if (req)
+    {
+        async_io_head = req->next;
+        if (!async_io_head)
+            async_io_tail = NULL;
+        req->state = ASYNC_IO_BUSY;
+    }
+
+    mutex_unlock(&async_io_mutex);
+    return req;
+}
+
+static void async_io_run(struct async_io_request *req)
+{
+#ifdef HAVE_PRIORITY_SCHEDULING
+    /* do the read as urgently as the thread that wants it would have */
+    thread_set_priority(async_io_thread_id, req->priority);
+#endif
+#ifdef HAVE_IO_PRIORITY
+    thread_set_io_priority(async_io_thread_id, req->io_priority);
+#endif
+
+#if (CONFIG_PLATFORM & PLATFORM_NATIVE)
+    if (req->sectors)
+    {
+        int rc = storage_read_sectors(IF_MD2(req->fd,) req->start,
+                                      req->count, req->buf);
+        req->result = rc < 0 ? rc : req->count;
+    }
+    else
+#endif
+    {
+        req->result = read(req->fd, req->buf, req->count);
+    }
+
+    logf("async io %p: %ld", req, req->result);
+
+    if (req->callback)
+        req->callback(req);
+
+    req->state = ASYNC_IO_DONE;
+    semaphore_release(&req->done);
+}
+
+static void async_io_run_all(void)
+{
+    struct async_io_request *req;
+
+    while ((req = async_io_dequeue()))
+        async_io_run(req);
+
+#ifdef HAVE_PRIORITY_SCHEDULING
+    thread_set_priority(async_io_thread_id, PRIORITY_SYSTEM);
+#endif
+}
+
+static void NORETURN_ATTR async_io_thread(void)
+{
+    struct queue_event ev;
+
+    while (1)
+    {
+        queue_wait(&async_io_queue, &ev);
+
+        switch (ev.id)
+        {
+            case ASYNC_IO_SUBMIT:
+                async_io_run_all();
+                break;
+
+#if (CONFIG_PLATFORM & PLATFORM_NATIVE)
+            case SYS_USB_CONNECTED:
+                /* the threads waiting for their reads may not be able to
+                   acknowledge until they are done */
+                async_io_run_all();
+                usb_acknowledge(SYS_USB_CONNECTED_ACK);
+                usb_wait_for_disconnect(&async_io_queue);
+                break;
+#endif
+        }
+    }
+}
+
+static int async_io_submit(struct async_io_request *req)
+{
+    bool wake;
+
+#ifdef HAVE_PRIORITY_SCHEDULING
+    req->priority = thread_get_priority(thread_self());
+#endif
+#ifdef HAVE_IO_PRIORITY
+    req->io_priority = thread_get_io_priority(thread_self());
+#endif
+    semaphore_init(&req->done, 1, 0);
+    req->next = NULL;
+
+    mutex_lock(&async_io_mutex);
+
+    req->state = ASYNC_IO_QUEUED;
+
+    /* the worker empties the queue every time it wakes up, so it only needs
+       waking when something is added to an empty one */
+    wake = !async_io_head;
+    if (wake)
+        async_io_head = req;
+    else
+        async_io_tail->next = req;
+    async_io_tail = req;
+
+    mutex_unlock(&async_io_mutex);
+
+    if (wake)
+        queue_post(&async_io_queue, ASYNC_IO_SUBMIT, 0);
+
+    return 0;
+}
+
+int read_async(struct async_io_request *req, int fd, void *buf,
+               size_t count, async_io_callback callback, void *data)
+{
+    req->callback = callback;
+    req->data = data;
+    req->sectors = false;
+    req->fd = fd;
+    req->buf = buf;
+    req->count = count;
+
+    if (fd < 0 || !async_io_thread_id)
+    {
+        req->result = -1;
+        req->state = ASYNC_IO_DONE;
+        return -1;
+    }
+
+    return async_io_submit(req);
+}
+
+#if (CONFIG_PLATFORM & PLATFORM_NATIVE)
+int storage_read_sectors_async(struct async_io_request *req,
+                               IF_MD2(int drive,) unsigned long start,
+                               int count, void *buf,
+                               async_io_callback callback, void *data)
+{
+    req->callback = callback;
+    req->data = data;
+    req->sectors = true;
+#ifdef HAVE_MULTIDRIVE
+    req->fd = drive;
+#else
+    req->fd = 0;
+#endif
+    req->start = start;
+    req->buf = buf;
+    req->count = count;
+
+    if (!async_io_thread_id)
+    {
+        req->result = -1;
+        req->state = ASYNC_IO_DONE;
+        return -1;
+    }
+
+    return async_io_submit(req);
+}
+#endif /* PLATFORM_NATIVE */
+
+bool async_io_cancel(struct async_io_request *req)
+{
+    bool cancelled = false;
+
+    mutex_lock(&async_io_mutex);
+
+    if (req->state == ASYNC_IO_QUEUED)
+    {
+        struct async_io_request *prev = NULL, *r;
+
+        for (r = async_io_head; r != req; prev = r, r = r->next);
+
+        if (prev)
+            prev->next = req->next;
+        else
+            async_io_head = req->next;
+
+        if (async_io_tail == req)
+            async_io_tail = prev;
+
+        req->state = ASYNC_IO_CANCELLED;
+        cancelled = true;
+    }
+
+    mutex_unlock(&async_io_mutex);
+    return cancelled;
+}
+
+bool async_io_wait(struct async_io_request *req, int timeout)
+{
+    switch (req->state)
+    {
+        case ASYNC_IO_QUEUED:
+        case ASYNC_IO_BUSY:
+            return semaphore_wait(&req->done, timeout) == OBJ_WAIT_SUCCEEDED;
+        default:
+            return true;
+    }
+}
+
+void async_io_init(void)
+{
+    mutex_init(&async_io_mutex);
+    queue_init(&async_io_queue, true);
+    async_io_thread_id = create_thread(async_io_thread, async_io_stack,
+                                       sizeof(async_io_stack), 0,
+                                       async_io_thread_name
+                                       IF_PRIO(, PRIORITY_SYSTEM)
+                                       IF_COP(, CPU));
+}
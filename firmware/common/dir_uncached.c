@@ -131,6 +131,8 @@ DIR_UNCACHED* opendir_uncached(const char* name)
                     pdir->busy = false;
                     return NULL;
                 }
+                fat_set_contiguous(&pdir->fatdir.file, entry.attr,
+                                   entry.filesize);
 #ifdef HAVE_MULTIVOLUME
                 pdir->volumecounter = -1; /* n.a. to subdirs */
 #endif
@@ -125,6 +125,10 @@ static unsigned long entry_count = 0;
 static unsigned long reserve_used = 0;
 static unsigned int  cache_build_ticks = 0;
 static unsigned long appflags = 0;
+/* bumped whenever names are added, removed or renamed (or the cache is
+ * (re)built) and whenever a file time changes, respectively */
+static unsigned long name_stamp = 0;
+static unsigned long time_stamp = 0;
 
 static struct event_queue dircache_queue SHAREDBSS_ATTR;
 static long dircache_stack[(DEFAULT_STACK_SIZE + 0x400)/sizeof(long)];
@@ -307,6 +311,11 @@ static int sab_process_dir(unsigned long startcluster, struct dircache_entry *ce
         logf("fat_opendir failed: %d", rc);
         return rc;
     }
+    /* an exFAT directory may have no FAT chain, its entry in the parent
+       tells */
+    if(ce->up)
+        fat_set_contiguous(&sab.dir->file, ce->up->info.attribute,
+                           ce->up->info.size);
     
     /* first pass : read dir */
     struct dircache_entry *first_ce = ce;
@@ -689,6 +698,7 @@ int dircache_load(void)
     reserve_used = 0;
     logf("Done, %ld KiB used", dircache_size / 1024);
     dircache_initialized = true;
+    name_stamp++;
     memset(fd_bindings, 0, sizeof(fd_bindings));
     dont_move = false;
 
@@ -721,6 +731,11 @@ int dircache_save(void)
     maindata.entry_count = entry_count;
     maindata.appflags = appflags;
 
+    /* the size is known up front, have it written in one piece */
+    file_preallocate(fd, sizeof(struct dircache_maindata)
+                         + entry_count*sizeof(struct dircache_entry)
+                         + (d_names_end - d_names_start));
+
     /* Save the info structure */
     bytes_written = write(fd, &maindata, sizeof(struct dircache_maindata));
     if (bytes_written != sizeof(struct dircache_maindata))
@@ -806,6 +821,7 @@ static int dircache_do_rebuild(void)
     
     dircache_initialized = true;
     dircache_initializing = false;
+    name_stamp++;
     cache_build_ticks = current_tick - start_tick;
     
     /* Initialized fd bindings. */
@@ -1066,6 +1082,18 @@ int dircache_get_reserve_used(void)
     return dircache_is_enabled() ? reserve_used : 0;
 }
 
+/**
+ * Returns a stamp that changes whenever an entry is added, removed or
+ * renamed, or the cache is rebuilt (entry ids change then).  With
+ * include_times, it also changes when a file's modification time does.
+ * Users can compare stamps to tell whether data they derived from the
+ * cache is still current.
+ */
+unsigned long dircache_get_modification_stamp(bool include_times)
+{
+    return include_times ? name_stamp + time_stamp : name_stamp;
+}
+
 /**
  * Returns the time in kernel ticks that took to build the cache.
  */
@@ -1186,6 +1214,64 @@ struct dirinfo* _dircache_get_entry_dirinfo(int id)
     return &get_entry(id)->info;
 }
 
+/**
+ * Skips unused entries and the "." and ".." links of a directory listing.
+ */
+static int first_used_entry_id(const struct dircache_entry *ce)
+{
+    while (ce != NULL && (ce->d_name == NULL || ce->d_name == dot
+                          || ce->d_name == dotdot))
+        ce = ce->next;
+
+    return ce ? ce - dircache_root : -1;
+}
+
+/**
+ * Returns the first entry of the directory listing of the entry id, or of
+ * the root directory if id is -1. Returns -1 if the directory is empty.
+ */
+int dircache_get_first_entry_id(int id)
+{
+    if (!dircache_initialized)
+        return -1;
+
+    return first_used_entry_id(id < 0 ? dircache_root : get_entry(id)->down);
+}
+
+/**
+ * Returns the entry following id in its directory, or -1 at the end.
+ */
+int dircache_get_next_entry_id(int id)
+{
+    if (!dircache_initialized || id < 0)
+        return -1;
+
+    return first_used_entry_id(get_entry(id)->next);
+}
+
+/**
+ * Returns the directory containing the entry id, -1 for the root.
+ */
+int dircache_get_parent_id(int id)
+{
+    const struct dircache_entry *up;
+
+    if (!dircache_initialized || id < 0)
+        return -1;
+
+    up = get_entry(id)->up;
+    return up ? up - dircache_root : -1;
+}
+
+/**
+ * Returns the name of the entry id. The pointer is only valid until the
+ * cache moves, i.e. until the next yield.
+ */
+const char* dircache_get_entry_name(int id)
+{
+    return get_entry(id)->d_name;
+}
+
 /*
  * build a path from an entry upto the root using recursion
  *
@@ -1297,6 +1383,7 @@ static struct dircache_entry* dircache_new_entry(const char *path, int attribute
 
     strcpy(entry->d_name, new);
     dircache_size += size;
+    name_stamp++;
 
     if (attribute & ATTR_DIRECTORY)
     {
@@ -1378,6 +1465,7 @@ void dircache_update_filetime(int fd)
     fd_bindings[fd]->info.wrttime = (((now->tm_hour)&0x1f)<<11)  |
                                     (((now->tm_min)&0x3f)<<5)    |
                                     (((now->tm_sec/2)&0x1f));
+    time_stamp++;
 #endif
 }
 
@@ -1409,6 +1497,7 @@ void dircache_rmdir(const char *path)
 
     entry->down = NULL;
     entry->d_name = NULL;
+    name_stamp++;
 }
 
 /* Remove a file from cache */
@@ -1431,6 +1520,7 @@ void dircache_remove(const char *name)
     }
     
     entry->d_name = NULL;
+    name_stamp++;
 }
 
 void dircache_rename(const char *oldpath, const char *newpath)
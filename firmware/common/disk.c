@@ -129,6 +129,7 @@ int disk_mount_all(void)
 #endif
 
     fat_init(); /* reset all mounted partitions */
+    file_cache_init();
     for (i=0; i<NUM_VOLUMES; i++)
         vol_drive[i] = -1; /* mark all as unassigned */
 
@@ -28,6 +28,7 @@
 #include "dircache.h"
 #include "filefuncs.h"
 #include "system.h"
+#include "kernel.h"
 
 /*
   These functions provide a roughly POSIX-compatible file IO API.
@@ -36,25 +37,322 @@
   cache for each open file. This way we can provide byte access without
   having to re-read the sector each time. 
   The penalty is the RAM used for the cache and slightly more complex code.
+
+  Below the per-file sector cache sits a small cache of multi-sector blocks
+  shared by all open files. Filling the sector cache reads a whole block
+  ahead when the file is being read sequentially, so parsers doing many
+  small reads don't hit the storage for every sector. Sectors that fill up
+  while writing sequentially are collected in a block as well and written
+  together.
 */
 
+/* Both can be overridden in config-[target].h */
+#ifndef FILE_CACHE_BLOCKS
+#if defined(BOOTLOADER) || (MEMORYSIZE <= 2)
+#define FILE_CACHE_BLOCKS 2
+#else
+#define FILE_CACHE_BLOCKS 4
+#endif
+#endif
+
+#ifndef FILE_CACHE_SECTORS
+#if defined(BOOTLOADER) || (MEMORYSIZE <= 2)
+#define FILE_CACHE_SECTORS 2
+#else
+#define FILE_CACHE_SECTORS 8
+#endif
+#endif
+
+struct file_cache_block {
+    unsigned char data[FILE_CACHE_SECTORS * SECTOR_SIZE] CACHEALIGN_ATTR;
+    long firstcluster; /* file the clean data belongs to, 0 if none */
+#ifdef HAVE_MULTIVOLUME
+    int volume;
+#endif
+    long sector;       /* file sector held in data[0] */
+    int count;         /* number of valid sectors */
+    struct filedesc* owner; /* file whose unwritten sectors these are */
+    unsigned int age;  /* last use, for replacement */
+    bool busy;         /* being read or written without holding the mutex */
+} CACHEALIGN_ATTR;
+
 struct filedesc {
     unsigned char cache[SECTOR_SIZE] CACHEALIGN_ATTR;
     int cacheoffset; /* invariant: 0 <= cacheoffset <= SECTOR_SIZE */
     long fileoffset;
     long size;
     int attr;
+    unsigned long mtime; /* write date and time of the entry when opened */
     struct fat_file fatfile;
+    struct fat_extent_cache extents;
+    struct file_cache_block* pending; /* written sectors not yet on disk */
+    long seqsector; /* sector a sequential read would continue at */
     bool busy;
     bool write;
     bool dirty;
     bool trunc;
+    bool prealloc; /* clusters reserved beyond the end, free them on close */
 } CACHEALIGN_ATTR;
 
 static struct filedesc openfiles[MAX_OPEN_FILES] CACHEALIGN_ATTR;
 
+static struct file_cache_block file_cache[FILE_CACHE_BLOCKS] CACHEALIGN_ATTR;
+static struct file_cache_stats file_cache_stats;
+static struct mutex file_cache_mutex;
+static unsigned int file_cache_age;
+
 static int flush_cache(int fd);
 
+static bool cache_block_of(const struct file_cache_block* block,
+                           const struct filedesc* file)
+{
+    return block->firstcluster == file->fatfile.firstcluster
+#ifdef HAVE_MULTIVOLUME
+        && block->volume == file->fatfile.volume
+#endif
+        && !block->owner;
+}
+
+/* Drop the clean blocks of a file whose data was changed on disk */
+static void cache_invalidate(const struct filedesc* file)
+{
+    int i;
+
+    if (!file->fatfile.firstcluster)
+        return;
+
+    mutex_lock(&file_cache_mutex);
+    for (i = 0; i < FILE_CACHE_BLOCKS; i++)
+        if (cache_block_of(&file_cache[i], file))
+            file_cache[i].firstcluster = 0;
+    mutex_unlock(&file_cache_mutex);
+}
+
+/* Find a block to reuse. Blocks holding unwritten sectors of other files
+   are never taken, their owner may be busy using its fat position. */
+static struct file_cache_block* cache_get_block(void)
+{
+    struct file_cache_block* victim = NULL;
+    int i;
+
+    for (i = 0; i < FILE_CACHE_BLOCKS; i++) {
+        struct file_cache_block* block = &file_cache[i];
+        if (block->owner || block->busy)
+            continue;
+        if (!block->firstcluster)
+            return block;
+        if (!victim || (int)(block->age - victim->age) < 0)
+            victim = block;
+    }
+
+    return victim;
+}
+
+/* Write the sectors collected in the pending block. This leaves the fat
+   position right after them, where it would have been had they been
+   written one by one. */
+static int flush_pending(int fd)
+{
+    struct filedesc* file = &openfiles[fd];
+    struct file_cache_block* block = file->pending;
+    int rc;
+
+    if (!block)
+        return 0;
+
+    /* keep the block from being reused if the volume gets unmounted while
+       it is written */
+    mutex_lock(&file_cache_mutex);
+    block->busy = true;
+    mutex_unlock(&file_cache_mutex);
+
+    rc = fat_seek(&(file->fatfile), block->sector);
+    if (rc >= 0)
+        rc = fat_readwrite(&(file->fatfile), block->count, block->data, true);
+
+    mutex_lock(&file_cache_mutex);
+
+    if (rc >= 0)
+        file_cache_stats.writes++;
+
+    /* the data is gone either way, like a failing flush_cache() */
+    block->busy = false;
+    block->owner = NULL;
+    block->firstcluster = 0;
+    file->pending = NULL;
+
+    mutex_unlock(&file_cache_mutex);
+
+    cache_invalidate(file);
+
+    if (rc < 0) {
+        if (file->fatfile.eof)
+            errno = ENOSPC;
+        return rc * 10 - 1;
+    }
+
+    return 0;
+}
+
+/* Called instead of flush_cache() when the sector cache was filled up by a
+   write, to add it to the file's pending block */
+static int cache_append(int fd)
+{
+    struct filedesc* file = &openfiles[fd];
+    struct file_cache_block* block = file->pending;
+    long sector = file->fileoffset / SECTOR_SIZE;
+    int rc;
+
+    if (block && block->sector + block->count != sector) {
+        rc = flush_pending(fd);
+        if (rc < 0)
+            return rc * 10 - 1;
+        block = NULL;
+    }
+
+    mutex_lock(&file_cache_mutex);
+
+    if (!block) {
+        block = cache_get_block();
+        if (!block) {
+            /* all taken, write through */
+            mutex_unlock(&file_cache_mutex);
+            return flush_cache(fd);
+        }
+        block->firstcluster = 0;
+        block->owner = file;
+        block->sector = sector;
+        block->count = 0;
+        file->pending = block;
+    }
+
+    memcpy(block->data + block->count * SECTOR_SIZE, file->cache,
+           SECTOR_SIZE);
+    block->count++;
+    block->age = ++file_cache_age;
+    file_cache_stats.coalesced++;
+    file->dirty = false;
+
+    mutex_unlock(&file_cache_mutex);
+
+    if (block->count == FILE_CACHE_SECTORS) {
+        rc = flush_pending(fd);
+        if (rc < 0)
+            return rc * 10 - 2;
+    }
+
+    return 0;
+}
+
+/* Fill the sector cache with the given sector, the fat position must be
+   there already. Leaves the fat position after it, just like reading the
+   one sector would. Returns what fat_readwrite() would have. */
+static long cache_fill(int fd, long sector)
+{
+    struct filedesc* file = &openfiles[fd];
+    struct file_cache_block* block;
+    long count, rc;
+    int i;
+
+    if (!file->fatfile.firstcluster)
+        return fat_readwrite(&(file->fatfile), 1, file->cache, false);
+
+    mutex_lock(&file_cache_mutex);
+
+    for (i = 0; i < FILE_CACHE_BLOCKS; i++) {
+        block = &file_cache[i];
+        if (!block->busy && cache_block_of(block, file) &&
+            sector >= block->sector &&
+            sector < block->sector + block->count) {
+            memcpy(file->cache,
+                   block->data + (sector - block->sector) * SECTOR_SIZE,
+                   SECTOR_SIZE);
+            block->age = ++file_cache_age;
+            file_cache_stats.hits++;
+            mutex_unlock(&file_cache_mutex);
+            file->seqsector = sector + 1;
+            rc = fat_seek(&(file->fatfile), sector + 1);
+            return rc < 0 ? rc : 1;
+        }
+    }
+
+    file_cache_stats.misses++;
+
+    block = cache_get_block();
+    if (!block) {
+        mutex_unlock(&file_cache_mutex);
+        return fat_readwrite(&(file->fatfile), 1, file->cache, false);
+    }
+
+    /* read ahead only when the file is being read sequentially, random
+       accesses get just the sector they asked for */
+    count = 1;
+    if (sector == file->seqsector) {
+        count = (file->size + SECTOR_SIZE - 1) / SECTOR_SIZE - sector;
+        count = MAX(1, MIN(count, FILE_CACHE_SECTORS));
+    }
+
+    /* read without holding the mutex. The block already belongs to the
+       file, so that cache_invalidate() and release_files() can take it
+       away meanwhile, but holds nothing until the read is done. */
+    block->busy = true;
+    block->firstcluster = file->fatfile.firstcluster;
+#ifdef HAVE_MULTIVOLUME
+    block->volume = file->fatfile.volume;
+#endif
+    block->count = 0;
+    mutex_unlock(&file_cache_mutex);
+
+    rc = fat_readwrite(&(file->fatfile), count, block->data, false);
+
+    mutex_lock(&file_cache_mutex);
+    block->busy = false;
+    file_cache_stats.reads++;
+    if (rc > 0) {
+        memcpy(file->cache, block->data, SECTOR_SIZE);
+        if (block->firstcluster) {
+            block->sector = sector;
+            block->count = rc;
+            block->age = ++file_cache_age;
+        }
+    }
+    else
+        block->firstcluster = 0;
+    mutex_unlock(&file_cache_mutex);
+
+    if (rc > 0) {
+        file->seqsector = sector + 1;
+        if (rc > 1)
+            rc = fat_seek(&(file->fatfile), sector + 1);
+        if (rc >= 0)
+            rc = 1;
+    }
+
+    return rc;
+}
+
+void file_cache_init(void)
+{
+    static bool initialized = false;
+    int i;
+
+    if (!initialized) {
+        initialized = true;
+        mutex_init(&file_cache_mutex);
+    }
+
+    for (i = 0; i < FILE_CACHE_BLOCKS; i++) {
+        file_cache[i].firstcluster = 0;
+        file_cache[i].owner = NULL;
+        file_cache[i].busy = false;
+    }
+}
+
+void file_cache_get_stats(struct file_cache_stats* stats)
+{
+    *stats = file_cache_stats;
+}
+
 int file_creat(const char *pathname)
 {
     return open(pathname, O_WRONLY|O_CREAT|O_TRUNC, 0666);
@@ -125,9 +423,12 @@ static int open_internal(const char* pathname, int flags, bool use_cache)
                  startcluster,
                  &(file->fatfile),
                  NULL);
+        fat_set_extent_cache(&(file->fatfile), &(file->extents));
         struct dirinfo *info = _dircache_get_entry_dirinfo(ce);
+        fat_set_contiguous(&(file->fatfile), info->attribute, info->size);
         file->size = info->size;
         file->attr = info->attribute;
+        file->mtime = ((unsigned long)info->wrtdate << 16) | info->wrttime;
         file->cacheoffset = -1;
         file->fileoffset = 0;
 
@@ -171,8 +472,13 @@ static int open_internal(const char* pathname, int flags, bool use_cache)
                      entry->startcluster,
                      &(file->fatfile),
                      &(dir->fatdir));
+            fat_set_extent_cache(&(file->fatfile), &(file->extents));
+            fat_set_contiguous(&(file->fatfile), entry->info.attribute,
+                               entry->info.size);
             file->size = file->trunc ? 0 : entry->info.size;
             file->attr = entry->info.attribute;
+            file->mtime = ((unsigned long)entry->info.wrtdate << 16) |
+                          entry->info.wrttime;
             break;
         }
     }
@@ -190,6 +496,7 @@ static int open_internal(const char* pathname, int flags, bool use_cache)
                 closedir_uncached(dir);
                 return rc * 10 - 6;
             }
+            fat_set_extent_cache(&(file->fatfile), &(file->extents));
 #ifdef HAVE_DIRCACHE
             dircache_add_file(pathname, file->fatfile.firstcluster);
 #endif
@@ -252,6 +559,11 @@ int close(int fd)
         return -2;
     }
     if (file->write) {
+        /* give back what was reserved but not written */
+        if (file->prealloc) {
+            file->prealloc = false;
+            file->trunc = true;
+        }
         rc = fsync(fd);
         if (rc < 0)
             return rc * 10 - 3;
@@ -281,6 +593,14 @@ int fsync(int fd)
         return -2;
     }
     if (file->write) {
+        rc = flush_pending(fd);
+        if (rc < 0)
+        {
+            /* when failing, try to close the file anyway */
+            fat_closewrite(&(file->fatfile), file->size, file->attr);
+            return rc * 10 - 6;
+        }
+
         /* flush sector cache */
         if ( file->dirty ) {
             rc = flush_cache(fd);
@@ -292,8 +612,8 @@ int fsync(int fd)
             }
         }
 
-        /* truncate? */
-        if (file->trunc) {
+        /* truncate? Not while clusters are reserved, close() does it */
+        if (file->trunc && !file->prealloc) {
             rc = ftruncate(fd, file->size);
             if (rc < 0)
             {
@@ -307,6 +627,10 @@ int fsync(int fd)
         rc = fat_closewrite(&(file->fatfile), file->size, file->attr);
         if (rc < 0)
             return rc * 10 - 5;
+
+        /* an empty file gives up its clusters, reserved or not */
+        if (!file->size)
+            file->prealloc = false;
     }
     return 0;
 }
@@ -324,6 +648,7 @@ int remove(const char* name)
 #ifdef HAVE_DIRCACHE
     dircache_remove(name);
 #endif
+    cache_invalidate(file);
     rc = fat_remove(&(file->fatfile));
     if ( rc < 0 ) {
         DEBUGF("Failed removing file: %d\n", rc);
@@ -440,13 +765,17 @@ int rename(const char* path, const char* newpath)
 
 int ftruncate(int fd, off_t size)
 {
-    int rc, sector;
+    int rc, sector, i;
     struct filedesc* file = &openfiles[fd];
 
     sector = size / SECTOR_SIZE;
     if (size % SECTOR_SIZE)
         sector++;
 
+    rc = flush_pending(fd);
+    if (rc < 0)
+        return rc * 10 - 3;
+
     rc = fat_seek(&(file->fatfile), sector);
     if (rc < 0) {
         errno = EIO;
@@ -458,6 +787,20 @@ int ftruncate(int fd, off_t size)
         errno = EIO;
         return rc * 10 - 2;
     }
+    cache_invalidate(file);
+    file->prealloc = false;
+
+    /* other handles on the same file may have mapped the clusters that
+       were just freed */
+    for (i = 0; i < MAX_OPEN_FILES; i++) {
+        struct filedesc* other = &openfiles[i];
+        if (other != file && other->busy &&
+#ifdef HAVE_MULTIVOLUME
+            other->fatfile.volume == file->fatfile.volume &&
+#endif
+            other->fatfile.firstcluster == file->fatfile.firstcluster)
+            fat_set_extent_cache(&(other->fatfile), &(other->extents));
+    }
 
     file->size = size;
 #ifdef HAVE_DIRCACHE
@@ -467,6 +810,37 @@ int ftruncate(int fd, off_t size)
     return 0;
 }
 
+int file_preallocate(int fd, off_t size)
+{
+    struct filedesc* file = &openfiles[fd];
+    long clustersize, clusters;
+    int rc;
+
+    if (fd < 0 || fd > MAX_OPEN_FILES-1) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!file->busy || !file->write) {
+        errno = EBADF;
+        return -2;
+    }
+    if (size <= file->size)
+        return 0;
+
+    clustersize = fat_get_cluster_size(IF_MV(file->fatfile.volume));
+    clusters = (size + clustersize - 1) / clustersize;
+
+    /* even a partial reservation has to be trimmed on close */
+    file->prealloc = true;
+    rc = fat_preallocate(&(file->fatfile), clusters);
+    if (rc < 0) {
+        errno = ENOSPC;
+        return rc * 10 - 3;
+    }
+
+    return 0;
+}
+
 static int flush_cache(int fd)
 {
     int rc;
@@ -475,6 +849,11 @@ static int flush_cache(int fd)
 
     DEBUGF("Flushing dirty sector cache\n");
 
+    /* the collected sectors come first */
+    rc = flush_pending(fd);
+    if ( rc < 0 )
+        return rc * 10 - 4;
+
     /* make sure we are on correct sector */
     rc = fat_seek(&(file->fatfile), sector);
     if ( rc < 0 )
@@ -490,6 +869,7 @@ static int flush_cache(int fd)
     }
 
     file->dirty = false;
+    cache_invalidate(file);
 
     return 0;
 }
@@ -544,7 +924,7 @@ static int readwrite(int fd, void* buf, long count, bool write)
 
         if (offs + headbytes == SECTOR_SIZE) {
             if (file->dirty) {
-                rc = flush_cache(fd);
+                rc = cache_append(fd);
                 if ( rc < 0 ) {
                     errno = EIO;
                     return rc * 10 - 2;
@@ -567,6 +947,17 @@ static int readwrite(int fd, void* buf, long count, bool write)
     /* read/write whole sectors right into/from the supplied buffer */
     sectors = count / SECTOR_SIZE;
     rc = 0;
+    if ( sectors ) {
+        /* the collected sectors have to go first, the fat position
+           is still before them */
+        rc = flush_pending(fd);
+        if ( rc < 0 ) {
+            errno = EIO;
+            file->fileoffset += nread;
+            file->cacheoffset = -1;
+            return nread ? nread : rc * 10 - 9;
+        }
+    }
     if ( sectors ) {
 #ifdef STORAGE_NEEDS_ALIGN
         if (((uint32_t)buf + nread) & (CACHEALIGN_SIZE - 1))
@@ -606,6 +997,12 @@ static int readwrite(int fd, void* buf, long count, bool write)
             return nread ? nread : rc * 10 - 4;
         }
         else {
+            if ( write )
+                cache_invalidate(file);
+            else
+                file->seqsector = (file->fileoffset + nread) / SECTOR_SIZE
+                                  + rc;
+
             if ( rc > 0 ) {
                 nread += rc * SECTOR_SIZE;
                 count -= sectors * SECTOR_SIZE;
@@ -629,7 +1026,10 @@ static int readwrite(int fd, void* buf, long count, bool write)
             if ( file->fileoffset + nread < file->size ) {
                 /* sector is only partially filled. copy-back from disk */
                 LDEBUGF("Copy-back tail cache\n");
-                rc = fat_readwrite(&(file->fatfile), 1, file->cache, false );
+                rc = flush_pending(fd);
+                if ( rc >= 0 )
+                    rc = fat_readwrite(&(file->fatfile), 1, file->cache,
+                                       false );
                 if ( rc < 0 ) {
                     DEBUGF("Failed writing\n");
                     errno = EIO;
@@ -669,7 +1069,9 @@ static int readwrite(int fd, void* buf, long count, bool write)
             file->dirty = true;
         }
         else {
-            rc = fat_readwrite(&(file->fatfile), 1, file->cache,false);
+            rc = flush_pending(fd);
+            if (rc >= 0)
+                rc = cache_fill(fd, (file->fileoffset + nread) / SECTOR_SIZE);
             if (rc < 1 ) {
                 DEBUGF("Failed caching sector\n");
                 errno = EIO;
@@ -764,6 +1166,10 @@ off_t lseek(int fd, off_t offset, int whence)
     if ( (newsector != oldsector) ||
          ((file->cacheoffset==-1) && sectoroffset) ) {
 
+        rc = flush_pending(fd);
+        if (rc < 0)
+            return rc * 10 - 7;
+
         if ( newsector != oldsector ) {
             if (file->dirty) {
                 rc = flush_cache(fd);
@@ -778,7 +1184,7 @@ off_t lseek(int fd, off_t offset, int whence)
             }
         }
         if ( sectoroffset ) {
-            rc = fat_readwrite(&(file->fatfile), 1, file->cache ,false);
+            rc = cache_fill(fd, newsector);
             if ( rc < 0 ) {
                 errno = EIO;
                 return rc * 10 - 6;
@@ -813,6 +1219,23 @@ off_t filesize(int fd)
     return file->size;
 }
 
+int file_get_mtime(int fd, unsigned long* mtime)
+{
+    struct filedesc* file = &openfiles[fd];
+
+    if (fd < 0 || fd > MAX_OPEN_FILES-1) {
+        errno = EINVAL;
+        return -1;
+    }
+    if ( !file->busy ) {
+        errno = EBADF;
+        return -1;
+    }
+
+    *mtime = file->mtime;
+    return 0;
+}
+
 
 /* release all file handles on a given volume "by force", to avoid leaks */
 int release_files(int volume)
@@ -829,8 +1252,26 @@ int release_files(int volume)
 #endif
         {
             pfile->busy = false; /* mark as available, no further action */
+            pfile->pending = NULL;
             closed++;
         }
     }
+
+    /* whatever is cached may be gone or different on the next mount */
+    mutex_lock(&file_cache_mutex);
+    for (fd = 0; fd < FILE_CACHE_BLOCKS; fd++)
+    {
+#ifdef HAVE_MULTIVOLUME
+        if (file_cache[fd].volume == volume ||
+            (file_cache[fd].owner &&
+             file_cache[fd].owner->fatfile.volume == volume))
+#endif
+        {
+            file_cache[fd].firstcluster = 0;
+            file_cache[fd].owner = NULL;
+        }
+    }
+    mutex_unlock(&file_cache_mutex);
+
     return closed; /* return how many we did */
 }
@@ -25,6 +25,8 @@
 #include "debug.h"
 #include "file.h"
 #include "filefuncs.h"
+#include "string-extra.h"
+#include <stdio.h>
 
 #ifndef __PCTOOL__
 #ifdef HAVE_MULTIVOLUME
@@ -89,6 +91,345 @@ bool dir_exists(const char *path)
     return true;
 }
 
+/* Appends the pending directories of a breadth-first walk to the queue as
+   a depth byte followed by the payload. */
+static bool queue_push(struct treewalk *walk, int depth,
+                       const void *data, size_t len)
+{
+    if (walk->queue_tail + 1 + len > walk->queue_size)
+    {
+        /* reclaim the records already consumed */
+        memmove(walk->queue, walk->queue + walk->queue_head,
+                walk->queue_tail - walk->queue_head);
+        walk->queue_tail -= walk->queue_head;
+        walk->queue_head = 0;
+
+        if (walk->queue_tail + 1 + len > walk->queue_size)
+        {
+            DEBUGF("treewalk: queue full, skipping a directory\n");
+            walk->incomplete = true;
+            return false;
+        }
+    }
+
+    walk->queue[walk->queue_tail++] = depth;
+    memcpy(walk->queue + walk->queue_tail, data, len);
+    walk->queue_tail += len;
+    return true;
+}
+
+/* Takes the next record from the queue, len is 0 for strings. The payload
+   is valid until the next push. */
+static const char* queue_pop(struct treewalk *walk, int *depth, size_t len)
+{
+    const char *data;
+
+    if (walk->queue_head == walk->queue_tail)
+        return NULL;
+
+    *depth = walk->queue[walk->queue_head++];
+    data = walk->queue + walk->queue_head;
+    walk->queue_head += len ? len : strlen(data) + 1;
+    return data;
+}
+
+static bool is_dot_name(const char *name)
+{
+    return name[0] == '.' &&
+           (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/* Appends the current entry to the directory path, returns the previous
+   length or -1 if it doesn't fit. */
+static int append_current(struct treewalk *walk)
+{
+    size_t len = strlen(walk->path);
+    size_t sep = (len > 1) ? 1 : 0;
+
+    if (len + sep + strlen(walk->name) >= MAX_PATH)
+        return -1;
+
+    if (sep)
+        walk->path[len] = '/';
+    strcpy(walk->path + len + sep, walk->name);
+    return len;
+}
+
+#ifdef HAVE_DIRCACHE
+static bool walk_cached_next(struct treewalk *walk, bool enter)
+{
+    int id = walk->id;
+
+    /* the ids are worthless once the cache was rebuilt */
+    if (!dircache_get_appflag(DIRCACHE_APPFLAG_TREEWALK))
+    {
+        DEBUGF("treewalk: dircache changed, giving up\n");
+        walk->incomplete = true;
+        return false;
+    }
+
+    if (walk->flags & TREEWALK_BREADTH_FIRST)
+    {
+        if (enter)
+            queue_push(walk, walk->depth + 1, &id, sizeof(id));
+
+        if (walk->depth < 0)
+        {
+            walk->depth = 0;
+            id = dircache_get_first_entry_id(walk->root_id);
+        }
+        else
+            id = dircache_get_next_entry_id(id);
+
+        while (id < 0)
+        {
+            const char *data = queue_pop(walk, &walk->depth, sizeof(id));
+            if (!data)
+                return false;
+
+            memcpy(&walk->dir_id, data, sizeof(id));
+            id = dircache_get_first_entry_id(walk->dir_id);
+        }
+    }
+    else
+    {
+        int child = enter ? dircache_get_first_entry_id(id) : -1;
+
+        if (walk->depth < 0)
+        {
+            walk->depth = 0;
+            id = dircache_get_first_entry_id(walk->root_id);
+        }
+        else if (child >= 0)
+        {
+            walk->depth++;
+            id = child;
+        }
+        else
+        {
+            /* next sibling, or the one of the closest parent */
+            int next;
+            while ((next = dircache_get_next_entry_id(id)) < 0
+                   && walk->depth > 0)
+            {
+                id = dircache_get_parent_id(id);
+                walk->depth--;
+            }
+            id = next;
+        }
+
+        if (id < 0)
+            return false;
+    }
+
+    walk->id = id;
+    walk->name = dircache_get_entry_name(id);
+    walk->info = *_dircache_get_entry_dirinfo(id);
+    return true;
+}
+#endif /* HAVE_DIRCACHE */
+
+static bool walk_fs_next(struct treewalk *walk, bool enter)
+{
+    struct dirent *entry;
+
+    if (enter)
+    {
+        int len = append_current(walk);
+
+        if (len < 0)
+        {
+            DEBUGF("treewalk: path too long, skipping a directory\n");
+            walk->incomplete = true;
+        }
+        else if (walk->flags & TREEWALK_BREADTH_FIRST)
+        {
+            queue_push(walk, walk->depth + 1, walk->path,
+                       strlen(walk->path) + 1);
+            walk->path[len] = '\0';
+        }
+        else
+        {
+            DIR *dir = NULL;
+
+            if (walk->open_count < TREEWALK_MAX_DEPTH)
+                dir = opendir(walk->path);
+
+            if (dir)
+            {
+                walk->dir_len[walk->open_count] = strlen(walk->path);
+                walk->dirs[walk->open_count++] = dir;
+            }
+            else
+            {
+                walk->incomplete = true;
+                walk->path[len] = '\0';
+            }
+        }
+    }
+
+    while (true)
+    {
+        if (walk->open_count == 0)
+        {
+            /* next directory of a breadth-first walk */
+            const char *path = queue_pop(walk, &walk->depth, 0);
+            if (!path)
+                return false;
+
+            strlcpy(walk->path, path, MAX_PATH);
+            walk->dir_len[0] = strlen(walk->path);
+            walk->dirs[0] = opendir(walk->path);
+            if (walk->dirs[0])
+                walk->open_count = 1;
+            else
+                walk->incomplete = true;
+            continue;
+        }
+
+        entry = readdir(walk->dirs[walk->open_count-1]);
+        if (!entry)
+        {
+            closedir(walk->dirs[--walk->open_count]);
+            if (walk->open_count > 0)
+                walk->path[walk->dir_len[walk->open_count-1]] = '\0';
+            continue;
+        }
+
+        if (is_dot_name(entry->d_name))
+            continue;
+
+        walk->name = entry->d_name;
+        walk->info = dir_get_info(walk->dirs[walk->open_count-1], entry);
+        if (!(walk->flags & TREEWALK_BREADTH_FIRST))
+            walk->depth = walk->open_count - 1;
+        else if (walk->depth < 0)
+            walk->depth = 0;
+        return true;
+    }
+}
+
+/**
+ * Prepares walking the tree below path. Breadth-first walks keep their
+ * pending directories in buf. Returns 0 on success, a negative value if
+ * the directory can't be opened.
+ */
+int treewalk_open(struct treewalk *walk, const char *path, unsigned flags,
+                  void *buf, size_t bufsize)
+{
+    size_t len;
+
+    memset(walk, 0, sizeof(*walk));
+    walk->max_depth = TREEWALK_MAX_DEPTH;
+    walk->flags = flags;
+    walk->queue = buf;
+    walk->queue_size = buf ? bufsize : 0;
+    walk->depth = -1;
+
+    len = strlcpy(walk->path, path, MAX_PATH);
+    if (len >= MAX_PATH || path[0] != '/')
+        return -1;
+
+    while (len > 1 && walk->path[len-1] == '/')
+        walk->path[--len] = '\0';
+
+#ifdef HAVE_DIRCACHE
+    if (dircache_is_enabled())
+    {
+        bool root = !strcmp(walk->path, "/");
+
+        walk->root_id = root ? -1 : dircache_get_entry_id(walk->path);
+        if (root || walk->root_id >= 0)
+        {
+            if (!root && !(_dircache_get_entry_dirinfo(walk->root_id)->attribute
+                           & ATTR_DIRECTORY))
+                return -2;
+
+            dircache_set_appflag(DIRCACHE_APPFLAG_TREEWALK);
+            walk->cached = true;
+            walk->id = -1;
+            return 0;
+        }
+    }
+#endif
+
+    walk->dirs[0] = opendir(walk->path);
+    if (!walk->dirs[0])
+        return -2;
+
+    walk->dir_len[0] = len;
+    walk->open_count = 1;
+    return 0;
+}
+
+/**
+ * Advances to the next entry of the tree, directories come before their
+ * content. Returns false at the end of the walk, check walk->incomplete
+ * then to know whether everything was seen.
+ */
+bool treewalk_next(struct treewalk *walk)
+{
+    while (true)
+    {
+        bool enter = walk->descend;
+        bool found;
+
+        walk->descend = false;
+        if (enter && walk->depth + 1 >= walk->max_depth)
+        {
+            /* only the hard limit leaves something out, a lower
+               max_depth is what the caller asked for */
+            enter = false;
+            if (walk->max_depth >= TREEWALK_MAX_DEPTH)
+                walk->incomplete = true;
+        }
+#ifdef HAVE_DIRCACHE
+        if (walk->cached)
+            found = walk_cached_next(walk, enter);
+        else
+#endif
+            found = walk_fs_next(walk, enter);
+
+        if (!found)
+            return false;
+
+        if (walk->filter && !walk->filter(walk, walk->filter_data))
+            continue;
+
+        if (walk->info.attribute & ATTR_DIRECTORY)
+        {
+            walk->descend = true;
+            if (!(walk->flags & TREEWALK_SKIP_DIRS))
+                return true;
+        }
+        else if (!(walk->flags & TREEWALK_SKIP_FILES))
+            return true;
+    }
+}
+
+/* Don't walk into the directory just returned by treewalk_next() */
+void treewalk_skip_dir(struct treewalk *walk)
+{
+    walk->descend = false;
+}
+
+/* Copies the full path of the current entry to buf */
+size_t treewalk_get_path(const struct treewalk *walk, char *buf, size_t size)
+{
+#ifdef HAVE_DIRCACHE
+    if (walk->cached)
+        return dircache_copy_path(walk->id, buf, size);
+#endif
+    return snprintf(buf, size, "%s/%s",
+                    strcmp(walk->path, "/") ? walk->path : "", walk->name);
+}
+
+void treewalk_close(struct treewalk *walk)
+{
+    while (walk->open_count > 0)
+        closedir(walk->dirs[--walk->open_count]);
+}
+
 #endif /* __PCTOOL__ */
 
 #if (CONFIG_PLATFORM & (PLATFORM_NATIVE|PLATFORM_SDL|PLATFORM_MAEMO|PLATFORM_PANDORA))
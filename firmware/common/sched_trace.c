@@ -0,0 +1,253 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2012 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+#include "config.h"
+#include <stdbool.h>
+#if (CONFIG_PLATFORM & PLATFORM_HOSTED)
+#include <time.h>
+#endif
+#include "system.h"
+#include "kernel.h"
+#include "thread.h"
+#include "file.h"
+#include "sched_trace.h"
+
+#ifndef SCHED_TRACE_EVENTS
+#if (CONFIG_PLATFORM & PLATFORM_HOSTED)
+#define SCHED_TRACE_EVENTS  32768
+#else
+#define SCHED_TRACE_EVENTS  4096    /* must be a power of 2 */
+#endif
+#endif
+
+struct sched_trace_event
+{
+    unsigned long time;     /* usecs */
+    unsigned char event;    /* enum sched_event */
+    unsigned char slot;     /* thread slot */
+    unsigned short arg;
+    unsigned long data;
+};
+
+static struct sched_trace_event sched_trace_buf[SCHED_TRACE_EVENTS]
+    SHAREDBSS_ATTR;
+static unsigned int sched_trace_pos SHAREDBSS_ATTR; /* next event, wraps */
+static bool sched_trace_full SHAREDBSS_ATTR;        /* pos went round once */
+static bool sched_trace_paused SHAREDBSS_ATTR;      /* dumping */
+#if NUM_CORES > 1
+/* zeroed bss is an initialized corelock, events come in before any init
+   function could be called */
+static struct corelock sched_trace_cl SHAREDBSS_ATTR;
+#endif
+
+static inline unsigned long sched_trace_time(void)
+{
+#if (CONFIG_PLATFORM & PLATFORM_HOSTED)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+#elif defined(USEC_TIMER)
+    return USEC_TIMER;
+#else
+    /* no finer timer known for this target */
+    return current_tick * (1000000 / HZ);
+#endif
+}
+
+/* Called from the scheduler itself, from interrupt handlers and from both
+ * cores, so it must neither block nor be traced */
+void sched_trace(unsigned int event, unsigned int slot, unsigned int arg,
+                 unsigned long data)
+{
+    struct sched_trace_event *ev;
+    unsigned int pos;
+
+    if (sched_trace_paused)
+        return;
+
+#if (CONFIG_PLATFORM & PLATFORM_HOSTED)
+    /* the "interrupt" threads run in parallel with the others */
+    pos = __sync_fetch_and_add(&sched_trace_pos, 1);
+#else
+    int oldlevel = disable_irq_save();
+    corelock_lock(&sched_trace_cl);
+    pos = sched_trace_pos++;
+#endif
+
+    ev = &sched_trace_buf[pos & (SCHED_TRACE_EVENTS - 1)];
+    ev->time = sched_trace_time();
+    ev->event = event;
+    ev->slot = slot;
+    ev->arg = arg > 0xffff ? 0xffff : arg;
+    ev->data = data;
+
+    if (pos == SCHED_TRACE_EVENTS - 1)
+        sched_trace_full = true;
+
+#if !(CONFIG_PLATFORM & PLATFORM_HOSTED)
+    corelock_unlock(&sched_trace_cl);
+    restore_irq(oldlevel);
+#endif
+}
+
+static const char * const sched_block_names[] =
+{
+    [SCHED_BLOCK_SLEEP]      = "sleep",
+    [SCHED_BLOCK_QUEUE]      = "queue wait",
+    [SCHED_BLOCK_QUEUE_SEND] = "queue send",
+    [SCHED_BLOCK_MUTEX]      = "mutex",
+    [SCHED_BLOCK_SEMAPHORE]  = "semaphore",
+    [SCHED_BLOCK_THREAD]     = "thread wait",
+};
+
+/* Written in the trace event format of chrome://tracing. Every thread gets
+ * a track with a slice for each time it ran, blocking calls are instant
+ * events on the track of the thread, transfers are async events so they may
+ * span the slices of the thread doing them. */
+int sched_trace_dump(const char *path)
+{
+    static unsigned long run_start[MAXTHREADS];
+    static bool running[MAXTHREADS];
+    static bool seen[MAXTHREADS];
+    static bool io_write[MAXTHREADS];
+    const char *sep = "";
+    unsigned int pos, end;
+    unsigned long first, ts = 0;
+    int fd, i;
+
+    fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd < 0)
+        return -1;
+
+    /* the file system would put its own events in while this goes on */
+    sched_trace_paused = true;
+
+    end = sched_trace_pos;
+    pos = sched_trace_full ? end - SCHED_TRACE_EVENTS : 0;
+    first = sched_trace_buf[pos & (SCHED_TRACE_EVENTS - 1)].time;
+
+    for (i = 0; i < MAXTHREADS; i++)
+        running[i] = seen[i] = io_write[i] = false;
+
+    fdprintf(fd, "{\"traceEvents\":[\n");
+
+    for (; pos != end; pos++)
+    {
+        const struct sched_trace_event *ev =
+            &sched_trace_buf[pos & (SCHED_TRACE_EVENTS - 1)];
+        unsigned int slot = ev->slot;
+
+        if (slot >= MAXTHREADS)
+            continue;
+
+        ts = ev->time - first;
+        seen[slot] = true;
+
+        switch (ev->event)
+        {
+        case SCHED_EVENT_RUN:
+            running[slot] = true;
+            run_start[slot] = ts;
+            continue;
+
+        case SCHED_EVENT_STOP:
+            /* without a start it ran from before the first event */
+            fdprintf(fd, "%s{\"name\":\"running\",\"ph\":\"X\",\"pid\":1,"
+                     "\"tid\":%u,\"ts\":%lu,\"dur\":%lu}", sep, slot,
+                     running[slot] ? run_start[slot] : 0ul,
+                     ts - (running[slot] ? run_start[slot] : 0ul));
+            running[slot] = false;
+            break;
+
+        case SCHED_EVENT_BLOCK:
+            if (ev->arg >= ARRAYLEN(sched_block_names))
+                continue;
+            fdprintf(fd, "%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+                     "\"pid\":1,\"tid\":%u,\"ts\":%lu}", sep,
+                     sched_block_names[ev->arg], slot, ts);
+            break;
+
+        case SCHED_EVENT_BOOST:
+            fdprintf(fd, "%s{\"name\":\"cpu boost\",\"ph\":\"C\",\"pid\":1,"
+                     "\"ts\":%lu,\"args\":{\"count\":%u}}", sep, ts, ev->arg);
+            break;
+
+        case SCHED_EVENT_IO_READ:
+        case SCHED_EVENT_IO_WRITE:
+            io_write[slot] = ev->event == SCHED_EVENT_IO_WRITE;
+            fdprintf(fd, "%s{\"name\":\"%s\",\"cat\":\"storage\","
+                     "\"ph\":\"b\",\"id\":%u,\"pid\":1,\"tid\":%u,"
+                     "\"ts\":%lu,\"args\":{\"start\":%lu,\"count\":%u}}",
+                     sep, io_write[slot] ? "write" : "read", slot, slot, ts,
+                     ev->data, ev->arg);
+            break;
+
+        case SCHED_EVENT_IO_DONE:
+            fdprintf(fd, "%s{\"name\":\"%s\",\"cat\":\"storage\","
+                     "\"ph\":\"e\",\"id\":%u,\"pid\":1,\"tid\":%u,"
+                     "\"ts\":%lu}", sep, io_write[slot] ? "write" : "read",
+                     slot, slot, ts);
+            break;
+
+        default:
+            continue;
+        }
+
+        sep = ",\n";
+    }
+
+    /* close the slices of the threads still running, and name the tracks
+       after the threads in those slots now */
+    for (i = 0; i < MAXTHREADS; i++)
+    {
+        char name[32], *p;
+
+        if (!seen[i])
+            continue;
+
+        if (running[i])
+        {
+            fdprintf(fd, "%s{\"name\":\"running\",\"ph\":\"X\",\"pid\":1,"
+                     "\"tid\":%d,\"ts\":%lu,\"dur\":%lu}", sep, i,
+                     run_start[i], ts - run_start[i]);
+            sep = ",\n";
+        }
+
+        thread_get_name(name, sizeof(name), thread_id_entry(i));
+        for (p = name; *p; p++)
+        {
+            if (*p == '"' || *p == '\\' || (unsigned char)*p < ' ')
+                *p = '_';
+        }
+
+        fdprintf(fd, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                 "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", sep, i, name);
+        sep = ",\n";
+    }
+
+    fdprintf(fd, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+             "\"args\":{\"name\":\"Rockbox\"}}\n]}\n", sep);
+
+    sched_trace_pos = 0;
+    sched_trace_full = false;
+    sched_trace_paused = false;
+
+    return close(fd);
+}
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <ctype.h>
 #include <stdbool.h>
 #include "fat.h"
@@ -31,6 +32,9 @@
 #include "timefuncs.h"
 #include "kernel.h"
 #include "rbunicode.h"
+#include "core_alloc.h"
+#include "events.h"
+#include "ata_idle_notify.h"
 /*#define LOGF_ENABLE*/
 #include "logf.h"
 
@@ -83,6 +87,19 @@
 
 #define BPB_LAST_WORD       510
 
+/* exfat */
+#define EXFAT_OEMNAME       3
+#define EXFAT_VOLLENGTH     72
+#define EXFAT_FATOFFSET     80
+#define EXFAT_FATLENGTH     84
+#define EXFAT_HEAPOFFSET    88
+#define EXFAT_CLUSTERCOUNT  92
+#define EXFAT_ROOTCLUS      96
+#define EXFAT_BYTSPERSECSHIFT 108
+#define EXFAT_SECPERCLUSSHIFT 109
+#define EXFAT_NUMFATS       110
+#define EXFAT_PERCENTINUSE  112
+
 
 /* attributes */
 #define FAT_ATTR_LONG_NAME   (FAT_ATTR_READ_ONLY | FAT_ATTR_HIDDEN | \
@@ -130,6 +147,34 @@ static unsigned char FATLONG_NAME_SIZE[FATLONG_NAME_CHUNKS] = {10, 12, 4};
 #define FAT_LONGNAME_PAD_BYTE 0xff
 #define FAT_LONGNAME_PAD_UCS 0xffff
 
+/* exFAT directory entry types, bit 7 is clear in unused entries */
+#define EXFAT_ENTRY_EOD      0x00
+#define EXFAT_ENTRY_INUSE    0x80
+#define EXFAT_ENTRY_BITMAP   0x81
+#define EXFAT_ENTRY_FILE     0x85
+#define EXFAT_ENTRY_SECONDARY 0xc0 /* bit 6 set */
+#define EXFAT_ENTRY_STREAM   0xc0
+#define EXFAT_ENTRY_NAME     0xc1
+
+#define EXFATDIR_SECONDARYCOUNT 1
+#define EXFATDIR_SETCHECKSUM 2
+#define EXFATDIR_ATTR        4
+#define EXFATDIR_CRTTIME     8
+#define EXFATDIR_WRTTIME     12
+#define EXFATDIR_LSTACCTIME  16
+#define EXFATDIR_CRT10MS     20
+#define EXFATSTREAM_FLAGS    1
+#define EXFATSTREAM_NAMELEN  3
+#define EXFATSTREAM_VALIDLEN 8
+#define EXFATSTREAM_FSTCLUS  20
+#define EXFATSTREAM_DATALEN  24
+#define EXFATSTREAM_NOFATCHAIN 0x02
+#define EXFATNAME_POS        2
+#define EXFATNAME_CHARS      15
+#define EXFATBITMAP_FSTCLUS  20
+/* a stream entry and up to 17 name entries for 255 characters */
+#define EXFAT_MAX_SECONDARY  18
+
 struct fsinfo {
     unsigned long freecount; /* last known free cluster count */
     unsigned long nextfree;  /* first cluster to start looking for free
@@ -139,6 +184,17 @@ struct fsinfo {
 #define FSINFO_FREECOUNT 488
 #define FSINFO_NEXTFREE  492
 
+/* Keep a bitmap of the free clusters of each volume in RAM, so allocating
+ * doesn't have to read through the FAT. Bootloaders don't have buflib. */
+#ifndef BOOTLOADER
+#define FAT_FREEMAP
+#endif
+
+/* exFAT volumes can be mounted, but only for reading */
+#ifndef BOOTLOADER
+#define FAT_EXFAT
+#endif
+
 /* Note: This struct doesn't hold the raw values after mounting if
  * bpb_bytspersec isn't 512. All sector counts are normalized to 512 byte
  * physical sectors. */
@@ -168,6 +224,14 @@ struct bpb
     unsigned long startsector;
     unsigned long dataclusters;
     struct fsinfo fsinfo;
+#ifdef FAT_FREEMAP
+    int freemap_handle;          /* bit set for each free cluster, or 0 */
+    unsigned long freemap_known; /* clusters below this are in the bitmap */
+#endif
+#ifdef FAT_EXFAT
+    bool is_exfat;               /* true if this is a (read only) exFAT */
+    long bitmap_cluster;         /* first cluster of the allocation bitmap */
+#endif
 #ifdef HAVE_FAT16SUPPORT
     int bpb_rootentcnt;  /* Number of dir entries in the root */
     /* internals for FAT16 support */
@@ -198,14 +262,29 @@ static unsigned long find_free_cluster(IF_MV2(struct bpb* fat_bpb,)
 static int transfer(IF_MV2(struct bpb* fat_bpb,) unsigned long start,
                     long count, char* buf, bool write );
 
-#define FAT_CACHE_SIZE 0x20
-#define FAT_CACHE_MASK (FAT_CACHE_SIZE-1)
+/* The FAT cache is set associative, a sector can go into any of the ways of
+ * the set selected by its low bits. Consecutive FAT sectors fall into
+ * different sets so a scan doesn't evict the chain of the file being
+ * written. The size can be overridden in config-[target].h */
+#ifndef FAT_CACHE_WAYS
+#define FAT_CACHE_WAYS 4
+#endif
+#ifndef FAT_CACHE_SETS
+#if (MEMORYSIZE > 8) && !defined(BOOTLOADER)
+#define FAT_CACHE_SETS 16
+#else
+#define FAT_CACHE_SETS 8
+#endif
+#endif
+#define FAT_CACHE_SIZE (FAT_CACHE_SETS * FAT_CACHE_WAYS)
+#define FAT_CACHE_MASK (FAT_CACHE_SETS-1)
 
 struct fat_cache_entry
 {
     long secnum;
     bool inuse;
     bool dirty;
+    unsigned int lastuse; /* for picking the way to replace */
 #ifdef HAVE_MULTIVOLUME
     struct bpb* fat_vol ; /* shared cache for all volumes */
 #endif
@@ -213,6 +292,7 @@ struct fat_cache_entry
 
 static char fat_cache_sectors[FAT_CACHE_SIZE][SECTOR_SIZE] CACHEALIGN_ATTR;
 static struct fat_cache_entry fat_cache[FAT_CACHE_SIZE];
+static unsigned int fat_cache_clock;
 static struct mutex cache_mutex SHAREDBSS_ATTR;
 static struct mutex tempbuf_mutex;
 static char fat_tempbuf[SECTOR_SIZE] CACHEALIGN_ATTR;
@@ -252,6 +332,21 @@ static long cluster2sec(IF_MV2(struct bpb* fat_bpb,) long cluster)
            + fat_bpb->firstdatasector;
 }
 
+/* exFAT volumes are mounted read only, whatever would modify the volume
+   checks this first */
+static inline bool is_exfat(IF_MV_NONVOID(int volume))
+{
+#ifdef FAT_EXFAT
+#ifndef HAVE_MULTIVOLUME
+    const int volume = 0;
+#endif
+    return fat_bpbs[volume].is_exfat;
+#else
+    IF_MV((void)volume;)
+    return false;
+#endif
+}
+
 void fat_size(IF_MV2(int volume,) unsigned long* size, unsigned long* free)
 {
 #ifndef HAVE_MULTIVOLUME
@@ -288,6 +383,7 @@ void fat_init(void)
         fat_cache[i].secnum = 8; /* We use a "safe" sector just in case */
         fat_cache[i].inuse = false;
         fat_cache[i].dirty = false;
+        fat_cache[i].lastuse = 0;
 #ifdef HAVE_MULTIVOLUME
         fat_cache[i].fat_vol = NULL;
 #endif
@@ -301,6 +397,360 @@ void fat_init(void)
 #endif
 }
 
+#ifdef FAT_FREEMAP
+/* The bitmap starts out empty when a volume is mounted and grows from the
+ * start of the FAT as sectors of it get scanned, either while looking for
+ * free clusters or in the background when the disk is idle. Only the part
+ * below freemap_known is valid, beyond that the FAT has to be read. */
+
+/* Volumes whose bitmap would take more than 1/64 of the RAM go without */
+#define FREEMAP_MAX_SIZE (MEMORYSIZE * 1024 * 1024ul / 64)
+
+static unsigned long freemap_total(const struct bpb* fat_bpb)
+{
+    return fat_bpb->dataclusters + 2; /* nr 0 and 1 are unused */
+}
+
+static unsigned long freemap_per_sector(const struct bpb* fat_bpb)
+{
+#ifdef HAVE_FAT16SUPPORT
+    if (fat_bpb->is_fat16)
+        return CLUSTERS_PER_FAT16_SECTOR;
+#else
+    (void)fat_bpb;
+#endif
+    return CLUSTERS_PER_FAT_SECTOR;
+}
+
+static void freemap_init(struct bpb* fat_bpb)
+{
+    size_t size = (freemap_total(fat_bpb) + 31) / 32 * sizeof(uint32_t);
+
+    fat_bpb->freemap_known = 0;
+    fat_bpb->freemap_handle = 0;
+    if (size > FREEMAP_MAX_SIZE)
+    {
+        DEBUGF("freemap_init() - Too many clusters: %lu\n",
+               freemap_total(fat_bpb));
+        return;
+    }
+
+    fat_bpb->freemap_handle = core_alloc("fat freemap", size);
+    if (fat_bpb->freemap_handle <= 0)
+    {
+        DEBUGF("freemap_init() - No memory for %lu clusters\n",
+               freemap_total(fat_bpb));
+        fat_bpb->freemap_handle = 0;
+        return;
+    }
+    memset(core_get_data(fat_bpb->freemap_handle), 0, size);
+}
+
+static void freemap_free(struct bpb* fat_bpb)
+{
+    if (fat_bpb->freemap_handle > 0)
+        core_free(fat_bpb->freemap_handle);
+    fat_bpb->freemap_handle = 0;
+    fat_bpb->freemap_known = 0;
+}
+
+static bool freemap_complete(const struct bpb* fat_bpb)
+{
+    return fat_bpb->freemap_handle &&
+           fat_bpb->freemap_known >= freemap_total(fat_bpb);
+}
+
+/* Add the entries of one FAT sector to the bitmap, if it is the sector
+ * right after the part that is known already */
+static void freemap_add_sector(struct bpb* fat_bpb, unsigned long fatsector,
+                               const void* sec)
+{
+    unsigned long per = freemap_per_sector(fat_bpb);
+    unsigned long c = fatsector * per;
+    unsigned long end = MIN(c + per, freemap_total(fat_bpb));
+    uint32_t* map;
+
+    if (!fat_bpb->freemap_handle || !sec || c != fat_bpb->freemap_known)
+        return;
+
+    map = core_get_data(fat_bpb->freemap_handle);
+    for (; c < end; c++)
+    {
+        unsigned long entry;
+#ifdef HAVE_FAT16SUPPORT
+        if (fat_bpb->is_fat16)
+            entry = letoh16(((const uint16_t*)sec)[c % per]);
+        else
+#endif
+            entry = letoh32(((const uint32_t*)sec)[c % per]) & 0x0fffffff;
+
+        if (!entry && c >= 2)
+            map[c / 32] |= 1ul << (c % 32);
+    }
+    fat_bpb->freemap_known = end;
+}
+
+static void freemap_set(struct bpb* fat_bpb, unsigned long cluster, bool free)
+{
+    uint32_t* map;
+
+    if (!fat_bpb->freemap_handle || cluster >= fat_bpb->freemap_known)
+        return;
+
+    map = core_get_data(fat_bpb->freemap_handle);
+    if (free)
+        map[cluster / 32] |= 1ul << (cluster % 32);
+    else
+        map[cluster / 32] &= ~(1ul << (cluster % 32));
+}
+
+/* First free cluster in [from, to), or 0 */
+static unsigned long freemap_search(const struct bpb* fat_bpb,
+                                    unsigned long from, unsigned long to)
+{
+    const uint32_t* map = core_get_data(fat_bpb->freemap_handle);
+
+    while (from < to)
+    {
+        uint32_t word = map[from / 32] >> (from % 32);
+        if (word)
+        {
+            from += find_first_set_bit(word);
+            return from < to ? from : 0;
+        }
+        from = (from | 31) + 1;
+    }
+    return 0;
+}
+
+static unsigned long freemap_count(const struct bpb* fat_bpb)
+{
+    const uint32_t* map = core_get_data(fat_bpb->freemap_handle);
+    unsigned long words = (freemap_total(fat_bpb) + 31) / 32;
+    unsigned long i, count = 0;
+
+    for (i = 0; i < words; i++)
+    {
+        uint32_t w = map[i];
+        w = w - ((w >> 1) & 0x55555555);
+        w = (w & 0x33333333) + ((w >> 2) & 0x33333333);
+        count += (((w + (w >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+    }
+    return count;
+}
+
+#if USING_STORAGE_CALLBACK
+/* Sectors read at once, and per idle callback for all volumes together
+ * when building the bitmap. The callbacks are also forced before the disk
+ * sleeps, on USB connect and on shutdown, so each one only does a little. */
+#define FREEMAP_READ_SECTORS 8
+#define FREEMAP_IDLE_SECTORS 64
+
+static unsigned char freemap_buf[FREEMAP_READ_SECTORS * SECTOR_SIZE]
+    CACHEALIGN_ATTR;
+
+static void *fat_cache_lookup(struct bpb* fat_bpb, long fatsector);
+
+/* Storage idle callback scanning the next slice of the FAT of the volumes
+ * whose bitmap isn't complete yet. Stays registered until all are. */
+static void freemap_idle_build(void *data)
+{
+    bool pending = false;
+    unsigned long n = 0;
+    int i;
+    (void)data;
+
+    for (i = 0; i < NUM_VOLUMES; i++)
+    {
+        struct bpb* fat_bpb = &fat_bpbs[i];
+
+        if (!fat_bpb->freemap_handle
+#ifdef HAVE_MULTIVOLUME
+            || !fat_bpb->mounted
+#endif
+           )
+            continue;
+
+        while (n < FREEMAP_IDLE_SECTORS && !freemap_complete(fat_bpb))
+        {
+            unsigned long fatsector =
+                fat_bpb->freemap_known / freemap_per_sector(fat_bpb);
+            unsigned long count = MIN(FREEMAP_READ_SECTORS,
+                                      fat_bpb->fatsize - fatsector);
+            unsigned long j;
+            int rc;
+
+            /* hold the cache so no entry of these sectors can change
+               between reading them and adding them */
+            mutex_lock(&cache_mutex);
+            rc = storage_read_sectors(IF_MD2(fat_bpb->drive,)
+                                      fat_bpb->startsector +
+                                      fat_bpb->bpb_rsvdseccnt + fatsector,
+                                      count, freemap_buf);
+            if (rc < 0)
+            {
+                mutex_unlock(&cache_mutex);
+                break;
+            }
+            for (j = 0; j < count; j++)
+            {
+                /* a cached copy may be newer than the one on disk */
+                void *sec = fat_cache_lookup(fat_bpb, fatsector + j);
+                freemap_add_sector(fat_bpb, fatsector + j, sec ? sec :
+                                   &freemap_buf[j * SECTOR_SIZE]);
+            }
+            mutex_unlock(&cache_mutex);
+            n += count;
+        }
+
+        if (!freemap_complete(fat_bpb))
+            pending = true;
+    }
+
+    if (!pending)
+        remove_event(DISK_EVENT_SPINUP, freemap_idle_build);
+}
+#endif /* USING_STORAGE_CALLBACK */
+#endif /* FAT_FREEMAP */
+
+#ifdef FAT_EXFAT
+/* The boot sector of an exFAT volume has the geometry at different places
+ * and as powers of two. It maps onto the same bpb fields as FAT32, with the
+ * cluster heap as the data area and the FAT at FatOffset. The FAT itself has
+ * the same 32 bit format, except that the clusters of files flagged as
+ * contiguous aren't in it at all. buf holds the boot sector and is reused. */
+static int exfat_mount_internal(struct bpb* fat_bpb, unsigned char* buf)
+{
+    int bpsshift = buf[EXFAT_BYTSPERSECSHIFT];
+    int spcshift = buf[EXFAT_SECPERCLUSSHIFT];
+    unsigned long secmult, vollength;
+    unsigned int i, j;
+    int pct, rc;
+
+    if (bpsshift < 9 || bpsshift > 12 || spcshift > 25 - bpsshift)
+    {
+        DEBUGF("exfat_mount() - Bad geometry (%d, %d)\n", bpsshift, spcshift);
+        return -2;
+    }
+
+    fat_bpb->is_exfat       = true;
+    fat_bpb->bpb_bytspersec = 1 << bpsshift;
+    secmult = fat_bpb->bpb_bytspersec / SECTOR_SIZE;
+
+    fat_bpb->bpb_secperclus = secmult << spcshift;
+    fat_bpb->bpb_rsvdseccnt = secmult * BYTES2INT32(buf,EXFAT_FATOFFSET);
+    fat_bpb->bpb_numfats    = buf[EXFAT_NUMFATS];
+    fat_bpb->bpb_media      = 0xf8; /* there is no media byte */
+    fat_bpb->last_word      = BYTES2INT16(buf,BPB_LAST_WORD);
+    fat_bpb->fatsize        = secmult * BYTES2INT32(buf,EXFAT_FATLENGTH);
+
+    /* the volume length is 64 bit, sector numbers here are 32 bit */
+    vollength = BYTES2INT32(buf,EXFAT_VOLLENGTH);
+    if (BYTES2INT32(buf,EXFAT_VOLLENGTH + 4) || vollength > 0xffffffff / secmult)
+    {
+        DEBUGF("exfat_mount() - Volume is too large\n");
+        return -2;
+    }
+    fat_bpb->totalsectors    = secmult * vollength;
+    fat_bpb->firstdatasector = secmult * BYTES2INT32(buf,EXFAT_HEAPOFFSET);
+    fat_bpb->dataclusters    = BYTES2INT32(buf,EXFAT_CLUSTERCOUNT);
+    fat_bpb->bpb_rootclus    = BYTES2INT32(buf,EXFAT_ROOTCLUS);
+    fat_bpb->rootdirsector   = cluster2sec(IF_MV2(fat_bpb,)
+                                           fat_bpb->bpb_rootclus);
+
+    rc = bpb_is_sane(IF_MV(fat_bpb));
+    if (rc < 0)
+    {
+        DEBUGF( "exfat_mount() - BPB is not sane\n");
+        return rc * 10 - 3;
+    }
+
+    /* There is no FsInfo, only a rough percentage. Count the bitmap if it
+       isn't known, it is a lot smaller than a FAT. */
+    pct = buf[EXFAT_PERCENTINUSE];
+    if (pct <= 100)
+        fat_bpb->fsinfo.freecount = fat_bpb->dataclusters / 100 * (100 - pct);
+    else
+        fat_bpb->fsinfo.freecount = 0xffffffff; /* force recalc */
+    fat_bpb->fsinfo.nextfree = 0xffffffff;
+
+    /* The allocation bitmap has an entry in the root directory, which
+       always has a FAT chain. It is near the start, the first cluster is
+       plenty to look in. */
+    for (i = 0; i < fat_bpb->bpb_secperclus; i++)
+    {
+        rc = storage_read_sectors(IF_MD2(fat_bpb->drive,)
+                                  fat_bpb->startsector +
+                                  fat_bpb->rootdirsector + i, 1, buf);
+        if (rc < 0)
+        {
+            DEBUGF( "exfat_mount() - Couldn't read root (error code %d)\n",
+                    rc);
+            return rc * 10 - 4;
+        }
+
+        for (j = 0; j < SECTOR_SIZE; j += DIR_ENTRY_SIZE)
+        {
+            if (buf[j] == EXFAT_ENTRY_BITMAP)
+            {
+                fat_bpb->bitmap_cluster = BYTES2INT32(buf,
+                                            j + EXFATBITMAP_FSTCLUS);
+                return 0;
+            }
+            if (buf[j] == EXFAT_ENTRY_EOD)
+                break;
+        }
+
+        if (j < SECTOR_SIZE)
+            break;
+    }
+
+    DEBUGF("exfat_mount() - No allocation bitmap\n");
+    return -5;
+}
+
+static long get_next_cluster(IF_MV2(struct bpb* fat_bpb,) long cluster);
+
+/* Count the clear bits of the allocation bitmap */
+static void exfat_recalc_free(struct bpb* fat_bpb)
+{
+    unsigned long c = 0, free = 0;
+    long cluster;
+    unsigned int i, j;
+    unsigned char* buf = fat_get_sector_buffer();
+
+    for (cluster = fat_bpb->bitmap_cluster;
+         cluster > 0 && c < fat_bpb->dataclusters;
+         cluster = get_next_cluster(IF_MV2(fat_bpb,) cluster))
+    {
+        long sector = cluster2sec(IF_MV2(fat_bpb,) cluster);
+
+        for (i = 0; i < fat_bpb->bpb_secperclus &&
+                    c < fat_bpb->dataclusters; i++)
+        {
+            if (storage_read_sectors(IF_MD2(fat_bpb->drive,)
+                                     fat_bpb->startsector + sector + i,
+                                     1, buf) < 0)
+            {
+                /* keep whatever the boot sector said */
+                fat_release_sector_buffer();
+                return;
+            }
+
+            for (j = 0; j < SECTOR_SIZE * 8 &&
+                        c < fat_bpb->dataclusters; j++, c++)
+            {
+                if (!(buf[j / 8] & (1 << (j % 8))))
+                    free++;
+            }
+        }
+    }
+
+    fat_release_sector_buffer();
+    fat_bpb->fsinfo.freecount = free;
+}
+#endif /* FAT_EXFAT */
+
 /* fat_mount_internal is split out of fat_mount() to avoid having both the sector
  * buffer used here and the sector buffer used by update_fsinfo() on stack */
 static int fat_mount_internal(IF_MV2(int volume,) IF_MD2(int drive,) long startsector)
@@ -332,6 +782,15 @@ static int fat_mount_internal(IF_MV2(int volume,) IF_MD2(int drive,) long starts
     fat_bpb->drive          = drive;
 #endif
 
+#ifdef FAT_EXFAT
+    if (!memcmp(buf + EXFAT_OEMNAME, "EXFAT   ", 8))
+    {
+        rc = exfat_mount_internal(fat_bpb, buf);
+        fat_release_sector_buffer();
+        return rc;
+    }
+#endif
+
     fat_bpb->bpb_bytspersec = BYTES2INT16(buf,BPB_BYTSPERSEC);
     secmult = fat_bpb->bpb_bytspersec / SECTOR_SIZE; 
     /* Sanity check is performed later */
@@ -501,10 +960,20 @@ int fat_mount(IF_MV2(int volume,) IF_MD2(int drive,) long startsector)
     struct bpb* fat_bpb = &fat_bpbs[volume];
     int rc;
 
+#ifdef FAT_FREEMAP
+    freemap_free(fat_bpb); /* in case it wasn't unmounted */
+#endif
+
     rc = fat_mount_internal(IF_MV2(volume,) IF_MD2(drive,) startsector);
 
     if(rc!=0) return rc;
 
+#ifdef FAT_FREEMAP
+    /* nothing is ever allocated on exFAT */
+    if (!is_exfat(IF_MV(volume)))
+        freemap_init(fat_bpb);
+#endif
+
     /* calculate freecount if unset */
     if ( fat_bpb->fsinfo.freecount == 0xffffffff )
     {
@@ -521,6 +990,12 @@ int fat_mount(IF_MV2(int volume,) IF_MD2(int drive,) long startsector)
     fat_bpb->mounted = true;
 #endif
 
+#if defined(FAT_FREEMAP) && USING_STORAGE_CALLBACK
+    /* fill in the rest of the bitmap whenever the disk is idle */
+    if (fat_bpb->freemap_handle && !freemap_complete(fat_bpb))
+        add_event(DISK_EVENT_SPINUP, false, freemap_idle_build);
+#endif
+
     return 0;
 }
 
@@ -557,6 +1032,15 @@ int fat_unmount(int volume, bool flush)
         mutex_unlock(&cache_mutex);
         rc = 0;
     }
+#ifdef FAT_FREEMAP
+    mutex_lock(&cache_mutex);
+#ifdef HAVE_MULTIVOLUME
+    freemap_free(fat_bpb);
+#else
+    freemap_free(&fat_bpbs[0]);
+#endif
+    mutex_unlock(&cache_mutex);
+#endif
 #ifdef HAVE_MULTIVOLUME
     fat_bpb->mounted = false;
 #endif
@@ -571,12 +1055,34 @@ void fat_recalc_free(IF_MV_NONVOID(int volume))
     struct bpb* fat_bpb = &fat_bpbs[volume];
     long free = 0;
     unsigned long i;
+#ifdef FAT_EXFAT
+    if (fat_bpb->is_exfat)
+    {
+        exfat_recalc_free(fat_bpb);
+        return;
+    }
+#endif
+#ifdef FAT_FREEMAP
+    if (freemap_complete(fat_bpb))
+    {
+        /* no need to read the FAT again */
+        fat_bpb->fsinfo.freecount = freemap_count(fat_bpb);
+        if ( fat_bpb->fsinfo.nextfree == 0xffffffff )
+            fat_bpb->fsinfo.nextfree =
+                freemap_search(fat_bpb, 2, freemap_total(fat_bpb));
+        update_fsinfo(IF_MV(fat_bpb));
+        return;
+    }
+#endif
 #ifdef HAVE_FAT16SUPPORT
     if (fat_bpb->is_fat16)
     {
         for (i = 0; i<fat_bpb->fatsize; i++) {
             unsigned int j;
             unsigned short* fat = cache_fat_sector(IF_MV2(fat_bpb,) i, false);
+#ifdef FAT_FREEMAP
+            freemap_add_sector(fat_bpb, i, fat);
+#endif
             for (j = 0; j < CLUSTERS_PER_FAT16_SECTOR; j++) {
                 unsigned int c = i * CLUSTERS_PER_FAT16_SECTOR + j;
                 if ( c > fat_bpb->dataclusters+1 ) /* nr 0 is unused */
@@ -596,6 +1102,9 @@ void fat_recalc_free(IF_MV_NONVOID(int volume))
         for (i = 0; i<fat_bpb->fatsize; i++) {
             unsigned int j;
             unsigned long* fat = cache_fat_sector(IF_MV2(fat_bpb,) i, false);
+#ifdef FAT_FREEMAP
+            freemap_add_sector(fat_bpb, i, fat);
+#endif
             for (j = 0; j < CLUSTERS_PER_FAT_SECTOR; j++) {
                 unsigned long c = i * CLUSTERS_PER_FAT_SECTOR + j;
                 if ( c > fat_bpb->dataclusters+1 ) /* nr 0 is unused */
@@ -710,6 +1219,28 @@ static void flush_fat_sector(struct fat_cache_entry *fce,
     fce->dirty = false;
 }
 
+#if defined(FAT_FREEMAP) && USING_STORAGE_CALLBACK
+/* Return the cached copy of a FAT sector, or NULL if it isn't cached.
+   The cache_mutex must be held. */
+static void *fat_cache_lookup(struct bpb* fat_bpb, long fatsector)
+{
+    long secnum = fatsector + fat_bpb->bpb_rsvdseccnt;
+    int set = (secnum & FAT_CACHE_MASK) * FAT_CACHE_WAYS;
+    int i;
+
+    for(i = set;i < set + FAT_CACHE_WAYS;i++)
+    {
+        if(fat_cache[i].inuse && fat_cache[i].secnum == secnum
+#ifdef HAVE_MULTIVOLUME
+           && fat_cache[i].fat_vol == fat_bpb
+#endif
+          )
+            return fat_cache_sectors[i];
+    }
+    return NULL;
+}
+#endif
+
 /* Note: The returned pointer is only safely valid until the next
          task switch! (Any subsequent ata read/write may yield.) */
 static void *cache_fat_sector(IF_MV2(struct bpb* fat_bpb,)
@@ -719,13 +1250,39 @@ static void *cache_fat_sector(IF_MV2(struct bpb* fat_bpb,)
     struct bpb* fat_bpb = &fat_bpbs[0];
 #endif
     long secnum = fatsector + fat_bpb->bpb_rsvdseccnt;
-    int cache_index = secnum & FAT_CACHE_MASK;
-    struct fat_cache_entry *fce = &fat_cache[cache_index];
-    unsigned char *sectorbuf = &fat_cache_sectors[cache_index][0];
-    int rc;
+    int set = (secnum & FAT_CACHE_MASK) * FAT_CACHE_WAYS;
+    int cache_index = -1;
+    struct fat_cache_entry *fce;
+    unsigned char *sectorbuf;
+    int i, rc;
 
     mutex_lock(&cache_mutex); /* make changes atomic */
 
+    /* Look for the sector in its set, and for the way to replace in case
+       it isn't there: an unused one or else the least recently used */
+    for(i = set;i < set + FAT_CACHE_WAYS;i++)
+    {
+        fce = &fat_cache[i];
+        if(fce->inuse && fce->secnum == secnum
+#ifdef HAVE_MULTIVOLUME
+           && fce->fat_vol == fat_bpb
+#endif
+          )
+        {
+            cache_index = i;
+            break;
+        }
+
+        if(cache_index < 0 || (fat_cache[cache_index].inuse &&
+           (!fce->inuse ||
+            (int)(fce->lastuse - fat_cache[cache_index].lastuse) < 0)))
+            cache_index = i;
+    }
+
+    fce = &fat_cache[cache_index];
+    sectorbuf = &fat_cache_sectors[cache_index][0];
+    fce->lastuse = ++fat_cache_clock;
+
     /* Delete the cache entry if it isn't the sector we want */
     if(fce->inuse && (fce->secnum != secnum
 #ifdef HAVE_MULTIVOLUME
@@ -776,6 +1333,31 @@ static unsigned long find_free_cluster(IF_MV2(struct bpb* fat_bpb,)
     unsigned long offset;
     unsigned long i;
 
+#ifdef FAT_FREEMAP
+    if (fat_bpb->freemap_handle)
+    {
+        unsigned long total = freemap_total(fat_bpb);
+        unsigned long c = 0;
+
+        if (startcluster < fat_bpb->freemap_known)
+            c = freemap_search(fat_bpb, MAX(startcluster, 2),
+                               fat_bpb->freemap_known);
+        if (!c && freemap_complete(fat_bpb))
+            c = freemap_search(fat_bpb, 2, MIN(startcluster, total));
+
+        if (c || freemap_complete(fat_bpb))
+        {
+            LDEBUGF("find_free_cluster(%lx) == %lx\n",startcluster,c);
+            if (c)
+                fat_bpb->fsinfo.nextfree = c;
+            return c;
+        }
+
+        /* nothing in the part the bitmap knows about, go on where it ends */
+        startcluster = MAX(startcluster, fat_bpb->freemap_known);
+    }
+#endif
+
 #ifdef HAVE_FAT16SUPPORT
     if (fat_bpb->is_fat16)
     {
@@ -788,6 +1370,9 @@ static unsigned long find_free_cluster(IF_MV2(struct bpb* fat_bpb,)
             unsigned short* fat = cache_fat_sector(IF_MV2(fat_bpb,) nr, false);
             if ( !fat )
                 break;
+#ifdef FAT_FREEMAP
+            freemap_add_sector(fat_bpb, nr, fat);
+#endif
             for (j = 0; j < CLUSTERS_PER_FAT16_SECTOR; j++) {
                 int k = (j + offset) % CLUSTERS_PER_FAT16_SECTOR;
                 if (letoh16(fat[k]) == 0x0000) {
@@ -816,6 +1401,9 @@ static unsigned long find_free_cluster(IF_MV2(struct bpb* fat_bpb,)
             unsigned long* fat = cache_fat_sector(IF_MV2(fat_bpb,) nr, false);
             if ( !fat )
                 break;
+#ifdef FAT_FREEMAP
+            freemap_add_sector(fat_bpb, nr, fat);
+#endif
             for (j = 0; j < CLUSTERS_PER_FAT_SECTOR; j++) {
                 int k = (j + offset) % CLUSTERS_PER_FAT_SECTOR;
                 if (!(letoh32(fat[k]) & 0x0fffffff)) {
@@ -880,6 +1468,9 @@ static int update_fat_entry(IF_MV2(struct bpb* fat_bpb,) unsigned long entry,
                 fat_bpb->fsinfo.freecount);
 
         sec[offset] = htole16(val);
+#ifdef FAT_FREEMAP
+        freemap_set(fat_bpb, entry, !val);
+#endif
     }
     else
 #endif /* #ifdef HAVE_FAT16SUPPORT */
@@ -919,6 +1510,9 @@ static int update_fat_entry(IF_MV2(struct bpb* fat_bpb,) unsigned long entry,
         /* don't change top 4 bits */
         sec[offset] &= htole32(0xf0000000);
         sec[offset] |= htole32(val & 0x0fffffff);
+#ifdef FAT_FREEMAP
+        freemap_set(fat_bpb, entry, !(val & 0x0fffffff));
+#endif
     }
 
     return 0;
@@ -1000,6 +1594,10 @@ static int update_fsinfo(IF_MV_NONVOID(struct bpb* fat_bpb))
     if (fat_bpb->is_fat16)
         return 0; /* FAT16 has no FsInfo */
 #endif /* #ifdef HAVE_FAT16SUPPORT */
+#ifdef FAT_EXFAT
+    if (fat_bpb->is_exfat)
+        return 0; /* neither has exFAT, and it is read only */
+#endif
 
     unsigned char* fsinfo = fat_get_sector_buffer();
     /* update fsinfo */
@@ -1739,6 +2337,106 @@ static int parse_direntry(struct fat_direntry *de, const unsigned char *buf)
     return 1;
 }
 
+/* Return the volume cluster holding cluster number clusternum of the file,
+   or 0 if that part of the chain isn't in the file's extent map */
+static long extent_lookup(const struct fat_file *file, long clusternum)
+{
+    const struct fat_extent_cache *ec = file->extents;
+    int lo = 0, hi;
+
+    if (!ec || clusternum >= ec->known)
+        return 0;
+
+    /* the runs are sorted and cover 0..known-1 without gaps */
+    hi = ec->used - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (ec->run[mid].fileclust <= clusternum)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return ec->run[lo].cluster + (clusternum - ec->run[lo].fileclust);
+}
+
+/* Note that cluster number clusternum of the file is the given volume
+   cluster. Only extends the map when it continues the known part */
+static void extent_record(const struct fat_file *file, long clusternum,
+                          long cluster)
+{
+    struct fat_extent_cache *ec = file->extents;
+    struct fat_extent *run;
+
+    if (!ec || clusternum != ec->known || cluster <= 0)
+        return;
+
+    if (ec->used &&
+        cluster == ec->run[ec->used - 1].cluster + ec->run[ec->used - 1].count)
+        ec->run[ec->used - 1].count++;
+    else if (ec->used < FAT_EXTENTS) {
+        run = &ec->run[ec->used++];
+        run->fileclust = clusternum;
+        run->cluster = cluster;
+        run->count = 1;
+    }
+    else
+        return; /* full */
+
+    ec->known++;
+}
+
+/* Forget everything in the map from file cluster clusternum onwards */
+static void extent_trim(const struct fat_file *file, long clusternum)
+{
+    struct fat_extent_cache *ec = file->extents;
+
+    if (!ec || clusternum >= ec->known)
+        return;
+
+    while (ec->used && ec->run[ec->used - 1].fileclust >= clusternum)
+        ec->used--;
+
+    if (ec->used) {
+        struct fat_extent *run = &ec->run[ec->used - 1];
+        run->count = clusternum - run->fileclust;
+    }
+
+    ec->known = clusternum;
+}
+
+void fat_set_extent_cache(struct fat_file *file,
+                          struct fat_extent_cache *cache)
+{
+    file->extents = cache;
+    if (cache) {
+        cache->used = 0;
+        cache->known = 0;
+        extent_record(file, 0, file->firstcluster);
+    }
+}
+
+/* Tell an opened file that its clusters are one contiguous run without a FAT
+   chain, if attr says so. Only exFAT has such files, it is a no-op else. */
+void fat_set_contiguous(struct fat_file *file, int attr, unsigned long size)
+{
+#ifdef FAT_EXFAT
+#ifdef HAVE_MULTIVOLUME
+    struct bpb* fat_bpb = &fat_bpbs[file->volume];
+#else
+    struct bpb* fat_bpb = &fat_bpbs[0];
+#endif
+    unsigned long clustersize = fat_bpb->bpb_secperclus * SECTOR_SIZE;
+
+    if (!(attr & FAT_ATTR_CONTIGUOUS) || file->firstcluster <= 0)
+        return;
+
+    file->contiguous = size / clustersize + (size % clustersize ? 1 : 0);
+#else
+    (void)file; (void)attr; (void)size;
+#endif
+}
+
 int fat_open(IF_MV2(int volume,)
              long startcluster,
              struct fat_file *file,
@@ -1759,6 +2457,8 @@ int fat_open(IF_MV2(int volume,)
     file->clusternum = 0;
     file->sectornum = 0;
     file->eof = false;
+    file->extents = NULL;
+    file->contiguous = 0;
 #ifdef HAVE_MULTIVOLUME
     file->volume = volume;
     /* fixme: remove error check when done */
@@ -1780,6 +2480,9 @@ int fat_create_file(const char* name,
     int rc;
 
     LDEBUGF("fat_create_file(\"%s\",%lx,%lx)\n",name,(long)file,(long)dir);
+    if (is_exfat(IF_MV(dir->file.volume)))
+        return -1; /* read only */
+
     rc = add_dir_entry(dir, file, name, false, false);
     if (!rc) {
         file->firstcluster = 0;
@@ -1788,6 +2491,8 @@ int fat_create_file(const char* name,
         file->clusternum = 0;
         file->sectornum = 0;
         file->eof = false;
+        file->extents = NULL;
+        file->contiguous = 0;
     }
 
     return rc;
@@ -1828,6 +2533,8 @@ int fat_create_dir(const char* name,
     struct fat_file dummyfile;
 
     LDEBUGF("fat_create_dir(\"%s\",%lx,%lx)\n",name,(long)newdir,(long)dir);
+    if (is_exfat(IF_MV(dir->file.volume)))
+        return -1; /* read only */
 
     memset(newdir, 0, sizeof(struct fat_dir));
     memset(&dummyfile, 0, sizeof(struct fat_file));
@@ -1891,6 +2598,8 @@ int fat_truncate(const struct fat_file *file)
 #endif
 
     LDEBUGF("fat_truncate(%lx, %lx)\n", file->firstcluster, last);
+    if (is_exfat(IF_MV(file->volume)))
+        return -1; /* read only */
 
     for ( last = get_next_cluster(IF_MV2(fat_bpb,) last); last; last = next ) {
         next = get_next_cluster(IF_MV2(fat_bpb,) last);
@@ -1899,6 +2608,142 @@ int fat_truncate(const struct fat_file *file)
     if (file->lastcluster)
         update_fat_entry(IF_MV2(fat_bpb,) file->lastcluster,FAT_EOF_MARK);
 
+    extent_trim(file, file->clusternum + 1);
+
+    return 0;
+}
+
+/* Number of free runs looked at before settling for the longest one seen */
+#define PREALLOC_TRIES 16
+
+/* Look for a run of at least want free clusters, beginning the search at
+ * startcluster. If none is found the longest run seen is returned instead.
+ * Returns the first cluster of the run and its length in *len, or 0 if the
+ * volume is full */
+static unsigned long find_free_run(IF_MV2(struct bpb* fat_bpb,)
+                                   unsigned long startcluster, long want,
+                                   long* len)
+{
+#ifndef HAVE_MULTIVOLUME
+    struct bpb* fat_bpb = &fat_bpbs[0];
+#endif
+    unsigned long lastcluster = fat_bpb->dataclusters + 1;
+    unsigned long c, best = 0;
+    long bestlen = 0;
+    bool wrapped = false;
+    int tries;
+
+    if (startcluster < 2 || startcluster > lastcluster)
+        startcluster = 2;
+    c = startcluster;
+
+    for (tries = 0; tries < PREALLOC_TRIES; tries++) {
+        unsigned long run = find_free_cluster(IF_MV2(fat_bpb,) c);
+        long n = 1;
+
+        if (!run)
+            break;
+        if (run < c) {
+            /* wrapped around the end of the FAT */
+            if (wrapped)
+                break;
+            wrapped = true;
+        }
+        if (wrapped && run >= startcluster)
+            break; /* back where we started */
+
+        while (n < want && run + n <= lastcluster &&
+               read_fat_entry(IF_MV2(fat_bpb,) run + n) == 0)
+            n++;
+
+        if (n > bestlen) {
+            best = run;
+            bestlen = n;
+            if (n >= want)
+                break;
+        }
+
+        c = run + n + 1;
+        if (c > lastcluster) {
+            if (wrapped)
+                break;
+            wrapped = true;
+            c = 2;
+        }
+    }
+
+    *len = bestlen;
+    return best;
+}
+
+/* Make the cluster chain of the file at least the given number of clusters
+ * long, so that it can be written without allocating. The clusters added
+ * come in as few contiguous runs as can be found. The file position is not
+ * changed, the caller has to truncate whatever it doesn't use.
+ * Returns 0 on success or a negative value if the volume ran full first, in
+ * which case the clusters that were found stay in the chain */
+int fat_preallocate(struct fat_file *file, long clusters)
+{
+#ifdef HAVE_MULTIVOLUME
+    struct bpb* fat_bpb = &fat_bpbs[file->volume];
+#else
+    struct bpb* fat_bpb = &fat_bpbs[0];
+#endif
+    long last = file->lastcluster;
+    long count = 0;
+    long next;
+
+    LDEBUGF("fat_preallocate(%lx, %ld)\n", file->firstcluster, clusters);
+
+    if (file->firstcluster < 0)
+        return -1; /* FAT16 root dir can't grow */
+    if (is_exfat(IF_MV(file->volume)))
+        return -1; /* read only */
+
+    /* find the end of the current chain, from where the file is at */
+    if (!last)
+        last = file->firstcluster;
+    if (last) {
+        count = (last == file->lastcluster ? file->clusternum : 0) + 1;
+        while (count < clusters &&
+               (next = get_next_cluster(IF_MV2(fat_bpb,) last))) {
+            last = next;
+            count++;
+        }
+        if (count >= clusters)
+            return 0;
+    }
+
+    while (count < clusters) {
+        unsigned long start = last ? (unsigned long)last + 1
+                                   : fat_bpb->fsinfo.nextfree;
+        long i, len;
+        unsigned long run = find_free_run(IF_MV2(fat_bpb,) start,
+                                          clusters - count, &len);
+        if (!run) {
+            DEBUGF("fat_preallocate(): Disk full!\n");
+            return -2;
+        }
+
+        len = MIN(len, clusters - count);
+        for (i = 0; i < len; i++)
+            update_fat_entry(IF_MV2(fat_bpb,) run + i,
+                             i < len - 1 ? run + i + 1 : FAT_EOF_MARK);
+
+        if (last)
+            update_fat_entry(IF_MV2(fat_bpb,) last, run);
+        else {
+            /* empty file, it is now positioned at the start of the run */
+            file->firstcluster = run;
+            file->lastcluster = run;
+            extent_record(file, 0, run);
+        }
+
+        last = run + len - 1;
+        count += len;
+        fat_bpb->fsinfo.nextfree = last + 1;
+    }
+
     return 0;
 }
 
@@ -1909,12 +2754,23 @@ int fat_closewrite(struct fat_file *file, long size, int attr)
     struct bpb* fat_bpb = &fat_bpbs[file->volume];
 #endif
     LDEBUGF("fat_closewrite(size=%ld)\n",size);
+    if (is_exfat(IF_MV(file->volume)))
+        return -1; /* read only */
 
     if (!size) {
-        /* empty file */
+        /* empty file, it may still have clusters reserved for it */
         if ( file->firstcluster ) {
-            update_fat_entry(IF_MV2(fat_bpb,) file->firstcluster, 0);
+            long next, cluster;
+            for (cluster = file->firstcluster; cluster > 0; cluster = next) {
+                next = get_next_cluster(IF_MV2(fat_bpb,) cluster);
+                update_fat_entry(IF_MV2(fat_bpb,) cluster, 0);
+            }
             file->firstcluster = 0;
+            file->lastcluster = 0;
+            file->lastsector = 0;
+            file->clusternum = 0;
+            file->sectornum = 0;
+            extent_trim(file, 0);
         }
     }
 
@@ -2046,6 +2902,8 @@ int fat_remove(struct fat_file* file)
 #endif
 
     LDEBUGF("fat_remove(%lx)\n",last);
+    if (is_exfat(IF_MV(file->volume)))
+        return -1; /* read only */
 
     while ( last ) {
         next = get_next_cluster(IF_MV2(fat_bpb,) last);
@@ -2059,6 +2917,7 @@ int fat_remove(struct fat_file* file)
             return rc * 10 - 1;
     }
 
+    extent_trim(file, 0);
     file->firstcluster = 0;
     file->dircluster = 0;
 
@@ -2092,6 +2951,9 @@ int fat_rename(struct fat_file* file,
     struct bpb* fat_bpb = &fat_bpbs[0];
 #endif
 
+    if (is_exfat(IF_MV(file->volume)))
+        return -1; /* read only */
+
     if ( !file->dircluster ) {
         DEBUGF("File has no dir cluster!\n");
         return -2;
@@ -2292,6 +3154,9 @@ long fat_readwrite( struct fat_file *file, long sectorcount,
     if ( eof && !write)
         return 0;
 
+    if (write && is_exfat(IF_MV(file->volume)))
+        return -1; /* read only */
+
     /* find sequential sectors and write them all at once */
     for (i=0; (i < sectorcount) && (sector > -1); i++ ) {
         numsec++;
@@ -2299,8 +3164,21 @@ long fat_readwrite( struct fat_file *file, long sectorcount,
             long oldcluster = cluster;
             long oldsector = sector;
             long oldnumsec = numsec;
-            if (write)
+            long next = cluster ? extent_lookup(file, clusternum + 1) : 0;
+            if (next) {
+                cluster = next;
+                sector = cluster2sec(IF_MV2(fat_bpb,) cluster);
+            }
+            else if (write)
                 cluster = next_write_cluster(file, cluster, &sector);
+            else if (file->contiguous) {
+                /* no chain to follow, the next cluster is simply next */
+                if (cluster && clusternum + 1 < file->contiguous)
+                    cluster++;
+                else
+                    cluster = 0;
+                sector = cluster2sec(IF_MV2(fat_bpb,) cluster);
+            }
             else {
                 cluster = get_next_cluster(IF_MV2(fat_bpb,) cluster);
                 sector = cluster2sec(IF_MV2(fat_bpb,) cluster);
@@ -2308,6 +3186,8 @@ long fat_readwrite( struct fat_file *file, long sectorcount,
 
             clusternum++;
             numsec=1;
+            if (oldcluster)
+                extent_record(file, clusternum, cluster);
 
             if (!cluster) {
                 eof = true;
@@ -2391,6 +3271,7 @@ int fat_seek(struct fat_file *file, unsigned long seeksector )
 #endif
     long clusternum=0, numclusters=0, sectornum=0, sector=0;
     long cluster = file->firstcluster;
+    long start = 0;
     long i;
 
 #ifdef HAVE_FAT16SUPPORT
@@ -2406,10 +3287,34 @@ int fat_seek(struct fat_file *file, unsigned long seeksector )
         numclusters = clusternum = seeksector / fat_bpb->bpb_secperclus;
         sectornum = seeksector % fat_bpb->bpb_secperclus;
 
-        if (file->clusternum && clusternum >= file->clusternum)
+        if (file->contiguous) {
+            /* no chain to walk at all */
+            if (clusternum >= file->contiguous) {
+                DEBUGF("Seeking beyond the end of the file! "
+                       "(sector %ld, cluster %ld)\n", seeksector, clusternum);
+                return -1;
+            }
+            cluster += clusternum;
+            numclusters = 0;
+            start = -1;
+        }
+        else if (file->extents && file->extents->known) {
+            /* start from the furthest cluster the map knows about, that
+               is all it takes if the target is inside the map */
+            start = MIN(clusternum, file->extents->known - 1);
+            cluster = extent_lookup(file, start);
+            numclusters -= start;
+        }
+        else
+            extent_record(file, 0, cluster);
+
+        if (!file->contiguous &&
+            file->clusternum && clusternum >= file->clusternum &&
+            file->clusternum > start)
         {
             cluster = file->lastcluster;
-            numclusters -= file->clusternum;
+            numclusters = clusternum - file->clusternum;
+            start = -1; /* don't add to the map from here */
         }
 
         for (i=0; i<numclusters; i++) {
@@ -2419,6 +3324,8 @@ int fat_seek(struct fat_file *file, unsigned long seeksector )
                        "(sector %ld, cluster %ld)\n", seeksector, i);
                 return -1;
             }
+            if (start >= 0)
+                extent_record(file, start + i + 1, cluster);
         }
 
         sector = cluster2sec(IF_MV2(fat_bpb,) cluster) + sectornum;
@@ -2473,6 +3380,167 @@ int fat_opendir(IF_MV2(int volume,)
     return 0;
 }
 
+#ifdef FAT_EXFAT
+static unsigned short exfat_entry_checksum(unsigned short sum,
+                                           const unsigned char *ent,
+                                           bool primary)
+{
+    int i;
+
+    for (i = 0; i < DIR_ENTRY_SIZE; i++)
+    {
+        /* the checksum of the set is stored in the primary entry */
+        if (primary && (i == EXFATDIR_SETCHECKSUM ||
+                        i == EXFATDIR_SETCHECKSUM + 1))
+            continue;
+        sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + ent[i];
+    }
+    return sum;
+}
+
+/* exFAT files are a set of entries: a file entry with the attributes and
+ * time stamps, a stream entry with the size and the first cluster, and the
+ * name in UTF-16 spread over as many name entries as it needs. The set is
+ * only used if it is complete and its checksum is right. */
+static int exfat_getnext(struct fat_dir *dir, struct fat_direntry *entry)
+{
+    int remaining = 0;  /* secondary entries of the set still to come */
+    int namelen = 0;    /* characters, from the stream entry */
+    int namepos = 0;    /* characters of the name seen so far */
+    bool stream = false;
+    unsigned short checksum = 0, setchecksum = 0;
+    unsigned long validlen = 0, datalen = 0;
+    unsigned char flags = 0;
+    int rc;
+
+    dir->entrycount = 0;
+
+    while (1)
+    {
+        const unsigned char *ent;
+        unsigned char type;
+
+        if ( !(dir->entry % DIR_ENTRIES_PER_SECTOR) || !dir->sector )
+        {
+            rc = fat_readwrite(&dir->file, 1, dir->sectorcache, false);
+            if (rc == 0) {
+                /* eof */
+                entry->name[0] = 0;
+                return 0;
+            }
+            if (rc < 0) {
+                DEBUGF( "exfat_getnext() - Couldn't read dir"
+                        " (error code %d)\n", rc);
+                return rc * 10 - 1;
+            }
+            dir->sector = dir->file.lastsector;
+        }
+
+        ent = dir->sectorcache +
+              (dir->entry % DIR_ENTRIES_PER_SECTOR) * DIR_ENTRY_SIZE;
+        type = ent[0];
+        dir->entry++;
+
+        if (type == EXFAT_ENTRY_EOD) {
+            /* last entry */
+            entry->name[0] = 0;
+            dir->entrycount = 0;
+            return 0;
+        }
+
+        if (type == EXFAT_ENTRY_FILE) {
+            /* start of a new set, drops any incomplete one */
+            remaining = ent[EXFATDIR_SECONDARYCOUNT];
+            if (remaining < 2 || remaining > EXFAT_MAX_SECONDARY) {
+                remaining = 0;
+                continue;
+            }
+            setchecksum = BYTES2INT16(ent, EXFATDIR_SETCHECKSUM);
+            checksum = exfat_entry_checksum(0, ent, true);
+            dir->entrycount = 1;
+            stream = false;
+            namelen = namepos = 0;
+
+            /* the time stamps are a FAT date and time in one word */
+            entry->attr = BYTES2INT16(ent, EXFATDIR_ATTR) &
+                          FAT_ATTR_LONG_NAME_MASK & ~FAT_ATTR_VOLUME_ID;
+            entry->crttimetenth = MIN(ent[EXFATDIR_CRT10MS], 199);
+            entry->crttime = BYTES2INT16(ent, EXFATDIR_CRTTIME);
+            entry->crtdate = BYTES2INT16(ent, EXFATDIR_CRTTIME + 2);
+            entry->wrttime = BYTES2INT16(ent, EXFATDIR_WRTTIME);
+            entry->wrtdate = BYTES2INT16(ent, EXFATDIR_WRTTIME + 2);
+            entry->lstaccdate = BYTES2INT16(ent, EXFATDIR_LSTACCTIME + 2);
+            continue;
+        }
+
+        /* anything but a secondary entry in use ends the set */
+        if (!remaining ||
+            (type & EXFAT_ENTRY_SECONDARY) != EXFAT_ENTRY_SECONDARY) {
+            remaining = 0;
+            continue;
+        }
+
+        checksum = exfat_entry_checksum(checksum, ent, false);
+        dir->entrycount++;
+        remaining--;
+
+        if (type == EXFAT_ENTRY_STREAM && dir->entrycount == 2) {
+            stream = true;
+            flags = ent[EXFATSTREAM_FLAGS];
+            namelen = ent[EXFATSTREAM_NAMELEN];
+            validlen = BYTES2INT32(ent, EXFATSTREAM_VALIDLEN);
+            datalen = BYTES2INT32(ent, EXFATSTREAM_DATALEN);
+            entry->firstcluster = BYTES2INT32(ent, EXFATSTREAM_FSTCLUS);
+            /* sizes are 32 bit here, larger files are left out */
+            if (BYTES2INT32(ent, EXFATSTREAM_VALIDLEN + 4) ||
+                BYTES2INT32(ent, EXFATSTREAM_DATALEN + 4) ||
+                validlen > LONG_MAX || datalen > LONG_MAX)
+                stream = false;
+        }
+        else if (type == EXFAT_ENTRY_NAME && namepos < namelen) {
+            int n = MIN(EXFATNAME_CHARS, namelen - namepos);
+            memcpy(dir->longname + namepos * 2, ent + EXFATNAME_POS, n * 2);
+            namepos += n;
+        }
+
+        if (remaining)
+            continue;
+
+        if (checksum != setchecksum || !stream || !namelen ||
+            namepos < namelen) {
+            logf("exfat warning: bad entry set");
+            continue;
+        }
+
+        /* convert the name to utf8, skip the file if it doesn't fit */
+        unsigned char *utf8 = entry->name;
+        int i;
+        for (i = 0; i < namelen; i++) {
+            unsigned short ucs = dir->longname[i * 2] |
+                                 (dir->longname[i * 2 + 1] << 8);
+            /* 4 is the maximum size of a UTF8 encoded character in rockbox */
+            if (utf8 - entry->name + 4 >= FAT_FILENAME_BYTES)
+                break;
+            utf8 = utf8encode(ucs, utf8);
+        }
+        *utf8 = 0;
+        if (i < namelen) {
+            logf("exfat warning: name too long");
+            continue;
+        }
+
+        /* a file is only defined up to its valid data length */
+        entry->filesize = (entry->attr & FAT_ATTR_DIRECTORY) ? datalen
+                                                             : validlen;
+        if (flags & EXFATSTREAM_NOFATCHAIN)
+            entry->attr |= FAT_ATTR_CONTIGUOUS;
+
+        logf("exFAT: %s", entry->name);
+        return 0;
+    }
+}
+#endif /* FAT_EXFAT */
+
 int fat_getnext(struct fat_dir *dir, struct fat_direntry *entry)
 {
     bool done = false;
@@ -2488,6 +3556,11 @@ int fat_getnext(struct fat_dir *dir, struct fat_direntry *entry)
     /* The long entries are expected to be in order, so remember the last ordinal */
     int last_long_ord = 0;
 
+#ifdef FAT_EXFAT
+    if (is_exfat(IF_MV(dir->file.volume)))
+        return exfat_getnext(dir, entry);
+#endif
+
     dir->entrycount = 0;
 
     while(!done)
@@ -108,6 +108,7 @@ void ICODE_ATTR lcd_mono_bitmap_part(const unsigned char *src, int src_x,
     src += stride * (src_y >> 3) + src_x; /* move starting point */
     src_y  &= 7;
     src_end = src + width;
+    lcd_mark_dirty(x, y, width, height);
     dst_col = LCDADDR(x, y);
     
 
@@ -285,6 +286,29 @@ static inline unsigned blend_color(unsigned c, unsigned a)
     return blend_two_colors(c, current_vp->fg_pattern, a);
 }
 
+/* Drawing solid over a plain background, every alpha value always gives the
+ * same colour, so they are blended once for each fg/bg pair */
+static fb_data alpha_blend_table[ALPHA_COLOR_LOOKUP_SIZE + 1];
+static unsigned alpha_blend_fg, alpha_blend_bg;
+static bool alpha_blend_valid = false;
+
+static const fb_data *alpha_blend_lookup(void)
+{
+    unsigned fg = current_vp->fg_pattern;
+    unsigned bg = current_vp->bg_pattern;
+    unsigned a;
+
+    if (!alpha_blend_valid || fg != alpha_blend_fg || bg != alpha_blend_bg)
+    {
+        for (a = 0; a <= ALPHA_COLOR_LOOKUP_SIZE; a++)
+            alpha_blend_table[a] = blend_two_colors(bg, fg, a);
+        alpha_blend_fg = fg;
+        alpha_blend_bg = bg;
+        alpha_blend_valid = true;
+    }
+    return alpha_blend_table;
+}
+
 void ICODE_ATTR lcd_alpha_bitmap_part(const unsigned char *src, int src_x,
                                       int src_y, int stride, int x, int y,
                                       int width, int height)
@@ -357,6 +381,11 @@ void ICODE_ATTR lcd_alpha_bitmap_part(const unsigned char *src, int src_x,
         dmask = ~dmask;
     }
 
+    const fb_data *blend_table = NULL;
+    if (drmode == DRMODE_SOLID && !lcd_backdrop)
+        blend_table = alpha_blend_lookup();
+
+    lcd_mark_dirty(x, y, width, height);
     dst_row = LCDADDR(x, y);
 
     int col, row = height;
@@ -477,8 +506,7 @@ void ICODE_ATTR lcd_alpha_bitmap_part(const unsigned char *src, int src_x,
                 {
                     do
                     {
-                        *dst = blend_color(current_vp->bg_pattern,
-                                        data & ALPHA_COLOR_LOOKUP_SIZE );
+                        *dst = blend_table[data & ALPHA_COLOR_LOOKUP_SIZE];
                         dst += COL_INC;
                         UPDATE_SRC_ALPHA;
                     }
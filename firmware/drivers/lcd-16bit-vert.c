@@ -74,6 +74,10 @@ static struct viewport* current_vp IDATA_ATTR = &default_vp;
 struct viewport* current_vp IDATA_ATTR = &default_vp;
 #endif
 
+/* Drawing primitives record what they touch for lcd_update_dirty() */
+#define LCD_DIRTY_TRACKING
+static void lcd_mark_dirty(int x, int y, int width, int height);
+
 /* LCD init */
 void lcd_init(void)
 {
@@ -273,6 +277,8 @@ void lcd_clear_viewport(void)
 {
     fb_data *dst, *dst_end;
 
+    lcd_mark_dirty(current_vp->x, current_vp->y,
+                   current_vp->width, current_vp->height);
     dst = LCDADDR(current_vp->x, current_vp->y);
     dst_end = dst + current_vp->width * LCD_HEIGHT;
 
@@ -340,7 +346,10 @@ void lcd_drawpixel(int x, int y)
         && ((unsigned)y < (unsigned)LCD_HEIGHT)
 #endif
         )
+    {
+        lcd_mark_dirty(current_vp->x+x, current_vp->y+y, 1, 1);
         lcd_fastpixelfuncs[current_vp->drawmode](LCDADDR(current_vp->x+x, current_vp->y+y));
+    }
 }
 
 /* Draw a line */
@@ -391,6 +400,9 @@ void lcd_drawline(int x1, int y1, int x2, int y2)
     }
     numpixels++; /* include endpoints */
 
+    lcd_mark_dirty(current_vp->x + MIN(x1, x2), current_vp->y + MIN(y1, y2),
+                   deltax + 1, deltay + 1);
+
     if (x1 > x2)
     {
         xinc1 = -xinc1;
@@ -478,6 +490,7 @@ void lcd_hline(int x1, int x2, int y)
         x2 = LCD_WIDTH-1;
 #endif
 
+    lcd_mark_dirty(x1, y, x2 - x1 + 1, 1);
     dst = LCDADDR(x1 , y );
     dst_end = dst + (x2 - x1) * LCD_HEIGHT;
 
@@ -563,6 +576,7 @@ void lcd_vline(int x, int y1, int y2)
     if (fillopt == OPT_NONE && current_vp->drawmode != DRMODE_COMPLEMENT)
         return;
 
+    lcd_mark_dirty(x, y1, 1, y2 - y1 + 1);
     dst = LCDADDR(x, y1);
 
     switch (fillopt)
@@ -681,6 +695,7 @@ void lcd_fillrect(int x, int y, int width, int height)
     if (fillopt == OPT_NONE && current_vp->drawmode != DRMODE_COMPLEMENT)
         return;
 
+    lcd_mark_dirty(x, y, width, height);
     dst = LCDADDR(x, y);
     dst_end = dst + width * LCD_HEIGHT;
 
@@ -774,6 +789,7 @@ void ICODE_ATTR lcd_bitmap_part(const fb_data *src, int src_x, int src_y,
 #endif
 
     src += stride * src_x + src_y; /* move starting point */
+    lcd_mark_dirty(x, y, width, height);
     dst = LCDADDR(x, y);
     dst_end = dst + width * LCD_HEIGHT;
 
@@ -856,6 +872,7 @@ void ICODE_ATTR lcd_bitmap_transparent_part(const fb_data *src, int src_x,
 #endif
 
     src += stride * src_x + src_y; /* move starting point */
+    lcd_mark_dirty(x, y, width, height);
     dst = LCDADDR(x, y);
     dst_end = dst + width * LCD_HEIGHT;
 
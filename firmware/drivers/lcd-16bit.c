@@ -70,6 +70,10 @@ static struct viewport default_vp =
 
 static struct viewport* current_vp IDATA_ATTR = &default_vp;
 
+/* Drawing primitives record what they touch for lcd_update_dirty() */
+#define LCD_DIRTY_TRACKING
+static void lcd_mark_dirty(int x, int y, int width, int height);
+
 /* LCD init */
 void lcd_init(void)
 {
@@ -269,6 +273,8 @@ void lcd_clear_viewport(void)
 {
     fb_data *dst, *dst_end;
 
+    lcd_mark_dirty(current_vp->x, current_vp->y,
+                   current_vp->width, current_vp->height);
     dst = LCDADDR(current_vp->x, current_vp->y);
     dst_end = dst + current_vp->height * LCD_WIDTH;
 
@@ -336,7 +342,10 @@ void lcd_drawpixel(int x, int y)
         && ((unsigned)y < (unsigned)LCD_HEIGHT)
 #endif
         )
+    {
+        lcd_mark_dirty(current_vp->x+x, current_vp->y+y, 1, 1);
         lcd_fastpixelfuncs[current_vp->drawmode](LCDADDR(current_vp->x+x, current_vp->y+y));
+    }
 }
 
 /* Draw a line */
@@ -387,6 +396,9 @@ void lcd_drawline(int x1, int y1, int x2, int y2)
     }
     numpixels++; /* include endpoints */
 
+    lcd_mark_dirty(current_vp->x + MIN(x1, x2), current_vp->y + MIN(y1, y2),
+                   deltax + 1, deltay + 1);
+
     if (x1 > x2)
     {
         xinc1 = -xinc1;
@@ -502,6 +514,7 @@ void lcd_hline(int x1, int x2, int y)
     if (fillopt == OPT_NONE && current_vp->drawmode != DRMODE_COMPLEMENT)
         return;
 
+    lcd_mark_dirty(x1, y, x2 - x1 + 1, 1);
     dst = LCDADDR(x1, y);
 
     switch (fillopt)
@@ -570,6 +583,7 @@ void lcd_vline(int x, int y1, int y2)
         y2 = LCD_HEIGHT-1;
 #endif
 
+    lcd_mark_dirty(x, y1, 1, y2 - y1 + 1);
     dst = LCDADDR(x , y1);
     dst_end = dst + (y2 - y1) * LCD_WIDTH;
 
@@ -677,6 +691,7 @@ void lcd_fillrect(int x, int y, int width, int height)
     if (fillopt == OPT_NONE && current_vp->drawmode != DRMODE_COMPLEMENT)
         return;
 
+    lcd_mark_dirty(x, y, width, height);
     dst = LCDADDR(x, y);
     dst_end = dst + height * LCD_WIDTH;
 
@@ -770,6 +785,7 @@ void ICODE_ATTR lcd_bitmap_part(const fb_data *src, int src_x, int src_y,
 #endif
     
     src += stride * src_y + src_x; /* move starting point */
+    lcd_mark_dirty(x, y, width, height);
     dst = LCDADDR(x, y);
 
     do
@@ -850,6 +866,7 @@ void ICODE_ATTR lcd_bitmap_transparent_part(const fb_data *src, int src_x,
 #endif
 
     src += stride * src_y + src_x; /* move starting point */
+    lcd_mark_dirty(x, y, width, height);
     dst = LCDADDR(x, y);
 
 #ifdef CPU_ARM
@@ -81,6 +81,99 @@ static void lcd_gradient_rect(int x1, int x2, int y, unsigned h,
 }
 #endif
 
+#ifdef LCD_DIRTY_TRACKING
+/* Areas drawn to since the last LCDFN(update_dirty)(), one bounding box per
+ * viewport so that small changes in distant viewports don't merge into one
+ * big update. When the slots run out the last one keeps growing. */
+#define LCD_DIRTY_SLOTS 8
+
+static struct {
+    const struct viewport *vp;
+    short x1, y1, x2, y2; /* x2 and y2 are exclusive */
+} LCDFN(dirty)[LCD_DIRTY_SLOTS];
+static int LCDFN(dirty_count) = 0;
+
+/* x and y are absolute screen coordinates */
+static void LCDFN(mark_dirty)(int x, int y, int width, int height)
+{
+    int x2 = x + width;
+    int y2 = y + height;
+    int i;
+
+    if (x < 0)
+        x = 0;
+    if (y < 0)
+        y = 0;
+    if (x2 > LCDM(WIDTH))
+        x2 = LCDM(WIDTH);
+    if (y2 > LCDM(HEIGHT))
+        y2 = LCDM(HEIGHT);
+    if (x >= x2 || y >= y2)
+        return;
+
+    /* the viewport drawn to last is nearly always the one at the end */
+    for (i = LCDFN(dirty_count) - 1; i >= 0; i--)
+    {
+        if (LCDFN(dirty)[i].vp == current_vp)
+            break;
+    }
+
+    if (i < 0)
+    {
+        if (LCDFN(dirty_count) < LCD_DIRTY_SLOTS)
+        {
+            i = LCDFN(dirty_count)++;
+            LCDFN(dirty)[i].vp = current_vp;
+            LCDFN(dirty)[i].x1 = x;
+            LCDFN(dirty)[i].y1 = y;
+            LCDFN(dirty)[i].x2 = x2;
+            LCDFN(dirty)[i].y2 = y2;
+            return;
+        }
+        i = LCD_DIRTY_SLOTS - 1;
+    }
+
+    if (x < LCDFN(dirty)[i].x1)
+        LCDFN(dirty)[i].x1 = x;
+    if (y < LCDFN(dirty)[i].y1)
+        LCDFN(dirty)[i].y1 = y;
+    if (x2 > LCDFN(dirty)[i].x2)
+        LCDFN(dirty)[i].x2 = x2;
+    if (y2 > LCDFN(dirty)[i].y2)
+        LCDFN(dirty)[i].y2 = y2;
+}
+
+/* Push only the areas drawn to since the last call to the display. Falls
+ * back to a full update when most of the screen changed anyway. */
+void LCDFN(update_dirty)(void)
+{
+    int i, area = 0;
+
+    for (i = 0; i < LCDFN(dirty_count); i++)
+        area += (LCDFN(dirty)[i].x2 - LCDFN(dirty)[i].x1) *
+                (LCDFN(dirty)[i].y2 - LCDFN(dirty)[i].y1);
+
+    if (area >= LCDM(WIDTH) * LCDM(HEIGHT) / 4 * 3)
+    {
+        LCDFN(update)();
+    }
+    else
+    {
+        for (i = 0; i < LCDFN(dirty_count); i++)
+            LCDFN(update_rect)(LCDFN(dirty)[i].x1, LCDFN(dirty)[i].y1,
+                               LCDFN(dirty)[i].x2 - LCDFN(dirty)[i].x1,
+                               LCDFN(dirty)[i].y2 - LCDFN(dirty)[i].y1);
+    }
+    LCDFN(dirty_count) = 0;
+}
+#else
+/* No tracking in this driver, everything may have changed */
+void LCDFN(update_dirty)(void)
+{
+    LCDFN(update)();
+}
+#endif /* LCD_DIRTY_TRACKING */
+
 /*
  * draws the borders of the current viewport
  **/
@@ -125,10 +218,26 @@ static void LCDFN(putsxyofs)(int x, int y, int ofs, const unsigned char *str)
         }
     }
 
+    ucs = bidi_l2v(str, 1);
+
+    /* most strings come pre-rendered as a whole */
+    {
+        int w;
+        const unsigned char *bits = font_get_string_bits(pf, ucs, &w);
+        if (bits)
+        {
+            if (ofs < w)
+                LCDFN(mono_bitmap_part)(bits, ofs, 0, w, x, y,
+                                        w - ofs, pf->height);
+            return;
+        }
+    }
+    font_prefetch_glyphs(pf, ucs);
+
     rtl_next_non_diac_width = 0;
     last_non_diacritic_width = 0;
     /* Mark diacritic and rtl flags for each character */
-    for (ucs = bidi_l2v(str, 1); *ucs; ucs++)
+    for (; *ucs; ucs++)
     {
         bool is_rtl, is_diac;
         const unsigned char *bits;
@@ -115,6 +115,11 @@ void lcd_update_viewport(void)
     lcd_update();
 }
 
+void lcd_update_dirty(void)
+{
+    lcd_update();
+}
+
 /** parameter handling **/
 
 int lcd_getwidth(void)
@@ -1049,6 +1049,18 @@ Lyre prototype 1 */
 
 #if defined(HAVE_DIRCACHE) && (CONFIG_PLATFORM & PLATFORM_NATIVE)
 #define HAVE_IO_PRIORITY
+/* storage requests wait for their turn on a semaphore */
+#ifndef HAVE_SEMAPHORE_OBJECTS
+#define HAVE_SEMAPHORE_OBJECTS
+#endif
+#endif
+
+#if (CONFIG_CODEC == SWCODEC) && !defined(BOOTLOADER) && !defined(__PCTOOL__)
+/* file reads can be handed to a worker thread, see async_io.h */
+#define HAVE_ASYNC_IO
+#ifndef HAVE_SEMAPHORE_OBJECTS
+#define HAVE_SEMAPHORE_OBJECTS
+#endif
 #endif
 
 #if defined(CPU_COLDIRE) || CONFIG_CPU == IMX31L
@@ -44,7 +44,7 @@
 struct fat_direntry
 {
     unsigned char name[FAT_FILENAME_BYTES]; /* UTF-8 encoded name plus \0 */
-    unsigned short attr;            /* Attributes */
+    unsigned int attr;              /* Attributes */
     unsigned char crttimetenth;     /* Millisecond creation
                                        time stamp (0-199) */
     unsigned short crttime;         /* Creation time */
@@ -63,6 +63,32 @@ struct fat_direntry
 #define FAT_ATTR_DIRECTORY   0x10
 #define FAT_ATTR_ARCHIVE     0x20
 #define FAT_ATTR_VOLUME      0x40 /* this is a volume, not a real directory */
+/* Not stored on disk: an exFAT file whose clusters are all in one run and
+   don't have a FAT chain. Kept clear of the bits tree.c uses for types. */
+#define FAT_ATTR_CONTIGUOUS  0x10000
+
+/* Number of contiguous cluster runs remembered per open file. Files written
+   to a reasonably unfragmented volume need only one or two, the map simply
+   stops growing when it is full and the rest of the chain is walked. */
+#ifndef FAT_EXTENTS
+#define FAT_EXTENTS 8
+#endif
+
+struct fat_extent
+{
+    long fileclust;       /* index of the first cluster of the run in the file */
+    long cluster;         /* first cluster of the run on the volume */
+    long count;           /* number of clusters in the run */
+};
+
+/* Map of the start of a file's cluster chain, filled in as the chain is
+   walked so that seeking back into the known part needs no FAT lookups */
+struct fat_extent_cache
+{
+    int used;             /* number of valid entries in run[] */
+    long known;           /* file clusters 0..known-1 are mapped */
+    struct fat_extent run[FAT_EXTENTS];
+};
 
 struct fat_file
 {
@@ -75,6 +101,9 @@ struct fat_file
     unsigned int direntries; /* number of dir entries used by this file */
     long dircluster;      /* first cluster of dir */
     bool eof;
+    struct fat_extent_cache *extents; /* optional cluster map, may be NULL */
+    long contiguous;      /* clusters in the run if the file has no FAT
+                             chain (exFAT), else 0 */
 #ifdef HAVE_MULTIVOLUME
     int volume;          /* file resides on which volume */
 #endif
@@ -117,12 +146,17 @@ extern int fat_open(IF_MV2(int volume,)
 extern int fat_create_file(const char* name,
                            struct fat_file* ent,
                            struct fat_dir* dir);
+extern void fat_set_extent_cache(struct fat_file *ent,
+                                 struct fat_extent_cache *cache);
+extern void fat_set_contiguous(struct fat_file *ent, int attr,
+                               unsigned long size);
 extern long fat_readwrite(struct fat_file *ent, long sectorcount, 
                          void* buf, bool write );
 extern int fat_closewrite(struct fat_file *ent, long size, int attr);
 extern int fat_seek(struct fat_file *ent, unsigned long sector );
 extern int fat_remove(struct fat_file *ent);
 extern int fat_truncate(const struct fat_file *ent);
+extern int fat_preallocate(struct fat_file *ent, long clusters);
 extern int fat_rename(struct fat_file* file, 
                       struct fat_dir* dir,
                       const unsigned char* newname,
@@ -34,6 +34,56 @@ int strip_volume(const char* name, char* namecopy);
 #ifndef __PCTOOL__
 bool file_exists(const char *file);
 bool dir_exists(const char *path);
+
+/* Tree traversal. Walks everything below a directory, reading the dircache
+ * when it is available and the file system otherwise. */
+#define TREEWALK_BREADTH_FIRST 0x01 /* all of a level before the next one */
+#define TREEWALK_SKIP_FILES    0x02 /* don't report files */
+#define TREEWALK_SKIP_DIRS     0x04 /* don't report directories (still
+                                       walked into) */
+
+#define TREEWALK_MAX_DEPTH     16   /* directory levels walked at most */
+
+struct treewalk {
+    /* May be changed by the caller after treewalk_open(). The filter is
+       called for every entry, those it refuses are neither reported nor
+       walked into. */
+    int max_depth;
+    bool (*filter)(const struct treewalk *walk, void *data);
+    void *filter_data;
+
+    /* Current entry, valid until the next call to treewalk_next() */
+    const char *name;
+    struct dirinfo info;
+    int depth;                  /* 0 for the content of the root */
+
+    /* Set once part of the tree had to be left out: a directory that
+       couldn't be opened, a path too long, more than TREEWALK_MAX_DEPTH
+       levels, a full breadth-first queue or a dircache rebuilt under a
+       cached walk (which ends it). What was reported is still valid. */
+    bool incomplete;
+
+    /* For internal use only. */
+    unsigned flags;
+    bool descend;               /* current entry will be walked into */
+    char *queue;                /* pending directories (breadth-first) */
+    size_t queue_size, queue_head, queue_tail;
+#ifdef HAVE_DIRCACHE
+    bool cached;
+    int root_id, dir_id, id;
+#endif
+    int open_count;             /* file system directories opened */
+    DIR *dirs[TREEWALK_MAX_DEPTH];
+    size_t dir_len[TREEWALK_MAX_DEPTH];
+    char path[MAX_PATH];        /* directory being read */
+};
+
+int treewalk_open(struct treewalk *walk, const char *path, unsigned flags,
+                  void *buf, size_t bufsize);
+bool treewalk_next(struct treewalk *walk);
+void treewalk_skip_dir(struct treewalk *walk);
+size_t treewalk_get_path(const struct treewalk *walk, char *buf, size_t size);
+void treewalk_close(struct treewalk *walk);
 #endif
 extern struct dirinfo dir_get_info(DIR* parent, struct dirent *entry);
 
@@ -84,6 +84,10 @@ enum {
 /* loadable font magic and version #*/
 #define VERSION "RB12"
 
+/* glyphs looked up directly, without searching the glyph cache */
+#define FONT_ATLAS_FIRST 0x20
+#define FONT_ATLAS_SIZE  (0x100 - FONT_ATLAS_FIRST)
+
 /* builtin C-based proportional/fixed font structure */
 /* based on The Microwindows Project http://microwindows.org */
 struct font {
@@ -111,6 +115,7 @@ struct font {
     uint32_t file_width_offset;    /* offset to file width data    */
     uint32_t file_offset_offset;   /* offset to file offset data   */
     int long_offset;
+    short atlas[FONT_ATLAS_SIZE];  /* cache handles of latin-1 glyphs */
 #endif    
     
 };
@@ -131,6 +136,10 @@ void font_reset(struct font *pf);
 int font_getstringsize(const unsigned char *str, int *w, int *h, int fontnumber);
 int font_get_width(struct font* ft, unsigned short ch);
 const unsigned char * font_get_bits(struct font* ft, unsigned short ch);
+void font_prefetch_glyphs(struct font* pf, const unsigned short *ucs);
+const unsigned char * font_get_string_bits(struct font* pf,
+                                           const unsigned short *ucs,
+                                           int *width);
 void glyph_cache_save(struct font* pf);
 
 #else /* HAVE_LCD_BITMAP */
@@ -151,6 +151,7 @@ extern void lcd_remote_update(void);
 extern void lcd_remote_update_rect(int x, int y, int width, int height);
 extern void lcd_remote_update_viewport(void);
 extern void lcd_remote_update_viewport_rect(int x, int y, int width, int height);
+extern void lcd_remote_update_dirty(void);
 
 extern void lcd_remote_set_invert_display(bool yesno);
 extern void lcd_remote_set_flip(bool yesno);
@@ -188,6 +188,8 @@ extern int  lcd_getstringsize(const unsigned char *str, int *w, int *h);
 extern void lcd_set_viewport(struct viewport* vp);
 extern void lcd_update(void);
 extern void lcd_update_viewport(void);
+/* update only what was drawn to since the last call */
+extern void lcd_update_dirty(void);
 extern void lcd_clear_viewport(void);
 extern void lcd_clear_display(void);
 extern void lcd_putsxy(int x, int y, const unsigned char *string);
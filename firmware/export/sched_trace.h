@@ -0,0 +1,93 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2012 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+#ifndef SCHED_TRACE_H
+#define SCHED_TRACE_H
+#include <config.h>
+
+#ifdef DO_SCHED_TRACE
+
+#include "thread.h"
+#include "rbpaths.h"
+
+/* The scheduler tracer keeps the last SCHED_TRACE_EVENTS context switches,
+ * blocking calls, CPU boosts and storage transfers in a ring buffer, which
+ * can be written out in the Chrome trace event format and then opened in
+ * chrome://tracing or Perfetto to see which thread ran when. */
+
+#define SCHED_TRACE_FILE    ROCKBOX_DIR "/sched_trace.json"
+
+enum sched_event
+{
+    SCHED_EVENT_RUN = 0,    /* thread gets the CPU */
+    SCHED_EVENT_STOP,       /* thread gives it up */
+    SCHED_EVENT_BLOCK,      /* thread is about to wait, arg says for what */
+    SCHED_EVENT_BOOST,      /* boost count changed to arg */
+    SCHED_EVENT_IO_READ,    /* transfer started: data is the sector and */
+    SCHED_EVENT_IO_WRITE,   /* arg the count, or the file and the byte */
+                            /* count in the simulator */
+    SCHED_EVENT_IO_DONE,    /* transfer finished */
+};
+
+enum sched_block
+{
+    SCHED_BLOCK_SLEEP = 0,
+    SCHED_BLOCK_QUEUE,
+    SCHED_BLOCK_QUEUE_SEND, /* waiting for the reply */
+    SCHED_BLOCK_MUTEX,
+    SCHED_BLOCK_SEMAPHORE,
+    SCHED_BLOCK_THREAD,     /* waiting for another thread to exit */
+};
+
+void sched_trace(unsigned int event, unsigned int slot, unsigned int arg,
+                 unsigned long data);
+
+/* Write the buffer to path and start over. Returns < 0 on error */
+int sched_trace_dump(const char *path);
+
+#define SCHED_TRACE_SLOT(thread) ((thread)->id & THREAD_ID_SLOT_MASK)
+#define SCHED_TRACE_SELF() (thread_self() & THREAD_ID_SLOT_MASK)
+
+#define SCHED_TRACE_RUN(thread) \
+    sched_trace(SCHED_EVENT_RUN, SCHED_TRACE_SLOT(thread), 0, 0)
+#define SCHED_TRACE_STOP(thread) \
+    sched_trace(SCHED_EVENT_STOP, SCHED_TRACE_SLOT(thread), 0, 0)
+#define SCHED_TRACE_BLOCK(thread, why) \
+    sched_trace(SCHED_EVENT_BLOCK, SCHED_TRACE_SLOT(thread), (why), 0)
+#define SCHED_TRACE_BOOST(count) \
+    sched_trace(SCHED_EVENT_BOOST, SCHED_TRACE_SELF(), (count), 0)
+#define SCHED_TRACE_IO(write, start, count) \
+    sched_trace((write) ? SCHED_EVENT_IO_WRITE : SCHED_EVENT_IO_READ, \
+                SCHED_TRACE_SELF(), (count), (start))
+#define SCHED_TRACE_IO_DONE() \
+    sched_trace(SCHED_EVENT_IO_DONE, SCHED_TRACE_SELF(), 0, 0)
+
+#else /* !DO_SCHED_TRACE */
+
+#define SCHED_TRACE_RUN(thread)
+#define SCHED_TRACE_STOP(thread)
+#define SCHED_TRACE_BLOCK(thread, why)
+#define SCHED_TRACE_BOOST(count)
+#define SCHED_TRACE_IO(write, start, count)
+#define SCHED_TRACE_IO_DONE()
+
+#endif /* DO_SCHED_TRACE */
+
+#endif /* SCHED_TRACE_H */
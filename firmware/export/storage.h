@@ -233,4 +233,27 @@ bool storage_present(int drive);
 
 int storage_read_sectors(IF_MD2(int drive,) unsigned long start, int count, void* buf);
 int storage_write_sectors(IF_MD2(int drive,) unsigned long start, int count, const void* buf);
+
+#ifdef HAVE_IO_PRIORITY
+/* Transfers are counted separately for threads doing background work */
+enum
+{
+    STORAGE_CLASS_FOREGROUND = 0,
+    STORAGE_CLASS_BACKGROUND,
+    STORAGE_NUM_CLASSES
+};
+
+struct storage_queue_stats
+{
+    int depth;                   /* requests waiting right now */
+    int max_depth;               /* most requests ever waiting at once */
+    unsigned long late;          /* requests served because they were late */
+    unsigned long requests[STORAGE_NUM_CLASSES]; /* transfers done */
+    unsigned long waited[STORAGE_NUM_CLASSES];   /* of those, had to queue */
+    unsigned long wait_ticks[STORAGE_NUM_CLASSES]; /* total time queued */
+    long max_wait[STORAGE_NUM_CLASSES];          /* longest time queued */
+};
+
+void storage_get_queue_stats(IF_MD2(int drive,) struct storage_queue_stats *stats);
+#endif
 #endif
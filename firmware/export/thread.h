@@ -64,10 +64,11 @@
 
 #if CONFIG_CODEC == SWCODEC
 
+/* includes the async I/O worker */
 #ifdef HAVE_RECORDING
-#define BASETHREADS  17
+#define BASETHREADS  18
 #else
-#define BASETHREADS  16
+#define BASETHREADS  17
 #endif
 
 #else
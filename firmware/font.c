@@ -62,7 +62,7 @@
 #ifndef BOOTLOADER
 /* Font cache includes */
 #include "font_cache.h"
-#include "lru.h"
+#include "core_alloc.h"
 #endif
 
 #ifndef O_BINARY
@@ -87,6 +87,42 @@ static unsigned char remote_buf[REMOTE_FONT_SIZE] CACHEALIGN_ATTR;
 /* system font table, in order of FONT_xxx definition */
 static struct font* sysfonts[MAXFONTS] = { &sysfont, &font_ui, NULL};
 
+/* Pre-rendered strings, kept in one movable buflib allocation used as a
+ * ring. Each strip holds the string's char codes followed by its glyphs
+ * composed into one bitmap in the 1-bit glyph format, so that drawing or
+ * scrolling a string is a single blit. */
+#if MEMORYSIZE > 2
+#define STRING_CACHE_SIZE    (16*1024)
+#else
+#define STRING_CACHE_SIZE    (4*1024)
+#endif
+#define STRING_CACHE_ENTRIES 32
+#define STRING_CACHE_MAXLEN  128
+
+static struct string_cache_entry {
+    const struct font *pf;   /* NULL if unused */
+    unsigned hash;
+    unsigned short len;      /* in chars */
+    unsigned short width;    /* in pixels */
+    int offset;              /* into the ring */
+    int size;
+} string_cache[STRING_CACHE_ENTRIES];
+static int string_cache_handle = 0;
+static int string_cache_pos = 0;    /* where the next strip goes */
+static int string_cache_next = 0;   /* entry to be replaced next */
+static bool string_cache_busy = false;
+
+/* forget the strips of a font that is being replaced */
+static void string_cache_flush(const struct font *pf)
+{
+    int i;
+    for (i = 0; i < STRING_CACHE_ENTRIES; i++)
+    {
+        if (string_cache[i].pf == pf)
+            string_cache[i].pf = NULL;
+    }
+}
+
 
 /* Font cache structures */
 static void cache_create(struct font* pf);
@@ -102,6 +138,10 @@ void font_init(void)
 #ifdef HAVE_REMOTE_LCD
     font_reset(&remote_font_ui);
 #endif
+    /* strings are simply drawn glyph by glyph if this fails */
+    string_cache_handle = core_alloc("font strings", STRING_CACHE_SIZE);
+    if (string_cache_handle < 0)
+        string_cache_handle = 0;
 }
 
 /* Check if we have x bytes left in the file buffer */
@@ -150,6 +190,7 @@ void font_reset(struct font *pf)
         buffer = pf->buffer_start;
         buf_size = pf->buffer_size;
     }
+    string_cache_flush(pf);
     memset(pf, 0, sizeof(struct font));
     pf->fd = -1;
     if (buffer)
@@ -466,6 +507,7 @@ void font_unload(int font_id)
     {
         if (pf->fd >= 0)
             close(pf->fd);
+        string_cache_flush(pf);
         sysfonts[font_id] = NULL;
     }
 }
@@ -540,9 +582,37 @@ static void cache_create(struct font* pf)
 {
     /* maximum size of rotated bitmap */
     int bitmap_size = glyph_bytes( pf, pf->maxwidth);
+    int i;
   
     /* Initialise cache */
     font_cache_create(&pf->cache, pf->buffer_start, pf->buffer_size, bitmap_size);
+
+    for (i = 0; i < FONT_ATLAS_SIZE; i++)
+        pf->atlas[i] = -1;
+}
+
+/*
+ * Looks up a glyph of a cached font, latin-1 ones go through the atlas
+ * instead of searching the cache
+ */
+static struct font_cache_entry* cache_get_glyph(struct font* pf,
+                                                unsigned short glyph)
+{
+    unsigned slot = glyph + pf->firstchar - FONT_ATLAS_FIRST;
+    struct font_cache_entry* p;
+
+    if (slot < FONT_ATLAS_SIZE)
+    {
+        p = font_cache_peek(&pf->cache, pf->atlas[slot], glyph);
+        if (p)
+            return p;
+    }
+
+    p = font_cache_get(&pf->cache, glyph, load_cache_entry, pf);
+
+    if (slot < FONT_ATLAS_SIZE)
+        pf->atlas[slot] = font_cache_handle(&pf->cache, p);
+    return p;
 }
 
 /*
@@ -556,7 +626,7 @@ int font_get_width(struct font* pf, unsigned short char_code)
     char_code -= pf->firstchar;
 
     return (pf->fd >= 0 && pf != &sysfont)?
-        font_cache_get(&pf->cache,char_code,load_cache_entry,pf)->width:
+        cache_get_glyph(pf, char_code)->width:
         pf->width? pf->width[char_code]: pf->maxwidth;
 }
 
@@ -571,8 +641,7 @@ const unsigned char* font_get_bits(struct font* pf, unsigned short char_code)
 
     if (pf->fd >= 0 && pf != &sysfont)
     {
-        bits =
-            (unsigned char*)font_cache_get(&pf->cache,char_code,load_cache_entry,pf)->bitmap;
+        bits = (unsigned char*)cache_get_glyph(pf, char_code)->bitmap;
     }
     else
     {
@@ -590,6 +659,141 @@ const unsigned char* font_get_bits(struct font* pf, unsigned short char_code)
 
     return bits;
 }
+
+static int ushortcmp(const void *a, const void *b)
+{
+    return ((int)(*(unsigned short*)a - *(unsigned short*)b));
+}
+
+/*
+ * Loads the glyphs of a string that aren't cached yet in one pass sorted by
+ * char code, so that the font file is read front to back instead of seeking
+ * around for every char
+ */
+#define MAX_PREFETCH 64
+void font_prefetch_glyphs(struct font* pf, const unsigned short *ucs)
+{
+    unsigned short missing[MAX_PREFETCH];
+    int count = 0, i;
+
+    if (pf->fd < 0 || pf == &sysfont)
+        return;
+
+    for (; *ucs && count < MAX_PREFETCH &&
+           count < pf->cache._capacity / 2; ucs++)
+    {
+        unsigned short glyph = *ucs;
+        if (glyph < pf->firstchar || glyph >= pf->firstchar+pf->size)
+            glyph = pf->defaultchar;
+        glyph -= pf->firstchar;
+        if (!font_cache_find(&pf->cache, glyph))
+            missing[count++] = glyph;
+    }
+
+    qsort(missing, count, sizeof(*missing), ushortcmp);
+    for (i = 0; i < count; i++)
+    {
+        if (i == 0 || missing[i] != missing[i-1])
+            cache_get_glyph(pf, missing[i]);
+    }
+}
+
+/*
+ * Returns the glyphs of a whole string (in visual order) composed into one
+ * bitmap of *width pixels, in the same format as font_get_bits(). NULL if
+ * the string can't be cached, it then has to be drawn glyph by glyph. The
+ * bitmap is only valid until the next yield.
+ */
+const unsigned char* font_get_string_bits(struct font* pf,
+                                          const unsigned short *ucs,
+                                          int *width)
+{
+    struct string_cache_entry *e;
+    unsigned char *buf, *strip;
+    unsigned hash = 0;
+    int len, w, x, bands, size, i;
+
+    /* 4-bit fonts and diacritics (which overdraw their base char) are
+     * left to the per glyph path */
+    if (!string_cache_handle || string_cache_busy || pf->depth)
+        return NULL;
+
+    for (len = 0; ucs[len]; len++)
+    {
+        if (len >= STRING_CACHE_MAXLEN || is_diacritic(ucs[len], NULL))
+            return NULL;
+        hash = hash * 31 + ucs[len];
+    }
+    if (len == 0)
+        return NULL;
+
+    buf = core_get_data(string_cache_handle);
+    for (i = 0; i < STRING_CACHE_ENTRIES; i++)
+    {
+        e = &string_cache[i];
+        if (e->pf == pf && e->hash == hash && e->len == len &&
+            !memcmp(buf + e->offset, ucs, len * sizeof(*ucs)))
+        {
+            *width = e->width;
+            return buf + e->offset + len * sizeof(*ucs);
+        }
+    }
+
+    font_prefetch_glyphs(pf, ucs);
+    for (i = 0, w = 0; i < len; i++)
+        w += font_get_width(pf, ucs[i]);
+
+    bands = (pf->height + 7) / 8;
+    size = len * sizeof(*ucs) + w * bands;
+    if (size > STRING_CACHE_SIZE / 4)
+        return NULL;
+
+    /* take the next slot and enough room in the ring, dropping whatever
+     * was there */
+    if (string_cache_pos + size > STRING_CACHE_SIZE)
+        string_cache_pos = 0;
+    for (i = 0; i < STRING_CACHE_ENTRIES; i++)
+    {
+        e = &string_cache[i];
+        if (e->pf && e->offset < string_cache_pos + size &&
+            e->offset + e->size > string_cache_pos)
+            e->pf = NULL;
+    }
+    e = &string_cache[string_cache_next];
+    string_cache_next = (string_cache_next + 1) % STRING_CACHE_ENTRIES;
+    e->pf = NULL;
+    e->offset = string_cache_pos;
+    e->size = size;
+    string_cache_pos = (string_cache_pos + size + 1) & ~1;
+
+    /* loading glyphs may read from disk and yield, during which the
+     * buffer can move and other threads may draw */
+    string_cache_busy = true;
+    for (i = 0, x = 0; i < len; i++)
+    {
+        const unsigned char *bits = font_get_bits(pf, ucs[i]);
+        int gw = font_get_width(pf, ucs[i]);
+        int b;
+
+        strip = (unsigned char*)core_get_data(string_cache_handle) +
+                e->offset + len * sizeof(*ucs);
+        for (b = 0; b < bands; b++)
+            memcpy(strip + b * w + x, bits + b * gw, gw);
+        x += gw;
+    }
+    string_cache_busy = false;
+
+    buf = core_get_data(string_cache_handle);
+    memcpy(buf + e->offset, ucs, len * sizeof(*ucs));
+    e->hash = hash;
+    e->len = len;
+    e->width = w;
+    e->pf = pf;
+
+    *width = w;
+    return buf + e->offset + len * sizeof(*ucs);
+}
+
 static int cache_fd;
 static void glyph_file_write(void* data)
 {
@@ -625,7 +829,7 @@ void glyph_cache_save(struct font* pf)
         if (cache_fd < 0)
             return;
 
-        lru_traverse(&pf->cache._lru, glyph_file_write);
+        font_cache_traverse(&pf->cache, glyph_file_write);
 
         if (cache_fd >= 0)
         {
@@ -660,19 +864,16 @@ int font_glyphs_to_bufsize(const char *path, int glyphs)
     }
     close(f.fd);
     
-    bufsize = LRU_SLOT_OVERHEAD + sizeof(struct font_cache_entry) + 
-        sizeof( unsigned short);
-    bufsize += glyph_bytes(&f, f.maxwidth);
+    /* entries are rounded up to 16 bits like font_cache_create() does */
+    bufsize = sizeof(struct font_cache_entry) + glyph_bytes(&f, f.maxwidth);
+    bufsize = (bufsize + 1) & ~1;
+    bufsize += FONT_CACHE_ENTRY_OVERHEAD;
     bufsize *= glyphs;
     if ( bufsize < FONT_HEADER_SIZE )
         bufsize = FONT_HEADER_SIZE;
     return bufsize;
 }
 
-static int ushortcmp(const void *a, const void *b)
-{
-    return ((int)(*(unsigned short*)a - *(unsigned short*)b));
-}
 static void glyph_cache_load(struct font* pf)
 {
 
@@ -784,6 +985,22 @@ const unsigned char* font_get_bits(struct font* pf, unsigned short char_code)
     return bits;
 }
 
+const unsigned char* font_get_string_bits(struct font* pf,
+                                          const unsigned short *ucs,
+                                          int *width)
+{
+    (void)pf;
+    (void)ucs;
+    (void)width;
+    return NULL;
+}
+
+void font_prefetch_glyphs(struct font* pf, const unsigned short *ucs)
+{
+    (void)pf;
+    (void)ucs;
+}
+
 #endif /* BOOTLOADER */
 
 /*
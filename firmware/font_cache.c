@@ -19,16 +19,18 @@
  ****************************************************************************/
 
 #include <string.h>
+#include <inttypes.h>
 #include "font_cache.h"
 #include "debug.h"
 
-/*******************************************************************************
- * font_cache_lru_init
- ******************************************************************************/
-static void font_cache_lru_init(void* data)
+#define ENTRY(fcache, i) \
+    ((struct font_cache_entry*)((fcache)->_entries + (fcache)->_entry_size * (i)))
+
+static inline unsigned font_cache_hash(
+    struct font_cache* fcache,
+    unsigned short char_code)
 {
-    struct font_cache_entry* p = data;
-    p->_char_code = 0xffff;   /* assume invalid char */
+    return ((uint32_t)char_code * 2654435761u) >> fcache->_hash_shift;
 }
 
 /*******************************************************************************
@@ -42,116 +44,103 @@ void font_cache_create(
 {
     int font_cache_entry_size =
         sizeof(struct font_cache_entry) + bitmap_bytes_size;
+    int table_size = 4, bits = 2;
+    int cache_size, i;
 
     /* make sure font cache entries are a multiple of 16 bits */
     if (font_cache_entry_size % 2 != 0)
         font_cache_entry_size++;
 
-    int cache_size = buf_size /
-        (font_cache_entry_size + LRU_SLOT_OVERHEAD + sizeof(short));
-
-    fcache->_size = 1;
+    /* the smallest table that is at most 3/4 full with as many entries as
+     * FONT_CACHE_ENTRY_OVERHEAD budgets for, so that probe sequences stay
+     * short */
+    cache_size = buf_size / (font_cache_entry_size + FONT_CACHE_ENTRY_OVERHEAD);
+    while (table_size < 32768 && table_size / 4 * 3 < cache_size)
+    {
+        table_size *= 2;
+        bits++;
+    }
+    /* what the table leaves over goes to more entries */
+    cache_size = (buf_size - table_size * (int)sizeof(short)) /
+                 (font_cache_entry_size + 1);
+    if (cache_size > table_size / 4 * 3)
+        cache_size = table_size / 4 * 3;
+    if (cache_size < 1)
+        cache_size = 1;
+
+    fcache->_size = 0;
     fcache->_capacity = cache_size;
-
-    /* set up index */
-    fcache->_index = buf;
-
-    /* set up lru list */
-    unsigned char* lru_buf = buf;
-    lru_buf += sizeof(short) * cache_size;
-    lru_create(&fcache->_lru, lru_buf, cache_size, font_cache_entry_size);
-
-    /* initialise cache */
-    lru_traverse(&fcache->_lru, font_cache_lru_init);
-    short i;
-    for (i = 0; i < cache_size; i++)
-        fcache->_index[i] = i; /* small cheat here */
+    fcache->_entry_size = font_cache_entry_size;
+    fcache->_hand = 0;
+    fcache->_hash_shift = 32 - bits;
+    fcache->_hash_mask = table_size - 1;
+
+    fcache->_table = buf;
+    fcache->_entries = (unsigned char*)buf + table_size * sizeof(short);
+    fcache->_referenced = fcache->_entries + cache_size * font_cache_entry_size;
+
+    for (i = 0; i < table_size; i++)
+        fcache->_table[i] = -1;
+    memset(fcache->_referenced, 0, cache_size);
 }
 
 /*******************************************************************************
- * font_cache_index_of
+ * font_cache_lookup
  ******************************************************************************/
-static int font_cache_index_of(
-           struct font_cache* fcache,
-           unsigned short char_code)
+static int font_cache_lookup(
+    struct font_cache* fcache,
+    unsigned short char_code)
 {
-    struct font_cache_entry* p;
-    int left, right, mid, c;
-    left = 0;
-    right = fcache->_size - 1;
+    unsigned slot = font_cache_hash(fcache, char_code);
+    short e;
 
-    do
+    while ((e = fcache->_table[slot]) >= 0)
     {
-        mid = (left + right) / 2;
-
-        p = lru_data(&fcache->_lru, fcache->_index[mid]);
-        c = p->_char_code - char_code;
-
-        if (c == 0)
-            return mid;
-
-        if (c < 0)
-            left = mid + 1;
-        else
-            right = mid - 1;
+        if (ENTRY(fcache, e)->_char_code == char_code)
+            return e;
+        slot = (slot + 1) & fcache->_hash_mask;
     }
-    while (left <= right);
 
     return -1;
 }
 
 /*******************************************************************************
- * font_cache_insertion_point
+ * font_cache_remove
  ******************************************************************************/
-static int font_cache_insertion_point(
-       struct font_cache* fcache,
-       unsigned short char_code)
+static void font_cache_remove(
+    struct font_cache* fcache,
+    short e)
 {
-    struct font_cache_entry* p;
-    short *index = fcache->_index;
-
-    p = lru_data(&fcache->_lru, index[0]);
-    if (char_code < p->_char_code)
-        return -1;
-
-    p = lru_data(&fcache->_lru, index[fcache->_capacity - 1]);
-    if (char_code > p->_char_code)
-        return fcache->_capacity - 1;
+    unsigned mask = fcache->_hash_mask;
+    unsigned slot = font_cache_hash(fcache, ENTRY(fcache, e)->_char_code);
+    unsigned next;
 
-    int left, right, mid, c;
+    while (fcache->_table[slot] != e)
+        slot = (slot + 1) & mask;
 
-    left = 0;
-    right = fcache->_capacity - 1;
-
-    do
+    /* shift back the entries of the probe sequence that follows, so that
+     * no tombstones are needed */
+    next = slot;
+    while (1)
     {
-        mid = (left + right) / 2;
-
-        p = lru_data(&fcache->_lru, index[mid]);
-        c = char_code - p->_char_code;
+        unsigned home;
 
-        if (c >= 0)
+        fcache->_table[slot] = -1;
+        do
         {
-            p = lru_data(&fcache->_lru, index[mid+1]);
-            int z = char_code - p->_char_code;
-
-            if (z < 0)
-                return mid;
-
-            if (z == 0)
-                return mid + 1;
+            next = (next + 1) & mask;
+            if (fcache->_table[next] < 0)
+                return;
+            home = font_cache_hash(fcache,
+                        ENTRY(fcache, fcache->_table[next])->_char_code);
         }
+        /* leave it if its home lies cyclically in (slot, next] */
+        while (slot <= next ? (slot < home && home <= next)
+                            : (slot < home || home <= next));
 
-        
-        if (c > 0)
-            left = mid + 1;
-        else
-            right = mid - 1;
+        fcache->_table[slot] = fcache->_table[next];
+        slot = next;
     }
-    while (left <= right);
-
-    /* not found */
-    return -2;
 }
 
 /*******************************************************************************
@@ -163,53 +152,115 @@ struct font_cache_entry* font_cache_get(
     void (*callback) (struct font_cache_entry* p, void *callback_data),
     void *callback_data)
 {
-    int insertion_point = font_cache_insertion_point(fcache, char_code);
-    if (insertion_point >= 0)
+    struct font_cache_entry* p;
+    unsigned slot;
+    short e = font_cache_lookup(fcache, char_code);
+
+    if (e >= 0)
     {
-        short lru_handle = fcache->_index[insertion_point];
-        struct font_cache_entry* p = lru_data(&fcache->_lru, lru_handle);
-        if (p->_char_code == char_code)
-        {
-            lru_touch(&fcache->_lru, lru_handle);
-            return lru_data(&fcache->_lru, lru_handle);
-        }
+        fcache->_referenced[e] = 1;
+        return ENTRY(fcache, e);
     }
 
     /* not found */
-    short lru_handle_to_replace = fcache->_lru._head;
-    struct font_cache_entry* p =
-        lru_data(&fcache->_lru, lru_handle_to_replace);
-    int index_to_replace = font_cache_index_of(fcache, p->_char_code);
-
-    if (insertion_point < index_to_replace)
+    if (fcache->_size < fcache->_capacity)
     {
-        /* shift memory up */
-        memmove(fcache->_index + insertion_point + 2,
-                fcache->_index + insertion_point + 1,
-                (index_to_replace - insertion_point - 1) * sizeof(short));
-
-        /* add to index */
-        fcache->_index[insertion_point + 1] = lru_handle_to_replace;
+        e = fcache->_size++;
     }
-    else if (insertion_point > index_to_replace)
+    else
     {
-        /* shift memory down */
-        memmove(fcache->_index + index_to_replace,
-                fcache->_index + index_to_replace + 1,
-                (insertion_point - index_to_replace) * sizeof(short));
-
-        /* add to index */
-        fcache->_index[insertion_point] = lru_handle_to_replace;
+        /* give entries used since the hand last passed a second chance */
+        while (fcache->_referenced[fcache->_hand])
+        {
+            fcache->_referenced[fcache->_hand] = 0;
+            if (++fcache->_hand >= fcache->_capacity)
+                fcache->_hand = 0;
+        }
+        e = fcache->_hand;
+        if (++fcache->_hand >= fcache->_capacity)
+            fcache->_hand = 0;
+        font_cache_remove(fcache, e);
     }
 
-    /* load new entry into cache */
-    lru_touch(&fcache->_lru, lru_handle_to_replace);
-
-    if (fcache->_size < fcache->_capacity)
-        fcache->_size++;
+    slot = font_cache_hash(fcache, char_code);
+    while (fcache->_table[slot] >= 0)
+        slot = (slot + 1) & fcache->_hash_mask;
+    fcache->_table[slot] = e;
+    fcache->_referenced[e] = 1;
 
+    /* load new entry into cache */
+    p = ENTRY(fcache, e);
     p->_char_code = char_code;
     callback(p, callback_data);
 
     return p;
 }
+
+/*******************************************************************************
+ * font_cache_find
+ ******************************************************************************/
+struct font_cache_entry* font_cache_find(
+    struct font_cache* fcache,
+    unsigned short char_code)
+{
+    short e = font_cache_lookup(fcache, char_code);
+
+    if (e < 0)
+        return NULL;
+
+    fcache->_referenced[e] = 1;
+    return ENTRY(fcache, e);
+}
+
+/*******************************************************************************
+ * font_cache_peek
+ ******************************************************************************/
+struct font_cache_entry* font_cache_peek(
+    struct font_cache* fcache,
+    short handle,
+    unsigned short char_code)
+{
+    struct font_cache_entry* p;
+
+    if (handle < 0 || handle >= fcache->_size)
+        return NULL;
+
+    p = ENTRY(fcache, handle);
+    if (p->_char_code != char_code)
+        return NULL;
+
+    fcache->_referenced[handle] = 1;
+    return p;
+}
+
+/*******************************************************************************
+ * font_cache_handle
+ ******************************************************************************/
+short font_cache_handle(
+    struct font_cache* fcache,
+    struct font_cache_entry* p)
+{
+    return ((unsigned char*)p - fcache->_entries) / fcache->_entry_size;
+}
+
+/*******************************************************************************
+ * font_cache_traverse
+ ******************************************************************************/
+void font_cache_traverse(
+    struct font_cache* fcache,
+    void (*callback)(void* data))
+{
+    int pass, i, e;
+
+    /* the entries the hand would reuse first are the oldest, those used
+     * since it last passed come after them */
+    for (pass = 0; pass < 2; pass++)
+    {
+        for (i = 0; i < fcache->_size; i++)
+        {
+            e = (fcache->_hand + i) % fcache->_size;
+            if (fcache->_referenced[e] == pass)
+                callback(ENTRY(fcache, e));
+        }
+    }
+}
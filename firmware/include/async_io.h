@@ -0,0 +1,110 @@
+/***************************************************************************
+ *             __________               __   ___.
+ *   Open      \______   \ ____   ____ |  | _\_ |__   _______  ___
+ *   Source     |       _//  _ \_/ ___\|  |/ /| __ \ /  _ \  \/  /
+ *   Jukebox    |    |   (  <_> )  \___|    < | \_\ (  <_> > <  <
+ *   Firmware   |____|_  /\____/ \___  >__|_ \|___  /\____/__/\_ \
+ *                     \/            \/     \/    \/            \/
+ * $Id$
+ *
+ * Copyright (C) 2012 The Rockbox Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ****************************************************************************/
+
+#ifndef _ASYNC_IO_H_
+#define _ASYNC_IO_H_
+
+#include "config.h"
+
+#ifdef HAVE_ASYNC_IO
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "kernel.h"
+#include "mv.h"
+
+/* Reads that are submitted here are carried out by the async I/O thread
+ * while the submitting thread goes on with its own work. The storage
+ * drivers themselves are synchronous, so a single worker thread serves the
+ * requests one after the other in the order they were submitted. */
+
+enum async_io_state
+{
+    ASYNC_IO_IDLE = 0,      /* never submitted */
+    ASYNC_IO_QUEUED,        /* waiting for the worker */
+    ASYNC_IO_BUSY,          /* being carried out right now */
+    ASYNC_IO_DONE,          /* finished, result is valid */
+    ASYNC_IO_CANCELLED,     /* removed from the queue before it started */
+};
+
+struct async_io_request;
+
+/* Called from the async I/O thread once the request has finished but before
+ * it is marked done, so it must not block for long */
+typedef void (*async_io_callback)(struct async_io_request *req);
+
+/* The caller owns the request and must keep it around, and must leave the
+ * file or buffer alone, until it is done or was cancelled */
+struct async_io_request
+{
+    struct async_io_request *next;  /* queue link */
+    volatile int state;             /* enum async_io_state */
+    long result;                    /* bytes or sectors read, < 0 on error */
+    async_io_callback callback;     /* may be NULL */
+    void *data;                     /* for use by the callback */
+    /* private */
+    bool sectors;                   /* storage read instead of a file read */
+    int fd;                         /* file, or drive for a storage read */
+    unsigned long start;            /* first sector for a storage read */
+    void *buf;
+    long count;
+#ifdef HAVE_PRIORITY_SCHEDULING
+    int priority;                   /* of the submitting thread */
+#endif
+#ifdef HAVE_IO_PRIORITY
+    int io_priority;
+#endif
+    struct semaphore done;
+};
+
+void async_io_init(void) INIT_ATTR;
+
+/* Queue a read of count bytes from the current position of fd into buf.
+ * Returns 0 when the request was queued, or < 0 if it could not be, in
+ * which case it is already done with a negative result */
+int read_async(struct async_io_request *req, int fd, void *buf,
+               size_t count, async_io_callback callback, void *data);
+
+#if (CONFIG_PLATFORM & PLATFORM_NATIVE)
+/* Same as above for storage_read_sectors() */
+int storage_read_sectors_async(struct async_io_request *req,
+                               IF_MD2(int drive,) unsigned long start,
+                               int count, void *buf,
+                               async_io_callback callback, void *data);
+#endif
+
+/* Returns the enum async_io_state of req */
+static inline int async_io_poll(const struct async_io_request *req)
+{
+    return req->state;
+}
+
+/* Remove req from the queue if it hasn't started yet.
+ * Returns false if it is already in progress or done */
+bool async_io_cancel(struct async_io_request *req);
+
+/* Wait up to timeout ticks for req to finish.
+ * Returns true if it is done (or was cancelled) */
+bool async_io_wait(struct async_io_request *req, int timeout);
+
+#endif /* HAVE_ASYNC_IO */
+
+#endif /* _ASYNC_IO_H_ */
@@ -32,6 +32,7 @@
 
 #define DIRCACHE_APPFLAG_TAGCACHE  0x0001
 #define DIRCACHE_APPFLAG_PLAYLIST  0x0002
+#define DIRCACHE_APPFLAG_TREEWALK  0x0004
 
 /* Internal structures. */
 struct travel_data {
@@ -75,10 +76,15 @@ int dircache_get_entry_count(void);
 int dircache_get_cache_size(void);
 int dircache_get_reserve_used(void);
 int dircache_get_build_ticks(void);
+unsigned long dircache_get_modification_stamp(bool include_times);
 void dircache_disable(void);
 void dircache_suspend(void);
 bool dircache_resume(void);
 int dircache_get_entry_id(const char *filename);
+int dircache_get_first_entry_id(int id);
+int dircache_get_next_entry_id(int id);
+int dircache_get_parent_id(int id);
+const char* dircache_get_entry_name(int id);
 size_t dircache_copy_path(int index, char *buf, size_t size);
 
 /* the next two are internal for file.c */
@@ -101,6 +101,35 @@ extern int rename(const char* path, const char* newname);
 extern int ftruncate(int fd, off_t length);
 extern off_t filesize(int fd);
 extern int release_files(int volume);
+#if (CONFIG_PLATFORM & PLATFORM_NATIVE) && !defined(__PCTOOL__)
+/* Reserve disk space so the file can grow to size bytes without allocating
+   as it is written, in as few contiguous pieces as possible. Whatever isn't
+   written is given back on close */
+extern int file_preallocate(int fd, off_t size);
+/* Write date (high 16 bits) and time (low 16 bits) of the file as found in
+   its directory entry when it was opened */
+extern int file_get_mtime(int fd, unsigned long* mtime);
+#else
+/* the host file system allocates as it sees fit */
+static inline int file_preallocate(int fd, off_t size)
+{
+    (void)fd;
+    (void)size;
+    return 0;
+}
+#endif
+
+/* Counters of the block cache shared by all open files */
+struct file_cache_stats
+{
+    unsigned long hits;      /* sectors found in the cache */
+    unsigned long misses;    /* sectors that had to be read */
+    unsigned long reads;     /* storage reads done to fill the cache */
+    unsigned long coalesced; /* written sectors collected in the cache */
+    unsigned long writes;    /* storage writes done to flush them */
+};
+extern void file_cache_init(void);
+extern void file_cache_get_stats(struct file_cache_stats* stats);
 int fdprintf (int fd, const char *fmt, ...) ATTRIBUTE_PRINTF(2, 3);
 #endif /* !CODEC && !PLUGIN */
 #endif
@@ -19,17 +19,23 @@
  ****************************************************************************/
 #ifndef _FONT_CACHE_H_
 #define _FONT_CACHE_H_
-#include "lru.h"
+#include <stdbool.h>
 
 /*******************************************************************************
- * 
+ * Glyph cache: a fixed array of entries found through an open addressed
+ * hash table of char codes, recycled with the clock (second chance) algorithm
  ******************************************************************************/
 struct font_cache
 {
-    struct lru _lru;
-    int _size;
-    int _capacity;
-    short *_index; /* index of lru handles in char_code order */
+    int _size;          /* entries in use */
+    int _capacity;      /* entries available */
+    int _entry_size;
+    int _hand;          /* clock hand, next entry considered for reuse */
+    int _hash_shift;    /* 32 - log2(table size) */
+    unsigned _hash_mask;
+    short *_table;      /* entry indexes, -1 for empty slots */
+    unsigned char *_entries;
+    unsigned char *_referenced; /* one flag per entry */
 };
 
 struct font_cache_entry
@@ -39,15 +45,37 @@ struct font_cache_entry
     unsigned char bitmap[1]; /* place holder */
 };
 
+/* Bytes needed per entry on top of the entry itself, at worst: the
+ * referenced flag and a table of less than 8/3 slots per entry */
+#define FONT_CACHE_ENTRY_OVERHEAD (3 * sizeof(short) + 1)
+
 /* void (*f) (void*, struct font_cache_entry*); */
 /* Create an auto sized font cache from buf */
 void font_cache_create(
     struct font_cache* fcache, void* buf, int buf_size, int bitmap_bytes_size);
-/* Get font cache entry */
+/* Get font cache entry, loading it through callback if it isn't cached */
 struct font_cache_entry* font_cache_get(
     struct font_cache* fcache,
     unsigned short char_code,
     void (*callback) (struct font_cache_entry* p, void *callback_data),
     void *callback_data);
+/* Get font cache entry if it is cached, NULL otherwise */
+struct font_cache_entry* font_cache_find(
+    struct font_cache* fcache,
+    unsigned short char_code);
+/* Get the entry at a handle remembered from an earlier font_cache_get(),
+ * NULL if it has been reused for another char since */
+struct font_cache_entry* font_cache_peek(
+    struct font_cache* fcache,
+    short handle,
+    unsigned short char_code);
+/* Handle of an entry, to be passed to font_cache_peek() later */
+short font_cache_handle(
+    struct font_cache* fcache,
+    struct font_cache_entry* p);
+/* Visit the entries in use, roughly from least to most recently used */
+void font_cache_traverse(
+    struct font_cache* fcache,
+    void (*callback)(void* data));
 
 #endif
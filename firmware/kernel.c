@@ -28,6 +28,7 @@
 #include "panic.h"
 #include "debug.h"
 #include "general.h"
+#include "sched_trace.h"
 
 /* Make this nonzero to enable more elaborate checks on objects */
 #if defined(DEBUG) || defined(SIMULATOR)
@@ -231,6 +232,8 @@ unsigned sleep(unsigned ticks)
     if (SLEEP_KERNEL_HOOK(ticks))
         return 0; /* Handled */
 
+    SCHED_TRACE_BLOCK(thread_self_entry(), SCHED_BLOCK_SLEEP);
+
     disable_irq();
     sleep_thread(ticks);
     switch_thread();
@@ -534,6 +537,7 @@ void queue_wait(struct event_queue *q, struct queue_event *ev)
         IF_COP( current->obj_cl = &q->cl; )
         current->bqp = &q->queue;
 
+        SCHED_TRACE_BLOCK(current, SCHED_BLOCK_QUEUE);
         block_thread(current);
 
         corelock_unlock(&q->cl);
@@ -588,6 +592,7 @@ void queue_wait_w_tmo(struct event_queue *q, struct queue_event *ev, int ticks)
         IF_COP( current->obj_cl = &q->cl; )
         current->bqp = &q->queue;
 
+        SCHED_TRACE_BLOCK(current, SCHED_BLOCK_QUEUE);
         block_thread_w_tmo(current, ticks);
         corelock_unlock(&q->cl);    
 
@@ -695,6 +700,7 @@ intptr_t queue_send(struct event_queue *q, long id, intptr_t data)
         current->retval = (intptr_t)spp;
         current->bqp = &send->list;
 
+        SCHED_TRACE_BLOCK(current, SCHED_BLOCK_QUEUE_SEND);
         block_thread(current);
 
         corelock_unlock(&q->cl);
@@ -1050,6 +1056,7 @@ void mutex_lock(struct mutex *m)
     IF_PRIO( current->blocker = &m->blocker; )
     current->bqp = &m->queue;
 
+    SCHED_TRACE_BLOCK(current, SCHED_BLOCK_MUTEX);
     disable_irq();
     block_thread(current);
 
@@ -1157,6 +1164,7 @@ int semaphore_wait(struct semaphore *s, int timeout)
          * explicit in semaphore_release */
         current->retval = OBJ_WAIT_TIMEDOUT;
 
+        SCHED_TRACE_BLOCK(current, SCHED_BLOCK_SEMAPHORE);
         if(timeout > 0)
             block_thread_w_tmo(current, timeout); /* ...or timed out... */
         else
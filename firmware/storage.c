@@ -20,6 +20,7 @@
  ****************************************************************************/
 #include "storage.h"
 #include "kernel.h"
+#include "sched_trace.h"
 
 #ifdef CONFIG_STORAGE_MULTI
 
@@ -36,60 +37,219 @@ static unsigned int num_drives;
 
 #ifdef HAVE_IO_PRIORITY
 
+/* Transfers don't reach the driver in the order they are asked for. While
+ * one is going on, the others queue up per drive. When it is done the drive
+ * goes to the request that is furthest past its deadline, or if none is late
+ * to the one with the best I/O priority, ties going to the closest sector
+ * ahead of the last transfer. The thread that asked does its own transfer
+ * once it has been given the drive.
+ * Right after a transfer, the drive is also kept from requests with a worse
+ * priority for a little while, so that a thread reading a file piece by
+ * piece isn't interrupted by background work between pieces. */
+
 /* Same for flash? */
 #define STORAGE_MINIMUM_IDLE_TIME (HZ/10)
 #define STORAGE_DELAY_UNIT  (HZ/20)
 
-static unsigned int storage_last_thread[NUM_DRIVES];
-static unsigned int storage_last_activity[NUM_DRIVES];
+struct storage_request
+{
+    struct storage_request *next;
+    unsigned long start;        /* first sector */
+    long queued;                /* tick the request was made */
+    long deadline;              /* tick by which it should have the drive */
+    int prio;                   /* I/O priority of the requesting thread */
+    bool granted;               /* the drive is ours */
+    struct semaphore wakeup;    /* released when granted or to re-check */
+};
+
+struct storage_queue
+{
+    struct storage_request *head; /* waiting requests, oldest first */
+    bool busy;                    /* a transfer is going on */
+    unsigned long position;       /* sector after the last transfer */
+    unsigned int last_thread;     /* thread of the last transfer */
+    long last_activity;           /* tick the last transfer ended */
+    struct storage_queue_stats stats;
+};
+
+static struct storage_queue storage_queues[NUM_DRIVES];
+static struct mutex storage_queue_mutex;
+static bool storage_queue_initialized = false;
+
+static int storage_class(int prio)
+{
+    return prio >= IO_PRIORITY_BACKGROUND ? STORAGE_CLASS_BACKGROUND
+                                          : STORAGE_CLASS_FOREGROUND;
+}
 
-static bool storage_should_wait(int drive, int prio)
+/* true if a thread with a better priority was using the drive very
+   recently and should get it back first */
+static bool storage_should_wait(struct storage_queue *q, int prio)
 {
-    int other_prio = thread_get_io_priority(storage_last_thread[drive]);
-    if(TIME_BEFORE(current_tick,storage_last_activity[drive]+STORAGE_MINIMUM_IDLE_TIME))
-    {
-        if(prio<=other_prio)
-        {
-            /* There is another active thread, but we have lower priority */
-            return false;
-        }
-        else
-        {
-            /* There is another active thread, but it has lower priority */
-            return true;
-        }
-    }
-    else
+    int other_prio = thread_get_io_priority(q->last_thread);
+    return prio > other_prio &&
+        TIME_BEFORE(current_tick, q->last_activity + STORAGE_MINIMUM_IDLE_TIME);
+}
+
+/* true if request a should go before request b */
+static bool storage_before(struct storage_queue *q,
+                           struct storage_request *a,
+                           struct storage_request *b)
+{
+    bool a_late = TIME_AFTER(current_tick, a->deadline);
+    bool b_late = TIME_AFTER(current_tick, b->deadline);
+
+    if (a_late || b_late)
+        return a_late && (!b_late || TIME_BEFORE(a->deadline, b->deadline));
+
+    if (a->prio != b->prio)
+        return a->prio < b->prio;
+
+    /* going up from the current position, wrapping at the end */
+    return a->start - q->position < b->start - q->position;
+}
+
+/* Hand the idle drive to the most urgent waiting request, if it may have
+   it now. If it may not, wake it anyway when nudge is set so it can wait for
+   its turn with a timeout. Called with the queue mutex held */
+static void storage_dispatch(struct storage_queue *q, bool nudge)
+{
+    struct storage_request *r, **best = NULL, **pp;
+
+    for (pp = &q->head; (r = *pp); pp = &r->next)
+        if (!best || storage_before(q, r, *best))
+            best = pp;
+
+    if (!best)
+        return;
+
+    r = *best;
+    if (!TIME_AFTER(current_tick, r->deadline) &&
+        storage_should_wait(q, r->prio))
     {
-        /* There's nothing going on anyway */
-        return false;
+        /* not yet, have it check again when the wait is over */
+        if (nudge)
+            semaphore_release(&r->wakeup);
+        return;
     }
+
+    if (TIME_AFTER(current_tick, r->deadline))
+        q->stats.late++;
+
+    *best = r->next;
+    q->stats.depth--;
+    q->busy = true;
+    r->granted = true;
+    semaphore_release(&r->wakeup);
 }
 
-static void storage_wait_turn(IF_MD_NONVOID(int drive))
+static void storage_wait_turn(IF_MD2(int drive,) unsigned long start)
 {
 #ifndef HAVE_MULTIDRIVE
     int drive=0;
 #endif
-    int my_prio = thread_get_io_priority(thread_self());
-    int loops=my_prio;
-    while(storage_should_wait(drive, my_prio) && (loops--)>=0)
+    struct storage_queue *q = &storage_queues[drive];
+    struct storage_request req, **pp;
+    int class;
+    long waited;
+
+    if (!storage_queue_initialized)
+    {
+        mutex_init(&storage_queue_mutex);
+        storage_queue_initialized = true;
+    }
+
+    req.prio = thread_get_io_priority(thread_self());
+    class = storage_class(req.prio);
+
+    mutex_lock(&storage_queue_mutex);
+    q->stats.requests[class]++;
+
+    if (!q->busy && !q->head && !storage_should_wait(q, req.prio))
+    {
+        /* nobody in the way */
+        q->busy = true;
+        mutex_unlock(&storage_queue_mutex);
+        return;
+    }
+
+    req.next = NULL;
+    req.start = start;
+    req.queued = current_tick;
+    req.deadline = req.queued + req.prio*STORAGE_DELAY_UNIT;
+    req.granted = false;
+    semaphore_init(&req.wakeup, 1, 0);
+
+    for (pp = &q->head; *pp; pp = &(*pp)->next);
+    *pp = &req;
+    if (++q->stats.depth > q->stats.max_depth)
+        q->stats.max_depth = q->stats.depth;
+
+    /* An idle drive with requests queued means they are held back for
+       another thread that used it last, which may well be us. Don't wait
+       behind them when we are the one they wait for. */
+    if (!q->busy)
+        storage_dispatch(q, false);
+
+    while (!req.granted)
     {
-        sleep(STORAGE_DELAY_UNIT);
+        int timeout = TIMEOUT_BLOCK;
+
+        /* If the drive is idle we are only held back by another thread
+           that may want it again, don't wait beyond that */
+        if (!q->busy)
+        {
+            timeout = q->last_activity + STORAGE_MINIMUM_IDLE_TIME
+                    - current_tick;
+            if (timeout < 1)
+                timeout = 1;
+        }
+
+        mutex_unlock(&storage_queue_mutex);
+        semaphore_wait(&req.wakeup, timeout);
+        mutex_lock(&storage_queue_mutex);
+
+        if (!req.granted && !q->busy)
+            storage_dispatch(q, false);
     }
 
-    storage_last_thread[drive] = thread_self();
-    storage_last_activity[drive] = current_tick;
+    waited = current_tick - req.queued;
+    q->stats.waited[class]++;
+    q->stats.wait_ticks[class] += waited;
+    if (waited > q->stats.max_wait[class])
+        q->stats.max_wait[class] = waited;
+
+    mutex_unlock(&storage_queue_mutex);
 }
+
+static void storage_done(IF_MD2(int drive,) unsigned long end)
+{
+#ifndef HAVE_MULTIDRIVE
+    int drive=0;
 #endif
+    struct storage_queue *q = &storage_queues[drive];
 
-int storage_read_sectors(IF_MD2(int drive,) unsigned long start, int count,
-                         void* buf)
+    mutex_lock(&storage_queue_mutex);
+    q->busy = false;
+    q->position = end;
+    q->last_thread = thread_self();
+    q->last_activity = current_tick;
+    storage_dispatch(q, true);
+    mutex_unlock(&storage_queue_mutex);
+}
+
+void storage_get_queue_stats(IF_MD2(int drive,) struct storage_queue_stats *stats)
 {
-#ifdef HAVE_IO_PRIORITY
-    storage_wait_turn(IF_MD(drive));
+#ifndef HAVE_MULTIDRIVE
+    int drive=0;
 #endif
+    *stats = storage_queues[drive].stats;
+}
+#endif /* HAVE_IO_PRIORITY */
 
+static int do_read_sectors(IF_MD2(int drive,) unsigned long start, int count,
+                           void* buf)
+{
 #ifdef CONFIG_STORAGE_MULTI
     int driver=(storage_drivers[drive] & DRIVER_MASK)>>DRIVER_OFFSET;
     int ldrive=(storage_drivers[drive] & DRIVE_MASK)>>DRIVE_OFFSET;
@@ -129,13 +289,9 @@ int storage_read_sectors(IF_MD2(int drive,) unsigned long start, int count,
 
 }
 
-int storage_write_sectors(IF_MD2(int drive,) unsigned long start, int count,
-                          const void* buf)
+static int do_write_sectors(IF_MD2(int drive,) unsigned long start, int count,
+                            const void* buf)
 {
-#ifdef HAVE_IO_PRIORITY
-    storage_wait_turn(IF_MD(drive));
-#endif
-
 #ifdef CONFIG_STORAGE_MULTI
     int driver=(storage_drivers[drive] & DRIVER_MASK)>>DRIVER_OFFSET;
     int ldrive=(storage_drivers[drive] & DRIVE_MASK)>>DRIVE_OFFSET;
@@ -174,6 +330,38 @@ int storage_write_sectors(IF_MD2(int drive,) unsigned long start, int count,
 #endif /* CONFIG_STORAGE_MULTI */
 }
 
+int storage_read_sectors(IF_MD2(int drive,) unsigned long start, int count,
+                         void* buf)
+{
+    int rc;
+#ifdef HAVE_IO_PRIORITY
+    storage_wait_turn(IF_MD2(drive,) start);
+#endif
+    SCHED_TRACE_IO(false, start, count);
+    rc = do_read_sectors(IF_MD2(drive,) start, count, buf);
+    SCHED_TRACE_IO_DONE();
+#ifdef HAVE_IO_PRIORITY
+    storage_done(IF_MD2(drive,) start + count);
+#endif
+    return rc;
+}
+
+int storage_write_sectors(IF_MD2(int drive,) unsigned long start, int count,
+                          const void* buf)
+{
+    int rc;
+#ifdef HAVE_IO_PRIORITY
+    storage_wait_turn(IF_MD2(drive,) start);
+#endif
+    SCHED_TRACE_IO(true, start, count);
+    rc = do_write_sectors(IF_MD2(drive,) start, count, buf);
+    SCHED_TRACE_IO_DONE();
+#ifdef HAVE_IO_PRIORITY
+    storage_done(IF_MD2(drive,) start + count);
+#endif
+    return rc;
+}
+
 #ifdef CONFIG_STORAGE_MULTI
 
 #define DRIVER_MASK     0xff000000
@@ -25,6 +25,7 @@
 #include "thread.h"
 #include "string.h"
 #include "file.h"
+#include "sched_trace.h"
 
 #if (CONFIG_PLATFORM & PLATFORM_NATIVE)
 long cpu_frequency SHAREDBSS_ATTR = CPU_FREQ;
@@ -139,6 +140,8 @@ void cpu_boost(bool on_off)
         }
     }
 
+    SCHED_TRACE_BOOST(boost_counter);
+
     corelock_unlock(&boostctrl_cl);
 }
 
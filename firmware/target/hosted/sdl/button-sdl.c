@@ -380,6 +380,15 @@ static void button_event(int key, bool pressed)
             return;
         }
         break;
+#ifdef DO_SCHED_TRACE
+    case SDLK_F6:
+        if(pressed)
+        {
+            sim_trigger_sched_trace_dump();
+            return;
+        }
+        break;
+#endif
 #ifdef HAVE_TOUCHSCREEN
     case SDLK_F4:
         if(pressed)
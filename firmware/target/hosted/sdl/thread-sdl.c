@@ -32,6 +32,7 @@
 #include "kernel.h"
 #include "thread.h"
 #include "debug.h"
+#include "sched_trace.h"
 
 /* Define this as 1 to show informational messages that are not errors. */
 #define THREAD_SDL_DEBUGF_ENABLED 0
@@ -239,6 +240,7 @@ void sim_thread_lock(void *me)
 {
     SDL_LockMutex(m);
     cores[CURRENT_CORE].running = (struct thread_entry *)me;
+    SCHED_TRACE_RUN((struct thread_entry *)me);
 
     if (threads_status != THREADS_RUN)
         thread_exit();
@@ -247,6 +249,7 @@ void sim_thread_lock(void *me)
 void * sim_thread_unlock(void)
 {
     struct thread_entry *current = cores[CURRENT_CORE].running;
+    SCHED_TRACE_STOP(current);
     SDL_UnlockMutex(m);
     return current;
 }
@@ -313,6 +316,8 @@ void switch_thread(void)
 
     enable_irq();
 
+    SCHED_TRACE_STOP(current);
+
     switch (current->state)
     {
     case STATE_RUNNING:
@@ -382,6 +387,7 @@ void switch_thread(void)
         } /* STATE_SLEEPING: */
     }
 
+    SCHED_TRACE_RUN(current);
     cores[CURRENT_CORE].running = current;
 
     if (threads_status != THREADS_RUN)
@@ -489,6 +495,7 @@ int runthread(void *data)
 
         if (threads_status == THREADS_RUN)
         {
+            SCHED_TRACE_RUN(current);
             current->context.start();
             THREAD_SDL_DEBUGF("Thread Done: %d (%s)\n",
                               current - threads, THREAD_SDL_GET_NAME(current));
@@ -617,6 +624,7 @@ void remove_thread(unsigned int thread_id)
 
     if (thread == current)
     {
+        SCHED_TRACE_STOP(current);
         /* Do a graceful exit - perform the longjmp back into the thread
            function to return */
         restore_irq(oldlevel);
@@ -648,6 +656,7 @@ void thread_wait(unsigned int thread_id)
     if (thread->id == thread_id && thread->state != STATE_KILLED)
     {
         current->bqp = &thread->queue;
+        SCHED_TRACE_BLOCK(current, SCHED_BLOCK_THREAD);
         block_thread(current);
         switch_thread();
     }
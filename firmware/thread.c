@@ -28,6 +28,7 @@
 #include "cpu.h"
 #include "string.h"
 #include "buffer.h"
+#include "sched_trace.h"
 #ifdef RB_PROFILE
 #include <profile.h>
 #endif
@@ -1159,6 +1160,8 @@ void switch_thread(void)
 #endif
 #endif
 
+    SCHED_TRACE_STOP(thread);
+
     /* Begin task switching by saving our current context so that we can
      * restore the state of the current thread later to the point prior
      * to this call. */
@@ -1274,6 +1277,8 @@ void switch_thread(void)
         }
     }
 
+    SCHED_TRACE_RUN(thread);
+
     /* And finally give control to the next thread. */
     load_context(&thread->context);
 
@@ -1698,6 +1703,7 @@ void thread_wait(unsigned int thread_id)
         IF_COP( current->obj_cl = &thread->waiter_cl; )
         current->bqp = &thread->queue;
 
+        SCHED_TRACE_BLOCK(current, SCHED_BLOCK_THREAD);
         disable_irq();
         block_thread(current);
 
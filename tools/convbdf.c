@@ -1405,10 +1405,11 @@ int gen_c_source(struct font* pf, char *path)
             "  0,  /* ^ position */\n"
             "  0,  /* ^ end */\n"
             "  0,  /* ^ size  */\n"
-            "  {{0,0,0,0,0},0,0,0},   /* cache  */\n"
+            "  {0,0,0,0,0,0,0,0,0},   /* cache  */\n"
             "  0,  /*   */\n"
             "  0,  /*   */\n"
             "  0,  /*   */\n"
+            "  {0},  /* atlas */\n"
             "};\n"
             "#endif /* HAVE_LCD_BITMAP */\n",
             pf->maxwidth, pf->height,
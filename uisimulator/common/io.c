@@ -59,6 +59,7 @@
 #include "ata.h" /* for IF_MV2 et al. */
 #include "rbpaths.h"
 #include "load_code.h"
+#include "sched_trace.h"
 
 /* keep this in sync with file.h! */
 #undef MAX_PATH /* this avoids problems when building simulator */
@@ -249,6 +250,9 @@ static ssize_t io_trigger_and_wait(enum io_dir cmd)
     void *mythread = NULL;
     ssize_t result;
 
+    /* while this thread is still the current one */
+    SCHED_TRACE_IO(cmd == IO_WRITE, io.fd, io.count);
+
     if (io.count > IO_YIELD_THRESHOLD ||
         (io.accum += io.count) >= IO_YIELD_THRESHOLD)
     {
@@ -276,6 +280,8 @@ static ssize_t io_trigger_and_wait(enum io_dir cmd)
         sim_thread_lock(mythread);
     }
 
+    SCHED_TRACE_IO_DONE();
+
     return result;
 }
 
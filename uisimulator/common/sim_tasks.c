@@ -25,6 +25,8 @@
 #include "kernel.h"
 #include "screendump.h"
 #include "thread.h"
+#include "debug.h"
+#include "sched_trace.h"
 
 static void sim_thread(void);
 static long sim_thread_stack[DEFAULT_STACK_SIZE/sizeof(long)];
@@ -35,6 +37,9 @@ static struct event_queue sim_queue;
 /* possible events for the sim thread */
 enum {
     SIM_SCREENDUMP,
+#ifdef DO_SCHED_TRACE
+    SIM_SCHED_TRACE_DUMP,
+#endif
 };
 
 void sim_thread(void)
@@ -52,6 +57,14 @@ void sim_thread(void)
                 remote_screen_dump();
 #endif
                 break;
+#ifdef DO_SCHED_TRACE
+            case SIM_SCHED_TRACE_DUMP:
+                if (sched_trace_dump(SCHED_TRACE_FILE) < 0)
+                    DEBUGF("Could not write " SCHED_TRACE_FILE "\n");
+                else
+                    DEBUGF("Wrote " SCHED_TRACE_FILE "\n");
+                break;
+#endif
         }
     }
 }
@@ -68,3 +81,10 @@ void sim_trigger_screendump(void)
 {
     queue_post(&sim_queue, SIM_SCREENDUMP, 0);
 }
+
+#ifdef DO_SCHED_TRACE
+void sim_trigger_sched_trace_dump(void)
+{
+    queue_post(&sim_queue, SIM_SCHED_TRACE_DUMP, 0);
+}
+#endif
@@ -23,3 +23,6 @@
 
 void sim_tasks_init(void);
 void sim_trigger_screendump(void);
+#ifdef DO_SCHED_TRACE
+void sim_trigger_sched_trace_dump(void);
+#endif